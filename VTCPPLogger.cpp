@@ -5,10 +5,26 @@
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
 
 #include <time.h>
 #include <assert.h>
 
+#if defined(__has_include)
+    #if __has_include(<charconv>)
+        #include <charconv>
+    #endif
+#endif
+
+#if defined(__cpp_lib_to_chars)
+    #define VT_HAS_FLOAT_TO_CHARS
+#endif
+
 #define TIMESTAMP_FORMAT "%Y-%m-%d %H:%M:%S"
 
 #define LL_DEBUG    "Debug"
@@ -17,7 +33,7 @@
 #define LL_ERROR    "Error"
 #define LL_CRITICAL "Critical"
 
-// shut up fopen and localtime security warnings in Visual Studio
+// shut up fopen security warnings in Visual Studio
 #ifdef _MSC_VER
     #pragma warning(push)
     #pragma warning(disable: 4996)
@@ -26,21 +42,44 @@
 
 namespace VT
 {
+    // insert-only hash table: readers walk bucket chains without locking,
+    // writers are serialized and publish new nodes and loggers with release stores
     class LogManager
     {
     private:
         friend VT::Logger get_logger(const std::string& name);
+        friend LoggerHandle get_logger_handle(const std::string& name);
         friend void set_logger(const std::string& name, const Logger& logger);
 
+        struct Node
+        {
+            explicit Node(const std::string& name) : name(name), next(nullptr) { }
+
+            const std::string name;
+            detail_::LoggerSlot slot;
+            std::atomic<Node*> next;
+        };
+
         LogManager();
         ~LogManager();
 
-        std::map<std::string, VT::Logger> loggers_;
+        static LogManager& self();
+
+        Node* find(const std::string& name, size_t bucket) const;
+        Node* find_or_create(const std::string& name);
+
+        static const size_t kBuckets = 256;
+        std::atomic<Node*> buckets_[kBuckets];
+
+        // everything ever published, freed on destruction; replaced loggers have
+        // their stream released, only the Logger object itself stays
+        std::vector<std::unique_ptr<Node>> nodes_;
+        std::vector<std::unique_ptr<Logger>> loggers_;
 
         static LogManager self_;
         static bool self_valid_;
 
-        std::mutex lock_;
+        std::mutex lock_;  // writers
     };
 }
 
@@ -49,13 +88,106 @@ VT::LogManager VT::LogManager::self_;
 bool VT::LogManager::self_valid_ = false;
 
 
-std::string createTimestamp()
+namespace
 {
-    time_t     now      = time(0);
-    struct tm  timeinfo = *localtime(&now);
-    char       buf[80];
-    strftime(buf, sizeof(buf), TIMESTAMP_FORMAT, &timeinfo);
-    return buf;
+    // timestamp formats in use, loggers refer to them by index
+    class TimestampFormats
+    {
+    public:
+        static TimestampFormats& instance()
+        {
+            // leaked, loggers with static storage may log during their destruction
+            static TimestampFormats* formats = new TimestampFormats();
+            return *formats;
+        }
+
+        uint32_t intern(const std::string& format)
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            for (size_t i = 0; i < formats_.size(); ++i)
+            {
+                if (formats_[i] == format)
+                    return static_cast<uint32_t>(i);
+            }
+            formats_.push_back(format);
+            return static_cast<uint32_t>(formats_.size() - 1);
+        }
+
+        std::string get(uint32_t id)
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            return formats_[id];
+        }
+
+    private:
+        TimestampFormats()
+        {
+            formats_.push_back(TIMESTAMP_FORMAT);
+        }
+
+        std::mutex lock_;
+        std::vector<std::string> formats_;
+    };
+
+    // per thread prelude parts, the timestamp is formatted again only when the second changes
+    struct ThreadPrelude
+    {
+        struct Second
+        {
+            Second() : value(-1) { }
+
+            int64_t value;
+            std::string text;
+        };
+
+        ThreadPrelude()
+            : thread_id(VT::safe_sprintf_ret("0x{0:X} ", std::this_thread::get_id()))
+        { }
+
+        const std::string& timestamp(uint32_t format, int64_t second)
+        {
+            if (format >= seconds.size())
+                seconds.resize(format + 1);
+
+            Second& cached = seconds[format];
+            if (cached.value != second)
+            {
+                time_t now = static_cast<time_t>(second);
+                struct tm timeinfo;
+#ifdef _WIN32
+                localtime_s(&timeinfo, &now);
+#else
+                localtime_r(&now, &timeinfo);
+#endif
+                char buf[128];
+                size_t size = strftime(buf, sizeof(buf), TimestampFormats::instance().get(format).c_str(), &timeinfo);
+                cached.text.assign(buf, size);
+                cached.value = second;
+            }
+            return cached.text;
+        }
+
+        const std::string thread_id;
+        std::vector<Second> seconds;  // by format
+    };
+
+    ThreadPrelude& thread_prelude()
+    {
+        static thread_local ThreadPrelude prelude;
+        return prelude;
+    }
+
+    void append_fraction(std::string& out, uint32_t value, int digits)
+    {
+        char buf[10];
+        buf[0] = '.';
+        for (int i = digits; i > 0; --i)
+        {
+            buf[i] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+        out.append(buf, digits + 1);
+    }
 }
 
 
@@ -95,9 +227,89 @@ const char* getLogLevel(VT::LogLevel l)
     }
 }
 
+const char* VT::LogLevel_to_str(LogLevel level)
+{
+    return getLogLevel(level);
+}
+
 
 namespace
 {
+    // JSON string escaping, bytes from 0x80 are passed as is (UTF-8)
+    void append_json_escaped(std::string& out, const char* s, size_t size)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        const char* end = s + size;
+        while (s != end)
+        {
+            const char* run = s;
+            while (s != end && static_cast<unsigned char>(*s) >= 0x20 && *s != '"' && *s != '\\')
+                ++s;
+            out.append(run, s);
+            if (s == end)
+                break;
+
+            const unsigned char c = static_cast<unsigned char>(*s++);
+            out.push_back('\\');
+            switch (c)
+            {
+            case '"':  out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '\n': out.push_back('n'); break;
+            case '\r': out.push_back('r'); break;
+            case '\t': out.push_back('t'); break;
+            case '\b': out.push_back('b'); break;
+            case '\f': out.push_back('f'); break;
+            default:
+                out.append("u00");
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xF]);
+                break;
+            }
+        }
+    }
+
+    // logfmt values are quoted when empty or containing spaces, '=', quotes or control characters
+    bool needs_quotes(const char* s, size_t size)
+    {
+        if (size == 0)
+            return true;
+        for (const char* end = s + size; s != end; ++s)
+        {
+            const unsigned char c = static_cast<unsigned char>(*s);
+            if (c <= ' ' || c == '=' || c == '"' || c == '\\' || c == 0x7F)
+                return true;
+        }
+        return false;
+    }
+
+    // escapes out[pos..] written unescaped (rare characters copy it)
+    void escape_tail(std::string& out, size_t pos, VT::LogFormat format)
+    {
+        const char* tail = out.data() + pos;
+        const size_t size = out.size() - pos;
+
+        if (format == VT::LF_JSON)
+        {
+            bool plain = true;
+            for (size_t i = 0; i < size && plain; ++i)
+                plain = (static_cast<unsigned char>(tail[i]) >= 0x20 && tail[i] != '"' && tail[i] != '\\');
+            if (plain)
+            {
+                out.insert(pos, 1, '"');
+                out.push_back('"');
+                return;
+            }
+        }
+        else if (!needs_quotes(tail, size))
+            return;
+
+        const std::string value(tail, size);
+        out.resize(pos);
+        VT::detail_::append_field_string(out, format, value.data(), value.size());
+    }
+
     bool is_set(unsigned int options, VT::LogOpts opt)
     {
         return (options & opt) == static_cast<unsigned int>(opt);
@@ -125,17 +337,31 @@ struct VT::Logger::Impl
         cout_level  (LL_NoLogging),
         cerr_level  (LL_NoLogging),
         stream_level(LL_NoLogging),
-        options     (LO_Default)
+        options     (LO_Default),
+        async       (false),
+        overflow    (LOF_Block),
+        flush_level (LL_Error),
+        name_prefix ("[" + name + "] "),
+        timestamp_format(0),
+        precision   (LTP_Seconds),
+        format      (LF_Text)
     { }
 
     Impl(const Impl& other) :
         name        (other.name),
         stream      (nullptr),
         stream_lock (),
-        cout_level  (other.cout_level),
-        cerr_level  (other.cerr_level),
-        stream_level(other.stream_level),
-        options     (other.options)
+        cout_level  (other.cout_level.load()),
+        cerr_level  (other.cerr_level.load()),
+        stream_level(other.stream_level.load()),
+        options     (other.options),
+        async       (other.async),
+        overflow    (other.overflow),
+        flush_level (other.flush_level),
+        name_prefix (other.name_prefix),
+        timestamp_format(other.timestamp_format),
+        precision   (other.precision),
+        format      (other.format)
     {
         std::lock_guard<std::mutex> l(stream_lock);
         stream = other.stream;
@@ -150,15 +376,24 @@ struct VT::Logger::Impl
     std::string                    name;
     std::shared_ptr<std::FILE>     stream;
     std::mutex                     stream_lock;
-    LogLevel                       cout_level;
-    LogLevel                       cerr_level;
-    LogLevel                       stream_level;
+    std::atomic<LogLevel>          cout_level;
+    std::atomic<LogLevel>          cerr_level;
+    std::atomic<LogLevel>          stream_level;
+    std::mutex                     level_lock;  // serializes min level updates
     unsigned int                   options;  // LogOpts flags
+    bool                           async;
+    LogOverflow                    overflow;
+    LogLevel                       flush_level;
+    std::string                    name_prefix;       // "[name] "
+    uint32_t                       timestamp_format;  // TimestampFormats index
+    LogTimePrecision               precision;
+    LogFormat                      format;
 };
 
 
 VT::Logger::Logger(const std::string& name)
     : pimpl_(new Impl(name))
+    , min_level_(LL_NoLogging)
 {
 }
 
@@ -169,6 +404,7 @@ VT::Logger::~Logger()
 
 VT::Logger::Logger(const Logger& other)
     : pimpl_(new Impl(*other.pimpl_))
+    , min_level_(other.min_level_.load())
 {
 }
 
@@ -181,17 +417,26 @@ VT::Logger& VT::Logger::operator=(Logger other)
 void VT::Logger::swap(Logger& other)
 {
     std::swap(pimpl_, other.pimpl_);
+    min_level_.store(other.min_level_.exchange(min_level_.load()));
 }
 
 
 void VT::Logger::set_cout(LogLevel reporting_level)
 {
     pimpl_->cout_level = reporting_level;
+    update_min_level();
 }
 
 void VT::Logger::set_cerr(LogLevel reporting_level)
 {
     pimpl_->cerr_level = reporting_level;
+    update_min_level();
+}
+
+void VT::Logger::update_min_level()
+{
+    std::lock_guard<std::mutex> l(pimpl_->level_lock);
+    min_level_.store(std::min(pimpl_->cout_level.load(), std::min(pimpl_->cerr_level.load(), pimpl_->stream_level.load())));
 }
 
 bool VT::Logger::set_stream(std::FILE* stream, LogLevel reporting_level)
@@ -201,9 +446,11 @@ bool VT::Logger::set_stream(std::FILE* stream, LogLevel reporting_level)
 
     if (stream)
     {
+        {
+            std::lock_guard<std::mutex> lock(pimpl_->stream_lock);
+            pimpl_->stream = std::shared_ptr<std::FILE>(stream, detail_::close_log_stream);
+        }
         pimpl_->stream_level = reporting_level;
-        std::lock_guard<std::mutex> lock(pimpl_->stream_lock);
-        pimpl_->stream = std::shared_ptr<std::FILE>(stream, std::fclose);
     }
     else
     {
@@ -211,6 +458,7 @@ bool VT::Logger::set_stream(std::FILE* stream, LogLevel reporting_level)
         std::lock_guard<std::mutex> lock(pimpl_->stream_lock);
         pimpl_->stream = nullptr;
     }
+    update_min_level();
 
     return true;
 }
@@ -234,6 +482,51 @@ bool VT::Logger::set_stream(const std::string& filename, LogLevel reporting_leve
     }
 }
 
+bool VT::Logger::set_rotating_stream(const RotatingFileOptions& options, LogLevel reporting_level)
+{
+    assert(reporting_level != LL_NoLogging);
+
+    std::FILE* file = RotatingFile::open(options);
+    if (file)
+        return set_stream(file, reporting_level);
+    else
+        return false;
+}
+
+
+void VT::Logger::set_async(LogOverflow overflow, LogLevel flush_level)
+{
+    pimpl_->async = true;
+    pimpl_->overflow = overflow;
+    pimpl_->flush_level = flush_level;
+}
+
+void VT::Logger::set_sync()
+{
+    // records queued by now keep their place in the output
+    if (pimpl_->async)
+        flush_async_logging();
+    pimpl_->async = false;
+}
+
+bool VT::Logger::is_async() const
+{
+    return pimpl_->async;
+}
+
+
+void VT::Logger::set_timestamp_format(const std::string& format, LogTimePrecision precision)
+{
+    pimpl_->timestamp_format = TimestampFormats::instance().intern(format);
+    pimpl_->precision = precision;
+}
+
+
+void VT::Logger::set_format(LogFormat format)
+{
+    pimpl_->format = format;
+}
+
 
 void VT::Logger::set(LogOpts opt)
 {
@@ -262,44 +555,162 @@ VT::detail_::LogWorker VT::Logger::error()   { return log(LL_Error); }
 VT::detail_::LogWorker VT::Logger::critical(){ return log(LL_Critical); }
 
 
+void VT::Logger::add_timestamp(std::string& out)
+{
+    const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t second = (ns >= 0 ? ns / 1000000000 : (ns - 999999999) / 1000000000);
+    const uint32_t fraction = static_cast<uint32_t>(ns - second * 1000000000);
+
+    out.append(thread_prelude().timestamp(pimpl_->timestamp_format, second));
+    switch (pimpl_->precision)
+    {
+    case LTP_Milliseconds: append_fraction(out, fraction / 1000000, 3); break;
+    case LTP_Microseconds: append_fraction(out, fraction / 1000, 6); break;
+    case LTP_Nanoseconds:  append_fraction(out, fraction, 9); break;
+    default: break;
+    }
+}
+
+
 void VT::Logger::add_prelude(std::string& out, LogLevel level)
 {
+    if (pimpl_->format != LF_Text)
+        return;  // part of the record, see add_record()
+
     if (!is_set(pimpl_->options, LO_NoTimestamp))
-        safe_sprintf(out, "{0} ", createTimestamp());
+    {
+        add_timestamp(out);
+        out.push_back(' ');
+    }
     if (!is_set(pimpl_->options, LO_NoLoggerName))
-        safe_sprintf(out, "[{0}] ", pimpl_->name);
+        out.append(pimpl_->name_prefix);
     if (!is_set(pimpl_->options, LO_NoThreadId))
-        safe_sprintf(out, "0x{0:X} ", std::this_thread::get_id());
+        out.append(thread_prelude().thread_id);
     if (!is_set(pimpl_->options, LO_NoLogLevel))
-        safe_sprintf(out, "<{0}> ", getLogLevel(level));
+    {
+        out.push_back('<');
+        out.append(getLogLevel(level));
+        out.append("> ");
+    }
 }
 
 
-void VT::Logger::add_epilog(std::string& out, LogLevel /*level*/)
+void VT::Logger::add_epilog(std::string& out, LogLevel level)
 {
+    if (pimpl_->format != LF_Text)
+    {
+        // [out] is the bare message
+        detail_::LogBuffer* buffer = detail_::acquire_log_buffer();
+        add_record(buffer->record, pimpl_->format, level, out.data(), out.size(), buffer->fields);
+        out.swap(buffer->record);
+        detail_::release_log_buffer(buffer);
+        return;
+    }
+
     if (!is_set(pimpl_->options, LO_NoEndl))
         out.push_back('\n');
 }
 
 
+void VT::Logger::add_record(std::string& out, LogFormat format, LogLevel level,
+                            const char* msg, size_t msg_size, const std::string& fields)
+{
+    using detail_::append_field_key;
+    using detail_::append_field_string;
+
+    const bool json = (format == LF_JSON);
+    const unsigned int options = pimpl_->options;
+
+    out.clear();
+    if (json)
+        out.push_back('{');
+
+    if (!is_set(options, LO_NoTimestamp))
+    {
+        append_field_key(out, format, "time");
+        const size_t pos = out.size();
+        add_timestamp(out);
+        escape_tail(out, pos, format);
+    }
+    if (!is_set(options, LO_NoLoggerName))
+    {
+        append_field_key(out, format, "logger");
+        append_field_string(out, format, pimpl_->name.data(), pimpl_->name.size());
+    }
+    if (!is_set(options, LO_NoThreadId))
+    {
+        const std::string& thread_id = thread_prelude().thread_id;
+        append_field_key(out, format, "thread");
+        append_field_string(out, format, thread_id.data(), thread_id.size() - 1);  // without the space
+    }
+    if (!is_set(options, LO_NoLogLevel))
+    {
+        const char* name = getLogLevel(level);
+        append_field_key(out, format, "level");
+        append_field_string(out, format, name, std::strlen(name));
+    }
+    append_field_key(out, format, "msg");
+    append_field_string(out, format, msg, msg_size);
+
+    if (!fields.empty())
+    {
+        out.push_back(json ? ',' : ' ');
+        out.append(fields);
+    }
+
+    if (json)
+        out.push_back('}');
+    if (!is_set(options, LO_NoEndl))
+        out.push_back('\n');
+}
+
+
 void VT::Logger::write_to_streams(LogLevel level, const std::string& msg)
 {
+    const bool to_cout = (level >= pimpl_->cout_level.load(std::memory_order_relaxed));
+    const bool to_cerr = (level >= pimpl_->cerr_level.load(std::memory_order_relaxed));
+
+    // own reference, set_stream() may replace or close the stream meanwhile
+    std::shared_ptr<std::FILE> stream;
+    if (level >= pimpl_->stream_level.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(pimpl_->stream_lock);
+        stream = pimpl_->stream;
+    }
+    const bool to_stream = (stream != nullptr);
+
+    if (pimpl_->async)
+    {
+        unsigned targets = 0;
+        if (to_cout)
+            targets |= detail_::LT_Stdout;
+        if (to_cerr)
+            targets |= detail_::LT_Stderr;
+        if (to_stream)
+            targets |= detail_::LT_Stream;
+
+        if (targets == 0 ||
+            detail_::async_write(level, targets, stream.get(), msg, pimpl_->overflow, level >= pimpl_->flush_level))
+            return;
+    }
+
     // fprintf is thread-safe on line level
 
-    if (level >= pimpl_->cout_level)
+    if (to_cout)
     {
         fprintf(stdout, "%s", msg.c_str());
         fflush(stdout);
     }
-    if (level >= pimpl_->cerr_level)
+    if (to_cerr)
     {
         fprintf(stderr, "%s", msg.c_str());
         fflush(stderr);
     }
-    if (level >= pimpl_->stream_level)
+    if (to_stream)
     {
-        fprintf(pimpl_->stream.get(), "%s", msg.c_str());
-        fflush(pimpl_->stream.get());
+        fprintf(stream.get(), "%s", msg.c_str());
+        fflush(stream.get());
     }
 }
 
@@ -310,97 +721,384 @@ void VT::quote(detail_::LogWorker& log_worker)
 }
 
 
-VT::Logger VT::get_logger(const std::string& name)
+VT::LogManager& VT::LogManager::self()
 {
-    if (!LogManager::self_valid_)
+    if (!self_valid_)
     {
         throw std::runtime_error("Trying to get logger after LogManager destruction");
     }
+    return self_;
+}
+
+
+VT::LogManager::Node* VT::LogManager::find(const std::string& name, size_t bucket) const
+{
+    for (Node* node = buckets_[bucket].load(std::memory_order_acquire);
+         node;
+         node = node->next.load(std::memory_order_acquire))
+    {
+        if (node->name == name)
+            return node;
+    }
+    return nullptr;
+}
+
 
-    std::lock_guard<std::mutex> lock(LogManager::self_.lock_);
+VT::LogManager::Node* VT::LogManager::find_or_create(const std::string& name)
+{
+    const size_t bucket = std::hash<std::string>()(name) % kBuckets;
 
-    auto it = LogManager::self_.loggers_.find(name);
-    if (it != LogManager::self_.loggers_.end())
-        return it->second;
+    if (Node* node = find(name, bucket))
+        return node;
 
-    auto pair = LogManager::self_.loggers_.insert(std::make_pair(name, Logger::cout(name)));
-    return pair.first->second;
+    std::lock_guard<std::mutex> lock(lock_);
+
+    if (Node* node = find(name, bucket))
+        return node;  // created by another thread meanwhile
+
+    loggers_.push_back(std::unique_ptr<Logger>(new Logger(Logger::cout(name))));
+    nodes_.push_back(std::unique_ptr<Node>(new Node(name)));
+
+    Node* node = nodes_.back().get();
+    node->slot.logger.store(loggers_.back().get(), std::memory_order_relaxed);
+    node->next.store(buckets_[bucket].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    buckets_[bucket].store(node, std::memory_order_release);
+    return node;
+}
+
+
+VT::Logger VT::get_logger(const std::string& name)
+{
+    return *LogManager::self().find_or_create(name)->slot.logger.load(std::memory_order_acquire);
+}
+
+
+VT::LoggerHandle VT::get_logger_handle(const std::string& name)
+{
+    return LoggerHandle(&LogManager::self().find_or_create(name)->slot);
 }
 
 
 void VT::set_logger(const std::string& name, const Logger& logger)
 {
-    if (!LogManager::self_valid_)
+    LogManager& manager = LogManager::self();
+    LogManager::Node* node = manager.find_or_create(name);
+
+    std::lock_guard<std::mutex> lock(manager.lock_);
+
+    manager.loggers_.push_back(std::unique_ptr<Logger>(new Logger(logger)));
+    Logger* retired = node->slot.logger.exchange(manager.loggers_.back().get(), std::memory_order_acq_rel);
+
+    // a thread still logging through it holds its own reference to the stream or finds none
+    retired->set_stream(nullptr, LL_NoLogging);
+}
+
+
+VT::LogManager::LogManager()
+{
+    for (size_t i = 0; i < kBuckets; ++i)
+        buckets_[i].store(nullptr, std::memory_order_relaxed);
+    self_valid_ = true;
+}
+
+
+VT::LogManager::~LogManager()
+{
+    self_valid_ = false;
+}
+
+
+void VT::detail_::LogBuffer::reset()
+{
+    text.clear();
+    fields.clear();
+    record.clear();
+    stream.clear();
+    stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    stream.precision(6);
+    stream.width(0);
+    stream.fill(' ');
+}
+
+
+namespace
+{
+    // buffers owned by the thread, free ones are reused so a message allocates
+    // only when it outgrows the longest message of the thread so far
+    struct LogBufferPool
     {
-        throw std::runtime_error("Trying to get logger after LogManager destruction");
+        ~LogBufferPool()
+        {
+            for (VT::detail_::LogBuffer* buffer : free)
+                delete buffer;
+        }
+
+        std::vector<VT::detail_::LogBuffer*> free;
+    };
+
+    thread_local LogBufferPool log_buffer_pool;
+
+    template <typename F>
+    void append_streamed(std::string& out, F value, int precision)
+    {
+        std::ostringstream oss;
+        oss.precision(precision);
+        oss << value;
+        out.append(oss.str());
+    }
+
+    const size_t kMaxPooledBuffers = 4;        // nesting depth of messages kept
+    const size_t kMaxPooledCapacity = 64 * 1024;  // larger buffers are not kept
+}
+
+
+VT::detail_::LogBuffer* VT::detail_::acquire_log_buffer()
+{
+    std::vector<LogBuffer*>& free = log_buffer_pool.free;
+    if (free.empty())
+        return new LogBuffer();
+
+    LogBuffer* buffer = free.back();
+    free.pop_back();
+    return buffer;
+}
+
+
+void VT::detail_::release_log_buffer(LogBuffer* buffer)
+{
+    std::vector<LogBuffer*>& free = log_buffer_pool.free;
+    if (free.size() >= kMaxPooledBuffers || buffer->text.capacity() > kMaxPooledCapacity)
+    {
+        delete buffer;
+        return;
+    }
+
+    buffer->reset();
+    if (free.capacity() == 0)
+        free.reserve(kMaxPooledBuffers);
+    free.push_back(buffer);
+}
+
+
+void VT::detail_::append_integer(std::string& out, unsigned long long value, bool negative)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    do
+    {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (negative)
+        *--p = '-';
+
+    out.append(p, static_cast<size_t>(end - p));
+}
+
+
+// %g with the stream precision, as std::num_put does for default flags
+void VT::detail_::append_float(std::string& out, double value, int precision)
+{
+    char digits[64];
+#ifdef VT_HAS_FLOAT_TO_CHARS
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value,
+                                                std::chars_format::general, precision);
+    if (result.ec == std::errc())
+    {
+        out.append(digits, result.ptr);
+        return;
     }
+#endif
+    int size = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+    if (size > 0 && static_cast<size_t>(size) < sizeof(digits))
+        out.append(digits, static_cast<size_t>(size));
+    else
+        append_streamed(out, value, precision);  // large precision
+}
 
-    std::lock_guard<std::mutex> lock(LogManager::self_.lock_);
 
-    auto it = LogManager::self_.loggers_.find(name);
-    if (it != LogManager::self_.loggers_.end())
+void VT::detail_::append_float(std::string& out, long double value, int precision)
+{
+    char digits[64];
+#ifdef VT_HAS_FLOAT_TO_CHARS
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value,
+                                                std::chars_format::general, precision);
+    if (result.ec == std::errc())
     {
-        it->second = logger;
+        out.append(digits, result.ptr);
+        return;
     }
+#endif
+    int size = std::snprintf(digits, sizeof(digits), "%.*Lg", precision, value);
+    if (size > 0 && static_cast<size_t>(size) < sizeof(digits))
+        out.append(digits, static_cast<size_t>(size));
     else
+        append_streamed(out, value, precision);
+}
+
+
+void VT::detail_::append_field_key(std::string& out, LogFormat format, const char* key)
+{
+    if (format == LF_JSON)
     {
-        LogManager::self_.loggers_.insert(std::make_pair(name, logger));
+        if (!out.empty() && out[out.size() - 1] != '{')
+            out.push_back(',');
+        out.push_back('"');
+        append_json_escaped(out, key, std::strlen(key));
+        out.append("\":");
+        return;
     }
+
+    if (format == LF_Logfmt && !out.empty())
+        out.push_back(' ');
+
+    // keys can't be quoted
+    for (; *key; ++key)
+        out.push_back(static_cast<unsigned char>(*key) <= ' ' || *key == '=' || *key == '"' ? '_' : *key);
+    out.push_back('=');
 }
 
 
-VT::LogManager::LogManager()
+void VT::detail_::append_field_string(std::string& out, LogFormat format, const char* value, size_t size)
 {
-    self_valid_ = true;
+    if (format != LF_JSON && !needs_quotes(value, size))
+    {
+        out.append(value, size);
+        return;
+    }
+
+    out.push_back('"');
+    append_json_escaped(out, value, size);
+    out.push_back('"');
 }
 
 
-VT::LogManager::~LogManager()
+// shortest representation that reads back to the same value
+void VT::detail_::append_field_float(std::string& out, LogFormat format, double value)
 {
-    self_valid_ = false;
+    if (value != value || value - value != 0)
+    {
+        // JSON has no NaN and infinities
+        if (format == LF_JSON)
+            out.append("null");
+        else
+            out.append(value != value ? "nan" : (value < 0 ? "-inf" : "inf"));
+        return;
+    }
+
+    char digits[32];
+#ifdef VT_HAS_FLOAT_TO_CHARS
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    if (result.ec == std::errc())
+    {
+        out.append(digits, result.ptr);
+        return;
+    }
+#endif
+    for (int precision = 15; ; ++precision)
+    {
+        const int size = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+        if (precision == 17 || std::strtod(digits, nullptr) == value)
+        {
+            out.append(digits, static_cast<size_t>(size));
+            return;
+        }
+    }
+}
+
+
+int64_t VT::detail_::log_clock_ns()
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+bool VT::detail_::LogRateSite::admit(Logger& logger, LogLevel level, int64_t now, int64_t interval, int burst)
+{
+    int64_t tat = tat_ns.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if (tat - now > interval * (burst - 1))
+        {
+            suppressed.fetch_add(1, std::memory_order_relaxed);  // lost the race for the last token
+            return false;
+        }
+        if (tat_ns.compare_exchange_weak(tat, std::max(tat, now) + interval, std::memory_order_relaxed))
+            break;
+    }
+
+    const uint64_t count = suppressed.exchange(0, std::memory_order_relaxed);
+    if (count > 0)
+        logger.log(level) << VT::safe_sprintf_ret("suppressed {0} similar messages at {1}:{2}", count, file, line);
+    return true;
 }
 
 
 VT::detail_::LogWorker::LogWorker(Logger* logger, LogLevel level)
     : logger_(logger)
     , msg_level_(level)
-    , msg_stream_()
+    , buffer_(nullptr)
     , options_(logger_->pimpl_->options)
+    , format_(logger_->pimpl_->format)
     , quote_(false)
 {
-    std::string out;
-    logger_->add_prelude(out, level);
-    msg_stream_ << out;
+    if (!logger_->enabled(level))
+        return;  // null sink, nothing is formatted
+
+    buffer_ = acquire_log_buffer();
+    logger_->add_prelude(buffer_->text, level);
 }
 
 
 VT::detail_::LogWorker::~LogWorker()
 {
-    assert(logger_);
-    std::string out(msg_stream_.str());
-    logger_->add_epilog(out, msg_level_);
-    logger_->write_to_streams(msg_level_, out);
+    if (!buffer_)
+        return;
+
+    if (format_ == LF_Text)
+    {
+        logger_->add_epilog(buffer_->text, msg_level_);
+        logger_->write_to_streams(msg_level_, buffer_->text);
+    }
+    else
+    {
+        size_t size = buffer_->text.size();
+        if (size > 0 && buffer_->text[size - 1] == ' ' && !(options_ & LO_NoSpace))
+            --size;  // separator after the last argument
+
+        logger_->add_record(buffer_->record, format_, msg_level_, buffer_->text.data(), size, buffer_->fields);
+        logger_->write_to_streams(msg_level_, buffer_->record);
+    }
+
+    release_log_buffer(buffer_);
 }
 
 
 VT::detail_::LogWorker::LogWorker(LogWorker&& other)
     : logger_(other.logger_)
     , msg_level_(other.msg_level_)
-    , msg_stream_()
+    , buffer_(other.buffer_)
     , options_(other.options_)
+    , format_(other.format_)
     , quote_(other.quote_)
 {
-    // FIXME: use msg_stream_ move constructor to move it
-    // as soon as gcc supports it
-    msg_stream_ << other.msg_stream_.rdbuf();
-    other.logger_ = nullptr;
+    other.buffer_ = nullptr;
 }
 
 
 void VT::detail_::LogWorker::optionally_add_space()
 {
     if (!(options_ & LO_NoSpace))
-        msg_stream_ << " ";
+        buffer_->text.push_back(' ');
 }
 
 
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "VTSafeSprintf.h"
+#include "VTRotatingFile.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <ostream>
 #include <map>
 #include <memory>
@@ -9,13 +13,15 @@
 #include <vector>
 #include <stdexcept>
 #include <sstream>
+#include <streambuf>
+#include <type_traits>
+#include <assert.h>
 
-// Hint: single logger is thread safe with respect to simultaneous writing messages to the stream,
-// but not thread safe when mutating logger parameters
+// Hint: single logger is thread safe with respect to simultaneous writing messages to the stream
+// and changing reporting levels, but not thread safe when mutating other logger parameters
 
 // TODO:
 //   * implement coloring (separate implementations for each platform)
-//   * add custom timestamp formatting
 /*
 
 */
@@ -23,8 +29,9 @@
 namespace VT
 {
     // forward declarations
-    namespace detail_ { class LogWorker; }
+    namespace detail_ { class LogWorker; struct LoggerSlot; template <typename T> struct LogField; }
     class Logger;
+    class LoggerHandle;
     
 
     // enumerations
@@ -41,6 +48,7 @@ namespace VT
 
     // return LL_NoLogging on unknown strings
     LogLevel LogLevel_from_str(const std::string& level);
+    const char* LogLevel_to_str(LogLevel level);
 
     enum LogOpts
     {
@@ -55,10 +63,69 @@ namespace VT
     };
 
 
+    // digits of a second appended to the timestamp
+    enum LogTimePrecision
+    {
+        LTP_Seconds,
+        LTP_Milliseconds,
+        LTP_Microseconds,
+        LTP_Nanoseconds
+    };
+
+
+    // layout of a record; structured formats turn the prelude into keys, the message
+    // into "msg" and VT::field() arguments into typed values
+    enum LogFormat
+    {
+        LF_Text,        // 2024-01-31 12:00:00 [name] 0x1F <Info> message key=value
+        LF_JSON,        // {"time":"...","logger":"name","thread":"0x1F","level":"Info","msg":"message","key":value}
+        LF_Logfmt       // time="..." logger=name thread=0x1F level=Info msg=message key=value
+    };
+
+
+    // what an async logger does when the calling thread's ring buffer is full
+    enum LogOverflow
+    {
+        LOF_Block,      // wait until the writer makes room
+        LOF_Drop,       // drop the record (counted, see async_logging_dropped())
+        LOF_Sync        // write it on the calling thread, like a synchronous logger
+    };
+
+
+    // registry of named loggers, a logger is created with Logger::cout(name) on first request;
+    // lookups are lock-free, get_logger() returns a copy (allocates), handles are plain pointers
     VT::Logger get_logger(const std::string& name);
+    LoggerHandle get_logger_handle(const std::string& name);
+
+    // handles of [name] switch to a copy of [logger]; the replaced instance releases its
+    // stream right away, but the (now silent) object is kept until exit for threads still using it
     void set_logger(const std::string& name, const Logger& logger);
 
 
+    // background writer shared by all async loggers
+    struct AsyncLogOptions
+    {
+        AsyncLogOptions()
+            : ring_bytes(256 * 1024)
+            , flush_bytes(64 * 1024)
+            , flush_interval_ms(100)
+        { }
+
+        size_t ring_bytes;      // per logging thread, records bigger than half of it are written synchronously
+        size_t flush_bytes;     // streams are flushed once this much was written since the last flush
+        int flush_interval_ms;  // ... or when this time has passed
+    };
+
+    // applies to threads that log asynchronously for the first time after the call
+    void configure_async_logging(const AsyncLogOptions& options);
+
+    // blocks until all records queued so far are written and flushed
+    void flush_async_logging();
+
+    // records dropped by loggers with LOF_Drop
+    uint64_t async_logging_dropped();
+
+
     // logging functions should be thread-safe
     // but anything that changes the logger is probably not
     // logger is copyable and copy will share file stream of
@@ -116,6 +183,13 @@ namespace VT
         void set_cout(LogLevel reporting_level = LL_Debug);
         void set_cerr(LogLevel reporting_level = LL_Debug);
 
+        // true if a message of [level] goes to at least one stream, costs a single relaxed load;
+        // use VT_LOG macros to skip evaluation of the message when it doesn't
+        bool enabled(LogLevel level) const
+        {
+            return level >= min_level_.load(std::memory_order_relaxed);
+        }
+
         // logger assumes control of FILE object and closes it when
         // all copies of this logger are destroyed or have new stream set
         bool set_stream(std::FILE* stream, LogLevel reporting_level = LL_Debug);
@@ -124,6 +198,26 @@ namespace VT
         // uses std::fopen, so use apropriate functions to get error codes
         bool set_stream(const std::string& filename, LogLevel reporting_level = LL_Debug);
 
+        // writes to a VT::RotatingFile, returns false when it can't be opened
+        // or the platform doesn't support it
+        bool set_rotating_stream(const RotatingFileOptions& options, LogLevel reporting_level = LL_Debug);
+
+
+        // async mode: formatted records are appended to a lock-free ring buffer of the calling
+        // thread and written by a background thread in batches; records of flush_level
+        // and above are flushed right away. Order is kept within a thread, not across threads.
+        void set_async(LogOverflow overflow = LOF_Block, LogLevel flush_level = LL_Error);
+        void set_sync();
+        bool is_async() const;
+
+
+        // strftime() format of the local time, "%Y-%m-%d %H:%M:%S" by default;
+        // it is formatted once a second per thread, fractions are appended as ".123"
+        void set_timestamp_format(const std::string& format, LogTimePrecision precision = LTP_Seconds);
+
+        // LF_Text by default; JSON records are one per line (JSON lines)
+        void set_format(LogFormat format);
+
 
         // modify logger options
 
@@ -144,11 +238,126 @@ namespace VT
 
         // type-safe veriadic logging functions
 
-#ifndef _MSC_VER
+#ifdef VT_HAS_CONSTEVAL_FORMAT
+
+        // string literal formats are checked at compile time (see FormatString),
+        // formats known only at runtime go to the overloads taking any string
+        template <typename... Args>
+        void log(LogLevel level, FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            if (!enabled(level))
+                return;
+
+            try
+            {
+                std::string msg;
+                add_prelude(msg, level);
+                safe_sprintf(msg, fmt, std::forward<Args>(args)...);
+                add_epilog(msg, level);
+                write_to_streams(level, msg);
+            }
+            catch (const std::exception& ex)
+            {
+                const std::string text(fmt.compiled().fmt, fmt.compiled().size);
+                throw std::runtime_error("Error while formatting '" + text + "': " + ex.what());
+            }
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        log(LogLevel level, S&& fmt, Args&&... args)
+        {
+            if (!enabled(level))
+                return;
+
+            const std::string& text = fmt;
+            try
+            {
+                std::string msg;
+                add_prelude(msg, level);
+                safe_sprintf(msg, text, std::forward<Args>(args)...);
+                add_epilog(msg, level);
+                write_to_streams(level, msg);
+            }
+            catch (const std::exception& ex)
+            {
+                throw std::runtime_error("Error while formatting '" + text + "': " + ex.what());
+            }
+        }
+
+        template <typename... Args>
+        void debug(FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            log(LL_Debug, fmt, std::forward<Args>(args)...);
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        debug(S&& fmt, Args&&... args)
+        {
+            log(LL_Debug, std::forward<S>(fmt), std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void info(FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            log(LL_Info, fmt, std::forward<Args>(args)...);
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        info(S&& fmt, Args&&... args)
+        {
+            log(LL_Info, std::forward<S>(fmt), std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void warning(FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            log(LL_Warning, fmt, std::forward<Args>(args)...);
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        warning(S&& fmt, Args&&... args)
+        {
+            log(LL_Warning, std::forward<S>(fmt), std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void error(FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            log(LL_Error, fmt, std::forward<Args>(args)...);
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        error(S&& fmt, Args&&... args)
+        {
+            log(LL_Error, std::forward<S>(fmt), std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void critical(FormatString<sizeof...(Args)> fmt, Args&&... args)
+        {
+            log(LL_Critical, fmt, std::forward<Args>(args)...);
+        }
+
+        template <typename S, typename... Args>
+        typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+        critical(S&& fmt, Args&&... args)
+        {
+            log(LL_Critical, std::forward<S>(fmt), std::forward<Args>(args)...);
+        }
+
+#elif !defined(_MSC_VER)
 
         template <typename... Args>
         void log(LogLevel level, const std::string& fmt, Args&&... args)
         {
+            if (!enabled(level))
+                return;
+
             try
             {
                 std::string msg;
@@ -198,6 +407,9 @@ namespace VT
         template <typename A0>
         void log(LogLevel level, const std::string& fmt, A0&& arg0)
         {
+            if (!enabled(level))
+                return;
+
             try
             {
                 std::string msg;
@@ -215,6 +427,9 @@ namespace VT
         template <typename A0, typename A1>
         void log(LogLevel level, const std::string& fmt, A0&& arg0, A1&& arg1)
         {
+            if (!enabled(level))
+                return;
+
             try
             {
                 std::string msg;
@@ -232,6 +447,9 @@ namespace VT
         template <typename A0, typename A1, typename A2>
         void log(LogLevel level, const std::string& fmt, A0&& arg0, A1&& arg1, A2&& arg2)
         {
+            if (!enabled(level))
+                return;
+
             try
             {
                 std::string msg;
@@ -255,22 +473,150 @@ namespace VT
 
         void add_prelude(std::string& out, LogLevel level);
         void add_epilog(std::string& out, LogLevel level);
+        void add_timestamp(std::string& out);
+        void add_record(std::string& out, LogFormat format, LogLevel level,
+                        const char* msg, size_t msg_size, const std::string& fields);
         void write_to_streams(LogLevel level, const std::string& msg);
+        void update_min_level();
 
         // private data
 
         struct Impl;
         Impl* pimpl_;
+
+        // lowest of the stream reporting levels
+        std::atomic<int> min_level_;
+    };
+
+
+    namespace detail_
+    {
+        struct LoggerSlot
+        {
+            std::atomic<Logger*> logger;
+        };
+    }
+
+    // refers to the logger currently registered under a name, valid until the end of
+    // the program (static destruction); copying is a pointer copy:
+    //   static VT::LoggerHandle log = VT::get_logger_handle("net");
+    //   log->info() << "connected";
+    class LoggerHandle
+    {
+    public:
+        LoggerHandle() : slot_(nullptr) { }
+
+        Logger* operator->() const { return get(); }
+        Logger& operator*() const { return *get(); }
+
+        Logger* get() const
+        {
+            return slot_->logger.load(std::memory_order_acquire);
+        }
+
+        bool valid() const { return slot_ != nullptr; }
+
+    private:
+        friend LoggerHandle get_logger_handle(const std::string& name);
+
+        explicit LoggerHandle(detail_::LoggerSlot* slot) : slot_(slot) { }
+
+        detail_::LoggerSlot* slot_;
     };
 
 
     // stream manipulator to surround next argument with quotes
     void quote(detail_::LogWorker& log_worker);
+
+    // typed key/value of a record, see LogFormat:
+    //   log.info() << "request done" << VT::field("status", 200) << VT::field("ms", 12.5);
+    // [key] and [value] are referenced until the end of the statement
+    template <typename T>
+    detail_::LogField<T> field(const char* key, const T& value);
     inline const char* yes_no(bool flag) { return (flag ? "yes" : "no"); }
 
 
     namespace detail_
     {
+        // targets of an async record
+        enum LogTarget
+        {
+            LT_Stdout = (1u << 0),
+            LT_Stderr = (1u << 1),
+            LT_Stream = (1u << 2)
+        };
+
+        // queues the record for the background writer, returns false if it must be written
+        // synchronously (LOF_Sync overflow, record too big or writer already destroyed)
+        bool async_write(LogLevel level, unsigned targets, std::FILE* stream, const std::string& msg,
+                         LogOverflow overflow, bool flush);
+
+        // deleter of logger streams, writes out pending async records first
+        void close_log_stream(std::FILE* stream);
+
+        // streambuf appending straight to a std::string
+        class StringAppendBuf : public std::streambuf
+        {
+        public:
+            explicit StringAppendBuf(std::string& out) : out_(out) { }
+
+        protected:
+            int_type overflow(int_type ch)
+            {
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                    out_.push_back(traits_type::to_char_type(ch));
+                return traits_type::not_eof(ch);
+            }
+
+            std::streamsize xsputn(const char* s, std::streamsize n)
+            {
+                out_.append(s, static_cast<size_t>(n));
+                return n;
+            }
+
+        private:
+            std::string& out_;
+        };
+
+        // message being built, reused by the thread once the message is written
+        struct LogBuffer
+        {
+            LogBuffer() : buf(text), stream(&buf) { }
+
+            // clears the text (keeping capacity) and stream formatting
+            void reset();
+
+            std::string text;
+            StringAppendBuf buf;
+            std::ostream stream;   // for manipulators and types without a fast path
+            std::string fields;    // serialized fields of structured formats
+            std::string record;    // structured record, scratch space
+        };
+
+        // per thread pool, so that nested messages get their own buffers
+        LogBuffer* acquire_log_buffer();
+        void release_log_buffer(LogBuffer* buffer);
+
+        // number formatting without streams, same output as std::ostream with default flags
+        void append_integer(std::string& out, unsigned long long value, bool negative);
+        void append_float(std::string& out, double value, int precision);
+        void append_float(std::string& out, long double value, int precision);
+
+        // escaping writers of structured formats, appending to [out] without temporaries;
+        // LF_Text fields are written like logfmt ones
+        void append_field_key(std::string& out, LogFormat format, const char* key);
+        void append_field_string(std::string& out, LogFormat format, const char* value, size_t size);
+        void append_field_float(std::string& out, LogFormat format, double value);
+
+        template <typename T>
+        struct LogField
+        {
+            LogField(const char* key, const T& value) : key(key), value(value) { }
+
+            const char* key;
+            const T& value;
+        };
+
         class LogWorker
         {
         public:
@@ -282,16 +628,19 @@ namespace VT
             // printers
 
             template <typename T>
-            LogWorker& operator<<(T arg)
+            LogWorker& operator<<(const T& arg)
             {
+                if (!buffer_)
+                    return *this;  // disabled
+
                 if (quote_)
-                    msg_stream_ << '"';
+                    buffer_->text.push_back('"');
 
-                msg_stream_ << arg;
+                put(arg);
 
                 if (quote_)
                 {
-                    msg_stream_ << '"';
+                    buffer_->text.push_back('"');
                     quote_ = false;
                 }
 
@@ -300,15 +649,39 @@ namespace VT
                 return *this;
             }
 
+            LogWorker& operator<<(const char* arg)
+            {
+                return operator<< <const char*>(arg);
+            }
+
+            template <typename T>
+            LogWorker& operator<<(const LogField<T>& field)
+            {
+                if (!buffer_)
+                    return *this;
+
+                // text keeps fields in place, structured formats after the message
+                std::string& out = (format_ == LF_Text ? buffer_->text : buffer_->fields);
+                append_field_key(out, format_, field.key);
+                put_field(out, field.value);
+
+                if (format_ == LF_Text)
+                    optionally_add_space();
+
+                return *this;
+            }
+
             LogWorker& operator<<(std::ostream& (*manip)(std::ostream&))
             {
-                manip(msg_stream_);
+                if (buffer_)
+                    manip(buffer_->stream);
                 return *this;
             }
 
             LogWorker& operator<<(std::ios_base& (*manip)(std::ios_base&))
             {
-                manip(msg_stream_);
+                if (buffer_)
+                    manip(buffer_->stream);
                 return *this;
             }
 
@@ -324,13 +697,233 @@ namespace VT
 
             void optionally_add_space();
 
+            // default stream formatting, fast paths apply
+            bool plain() const
+            {
+                return buffer_->stream.flags() == (std::ios_base::dec | std::ios_base::skipws) &&
+                       buffer_->stream.width() == 0;
+            }
+
+            void put_signed(long long value)
+            {
+                if (plain())
+                    append_integer(buffer_->text, value < 0 ? 0ull - static_cast<unsigned long long>(value)
+                                                            : static_cast<unsigned long long>(value), value < 0);
+                else
+                    buffer_->stream << value;
+            }
+
+            void put_unsigned(unsigned long long value)
+            {
+                if (plain())
+                    append_integer(buffer_->text, value, false);
+                else
+                    buffer_->stream << value;
+            }
+
+            template <typename C>
+            void put_char(C value)
+            {
+                if (plain())
+                    buffer_->text.push_back(static_cast<char>(value));
+                else
+                    buffer_->stream << value;
+            }
+
+            template <typename F>
+            void put_float(F value)
+            {
+                if (plain())
+                    append_float(buffer_->text, value, static_cast<int>(buffer_->stream.precision()));
+                else
+                    buffer_->stream << value;
+            }
+
+            void put(bool value)                { put_char(value ? '1' : '0'); }
+            void put(char value)                { put_char(value); }
+            void put(signed char value)         { put_char(value); }
+            void put(unsigned char value)       { put_char(value); }
+            void put(short value)               { put_signed(value); }
+            void put(unsigned short value)      { put_unsigned(value); }
+            void put(int value)                 { put_signed(value); }
+            void put(unsigned int value)        { put_unsigned(value); }
+            void put(long value)                { put_signed(value); }
+            void put(unsigned long value)       { put_unsigned(value); }
+            void put(long long value)           { put_signed(value); }
+            void put(unsigned long long value)  { put_unsigned(value); }
+            void put(float value)               { put_float(static_cast<double>(value)); }
+            void put(double value)              { put_float(value); }
+            void put(long double value)         { put_float(value); }
+
+            void put(const char* value)
+            {
+                if (!value)
+                    buffer_->text.append("(null)");
+                else if (plain())
+                    buffer_->text.append(value);
+                else
+                    buffer_->stream << value;
+            }
+
+            void put(const std::string& value)
+            {
+                if (plain())
+                    buffer_->text.append(value);
+                else
+                    buffer_->stream << value;
+            }
+
+            // anything else goes through the stream
+            template <typename T>
+            void put(const T& value)
+            {
+                buffer_->stream << value;
+            }
+
+            // field values
+
+            void put_field(std::string& out, bool value)                { out.append(value ? "true" : "false"); }
+            void put_field(std::string& out, char value)                { append_field_string(out, format_, &value, 1); }
+            void put_field(std::string& out, short value)               { put_field(out, static_cast<long long>(value)); }
+            void put_field(std::string& out, unsigned short value)      { put_field(out, static_cast<unsigned long long>(value)); }
+            void put_field(std::string& out, int value)                 { put_field(out, static_cast<long long>(value)); }
+            void put_field(std::string& out, unsigned int value)        { put_field(out, static_cast<unsigned long long>(value)); }
+            void put_field(std::string& out, long value)                { put_field(out, static_cast<long long>(value)); }
+            void put_field(std::string& out, unsigned long value)       { put_field(out, static_cast<unsigned long long>(value)); }
+            void put_field(std::string& out, unsigned long long value)  { append_integer(out, value, false); }
+            void put_field(std::string& out, float value)               { append_field_float(out, format_, value); }
+            void put_field(std::string& out, double value)              { append_field_float(out, format_, value); }
+            void put_field(std::string& out, long double value)         { append_field_float(out, format_, static_cast<double>(value)); }
+
+            void put_field(std::string& out, long long value)
+            {
+                append_integer(out, value < 0 ? 0ull - static_cast<unsigned long long>(value)
+                                              : static_cast<unsigned long long>(value), value < 0);
+            }
+
+            void put_field(std::string& out, const char* value)
+            {
+                if (value)
+                    append_field_string(out, format_, value, std::char_traits<char>::length(value));
+                else
+                    out.append(format_ == LF_JSON ? "null" : "(null)");
+            }
+
+            void put_field(std::string& out, const std::string& value)
+            {
+                append_field_string(out, format_, value.data(), value.size());
+            }
+
+            // anything else is streamed as a string
+            template <typename T>
+            void put_field(std::string& out, const T& value)
+            {
+                std::string& text = buffer_->text;
+                const size_t pos = text.size();
+                buffer_->stream << value;
+                buffer_->record.assign(text, pos, std::string::npos);
+                text.resize(pos);
+                append_field_string(out, format_, buffer_->record.data(), buffer_->record.size());
+            }
+
             friend void VT::quote(LogWorker& log_worker);
-            
+
             Logger*            logger_;
             LogLevel           msg_level_;
-            std::ostringstream msg_stream_;
+            LogBuffer*         buffer_;  // null for disabled messages
             unsigned int       options_;
+            LogFormat          format_;
             bool               quote_;
         };
+
+
+        // monotonic clock for rate limits, coarse (a few ms) where the platform has a cheaper one
+        int64_t log_clock_ns();
+
+        // state of a VT_LOG_RATE call site, constant-initialized
+        struct LogRateSite
+        {
+            constexpr LogRateSite(const char* file, int line) : tat_ns(0), suppressed(0), file(file), line(line) { }
+
+            // token bucket of [burst] messages refilled at [per_second] (GCRA: tat_ns is the
+            // time the bucket is full again); a rejection is a clock read, a load and an increment
+            bool allow(Logger& logger, LogLevel level, double per_second, int burst)
+            {
+                assert(per_second > 0 && burst > 0);
+
+                const int64_t now = log_clock_ns();
+                const int64_t interval = static_cast<int64_t>(1e9 / per_second);
+                if (tat_ns.load(std::memory_order_relaxed) - now > interval * (burst - 1))
+                {
+                    suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                return admit(logger, level, now, interval, burst);
+            }
+
+            // takes a token, writes the summary of messages suppressed since the last one;
+            // this is the only place it is written, nothing fires when the window closes
+            bool admit(Logger& logger, LogLevel level, int64_t now, int64_t interval, int burst);
+
+            std::atomic<int64_t> tat_ns;
+            std::atomic<uint64_t> suppressed;
+            const char* file;
+            int line;
+        };
+
+        // state of a VT_LOG_EVERY_N call site
+        struct LogSampleSite
+        {
+            constexpr LogSampleSite() : count(0) { }
+
+            bool sample(uint64_t n)
+            {
+                assert(n > 0);
+                return count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+            }
+
+            std::atomic<uint64_t> count;
+        };
+    }
+
+    template <typename T>
+    detail_::LogField<T> field(const char* key, const T& value)
+    {
+        return detail_::LogField<T>(key, value);
     }
 }
+
+
+// message and its arguments are not evaluated when [level] is disabled:
+//   VT_LOG(logger, VT::LL_Debug) << "state" << expensive_dump();
+//   VT_LOGF(logger, VT::LL_Debug, "state {0}", expensive_dump());
+#define VT_LOG(logger, level) \
+    if (!(logger).enabled(level)) ; else (logger).log(level)
+
+#define VT_LOG_DEBUG(logger)    VT_LOG(logger, VT::LL_Debug)
+#define VT_LOG_INFO(logger)     VT_LOG(logger, VT::LL_Info)
+#define VT_LOG_WARNING(logger)  VT_LOG(logger, VT::LL_Warning)
+#define VT_LOG_ERROR(logger)    VT_LOG(logger, VT::LL_Error)
+#define VT_LOG_CRITICAL(logger) VT_LOG(logger, VT::LL_Critical)
+
+#define VT_LOGF(logger, level, ...) \
+    do { if ((logger).enabled(level)) (logger).log(level, __VA_ARGS__); } while (0)
+
+// hot path limits, state is per call site (shared by all threads and loggers using it):
+//   VT_LOG_RATE(logger, VT::LL_Warning, 10, 100) << "queue full";   // 10/s, bursts of 100
+//   VT_LOG_EVERY_N(logger, VT::LL_Debug, 1000) << "packet" << id;  // 1st, 1001st, ...
+// the first message let through after rejections is preceded by
+// "suppressed <N> similar messages at <file>:<line>"; there is no timer, the summary is deferred
+// to that message, so a site that stays quiet after a burst never reports it.
+// per_second, burst and n must be positive
+#define VT_LOG_RATE(logger, level, per_second, burst) \
+    if (!(logger).enabled(level) || \
+        !VT_LOG_SITE_(VT::detail_::LogRateSite, (__FILE__, __LINE__)).allow(logger, level, per_second, burst)) ; \
+    else (logger).log(level)
+
+#define VT_LOG_EVERY_N(logger, level, n) \
+    if (!(logger).enabled(level) || !VT_LOG_SITE_(VT::detail_::LogSampleSite, {}).sample(n)) ; \
+    else (logger).log(level)
+
+#define VT_LOG_SITE_(type, args) \
+    ([]() -> type& { static type vt_log_site_ args; return vt_log_site_; }())
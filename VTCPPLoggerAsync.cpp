@@ -0,0 +1,446 @@
+#include "VTCPPLogger.h"
+#include "VTEvent.hpp"
+#include "VTLogRing.h"
+#include "VTThreadAffinity.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <assert.h>
+
+/*
+ * Background writer of async loggers.
+ *
+ * Every logging thread owns a single-producer single-consumer byte ring, the writer
+ * thread is the only consumer of all of them (VT::detail_::LogRing). A record is a
+ * RecordHeader followed by the formatted message.
+ *
+ * Producers wake the writer only when their ring was empty, the ring fills past
+ * flush_bytes or the record must be flushed right away, so under load records
+ * are written in batches with one fflush per stream.
+ */
+
+namespace
+{
+    struct RecordHeader
+    {
+        uint32_t size;      // message bytes
+        uint16_t level;
+        uint16_t flags;     // LogTarget bits and kFlush
+        std::FILE* stream;
+    };
+
+    const uint16_t kFlush = (1u << 15);
+
+    inline size_t record_size(size_t msg_size)
+    {
+        return VT::detail_::LogRing::record_size(sizeof(RecordHeader) + msg_size);
+    }
+
+
+    class Ring : public VT::detail_::LogRing
+    {
+    public:
+        explicit Ring(size_t capacity)
+            : LogRing(capacity)
+            , orphaned_(false)
+        { }
+
+        // producer side, false if there is no room right now
+        bool try_push(const RecordHeader& header, const char* msg)
+        {
+            char* record = reserve(sizeof(header) + header.size);
+            if (!record)
+                return false;
+
+            std::memcpy(record, &header, sizeof(header));
+            std::memcpy(record + sizeof(header), msg, header.size);
+            commit();
+            return true;
+        }
+
+        // consumer side, calls fn(header, msg) for every record published so far
+        template <typename F>
+        size_t consume_records(F fn)
+        {
+            return consume([&](const char* record, size_t /*size*/)
+            {
+                RecordHeader header;
+                std::memcpy(&header, record, sizeof(header));
+                fn(header, record + sizeof(header));
+            });
+        }
+
+        // set when the owning thread exits, the writer frees the ring once it is drained
+        void orphan() { orphaned_.store(true); }
+        bool orphaned() const { return orphaned_.load(); }
+
+    private:
+        std::atomic<bool> orphaned_;
+    };
+
+
+    class AsyncWriter
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        AsyncWriter()
+            : pending_wake_(false)
+            , flush_bytes_(options_.flush_bytes)
+            , dropped_(0)
+            , reported_dropped_(0)
+            , flush_requested_(0)
+            , flush_completed_(0)
+            , stop_(false)
+            , thread_([this]{ loop(); })
+        {
+            alive_.store(true);
+            started_.store(true);
+        }
+
+        ~AsyncWriter()
+        {
+            alive_.store(false);
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            thread_.join();
+        }
+
+        static AsyncWriter* instance()
+        {
+            static AsyncWriter writer;
+            return alive_.load() ? &writer : nullptr;
+        }
+
+        // writer is started lazily, after its destruction (static deinitialization) returns null
+        static AsyncWriter* existing()
+        {
+            return started_.load() && alive_.load() ? instance() : nullptr;
+        }
+
+        void configure(const VT::AsyncLogOptions& options)
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            options_ = options;
+        }
+
+        bool write(VT::LogLevel level, unsigned targets, std::FILE* stream, const std::string& msg,
+                   VT::LogOverflow overflow, bool flush)
+        {
+            Ring* ring = thread_ring();
+            if (!ring)
+                return false;
+            if (record_size(msg.size()) > ring->capacity() / 2)
+                return write_through(ring);
+
+            RecordHeader header = { static_cast<uint32_t>(msg.size()), static_cast<uint16_t>(level),
+                                    static_cast<uint16_t>(targets | (flush ? kFlush : 0)), stream };
+
+            const bool was_empty = ring->empty();
+
+            while (!ring->try_push(header, msg.data()))
+            {
+                if (overflow == VT::LOF_Drop)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                if (overflow == VT::LOF_Sync)
+                    return write_through(ring);
+
+                // LOF_Block, twice the record size is enough room even if the ring tail is skipped
+                wake_writer();
+                uint32_t key = space_.prepare_wait();
+                if (ring->capacity() - ring->used() >= record_size(msg.size()) * 2)
+                    space_.cancel_wait();
+                else
+                    space_.wait(key, 10);
+            }
+
+            if (was_empty || flush || ring->used() >= flush_bytes_.load(std::memory_order_relaxed))
+                wake_writer();
+
+            return true;
+        }
+
+        void flush()
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            uint64_t ticket = ++flush_requested_;
+            wake_.notify_all();
+            flushed_.wait(l, [&]{ return flush_completed_ >= ticket || stop_; });
+        }
+
+        uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        AsyncWriter(const AsyncWriter&);
+        AsyncWriter& operator=(const AsyncWriter&);
+
+        // the caller writes the record synchronously, records this thread queued
+        // before it are written first to keep the order within the thread
+        bool write_through(Ring* ring)
+        {
+            if (!ring->empty())
+                flush();
+            return false;
+        }
+
+        // frees the ring of an exiting thread
+        struct RingOwner
+        {
+            RingOwner() : ring(nullptr) { }
+            ~RingOwner()
+            {
+                if (ring && alive_.load())
+                    ring->orphan();
+            }
+
+            Ring* ring;
+        };
+
+        Ring* thread_ring()
+        {
+            static thread_local RingOwner owner;
+            if (!owner.ring)
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                if (stop_)
+                    return nullptr;
+                rings_.push_back(std::unique_ptr<Ring>(new Ring(options_.ring_bytes)));
+                owner.ring = rings_.back().get();
+                flush_bytes_.store(options_.flush_bytes, std::memory_order_relaxed);
+            }
+            return owner.ring;
+        }
+
+        void wake_writer()
+        {
+            if (pending_wake_.exchange(true))
+                return;  // already woken and not yet running
+
+            std::lock_guard<std::mutex> l(lock_);
+            wake_.notify_one();
+        }
+
+        struct Target
+        {
+            Target() : file(nullptr), unflushed(0) { }
+
+            std::FILE* file;
+            size_t unflushed;
+        };
+
+        // writes everything queued, returns number of records
+        size_t drain(bool& urgent)
+        {
+            size_t count = 0;
+
+            for (size_t i = 0; i < rings_snapshot_.size(); ++i)
+            {
+                count += rings_snapshot_[i]->consume_records([&](const RecordHeader& header, const char* msg)
+                {
+                    if (header.flags & VT::detail_::LT_Stdout)
+                        put(stdout, msg, header.size);
+                    if (header.flags & VT::detail_::LT_Stderr)
+                        put(stderr, msg, header.size);
+                    if (header.flags & VT::detail_::LT_Stream)
+                        put(header.stream, msg, header.size);
+                    if (header.flags & kFlush)
+                        urgent = true;
+                });
+            }
+
+            if (count)
+                space_.notify_all();
+
+            return count;
+        }
+
+        void put(std::FILE* file, const char* msg, size_t size)
+        {
+            std::fwrite(msg, 1, size, file);
+
+            for (Target& target : targets_)
+            {
+                if (target.file == file)
+                {
+                    target.unflushed += size;
+                    return;
+                }
+            }
+            targets_.push_back(Target());
+            targets_.back().file = file;
+            targets_.back().unflushed = size;
+        }
+
+        size_t unflushed() const
+        {
+            size_t total = 0;
+            for (const Target& target : targets_)
+                total += target.unflushed;
+            return total;
+        }
+
+        void flush_targets()
+        {
+            for (const Target& target : targets_)
+                std::fflush(target.file);
+            targets_.clear();  // streams may be closed once flushed
+            last_flush_ = clock::now();
+        }
+
+        void report_dropped()
+        {
+            uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+            if (dropped != reported_dropped_)
+            {
+                std::fprintf(stderr, "VT::Logger: %llu async log records dropped\n",
+                             static_cast<unsigned long long>(dropped - reported_dropped_));
+                reported_dropped_ = dropped;
+                std::fflush(stderr);
+            }
+        }
+
+        void loop()
+        {
+            VT::set_current_thread_name("vt-log-writer");
+            last_flush_ = clock::now();
+
+            std::unique_lock<std::mutex> l(lock_);
+            for (;;)
+            {
+                const uint64_t flush_ticket = flush_requested_;
+                const bool stopping = stop_;
+                const VT::AsyncLogOptions options = options_;
+                pending_wake_.store(false);
+
+                // forget rings of exited threads that were drained by the previous pass
+                for (size_t i = 0; i < rings_.size(); )
+                {
+                    if (rings_[i]->orphaned() && rings_[i]->empty())
+                    {
+                        rings_[i] = std::move(rings_.back());
+                        rings_.pop_back();
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+                rings_snapshot_.clear();
+                for (auto& ring : rings_)
+                    rings_snapshot_.push_back(ring.get());
+
+                l.unlock();
+
+                // one pass over the rings, busy producers can't keep the writer from flushing
+                bool urgent = false;
+                const size_t drained = drain(urgent);
+
+                const bool flush_due = unflushed() > 0 &&
+                    (urgent || stopping || flush_ticket != flush_completed_ ||
+                     unflushed() >= options.flush_bytes ||
+                     clock::now() - last_flush_ >= std::chrono::milliseconds(options.flush_interval_ms));
+                if (flush_due)
+                    flush_targets();
+                if (flush_due || stopping)
+                    report_dropped();  // at most once per flush
+
+                l.lock();
+
+                if (flush_ticket != flush_completed_)
+                {
+                    flush_completed_ = flush_ticket;
+                    flushed_.notify_all();
+                }
+
+                if (stopping)
+                    break;
+
+                if (drained || pending_wake_ || flush_requested_ != flush_completed_)
+                    continue;
+
+                if (unflushed() > 0)
+                    wake_.wait_until(l, last_flush_ + std::chrono::milliseconds(options.flush_interval_ms));
+                else
+                    wake_.wait(l);
+            }
+
+            flushed_.notify_all();
+        }
+
+        static std::atomic<bool> alive_;
+        static std::atomic<bool> started_;
+
+        std::mutex lock_;
+        std::condition_variable wake_;
+        std::condition_variable flushed_;
+        std::atomic<bool> pending_wake_;
+
+        VT::AsyncLogOptions options_;
+        std::atomic<size_t> flush_bytes_;
+        std::vector<std::unique_ptr<Ring>> rings_;
+
+        // writer thread only
+        std::vector<Ring*> rings_snapshot_;
+        std::vector<Target> targets_;
+        clock::time_point last_flush_;
+
+        VT::EventCount space_;  // producers blocked on a full ring
+
+        std::atomic<uint64_t> dropped_;
+        uint64_t reported_dropped_;
+
+        uint64_t flush_requested_;
+        uint64_t flush_completed_;
+        bool stop_;
+
+        std::thread thread_;
+    };
+
+    std::atomic<bool> AsyncWriter::alive_(false);
+    std::atomic<bool> AsyncWriter::started_(false);
+}
+
+
+void VT::configure_async_logging(const AsyncLogOptions& options)
+{
+    assert(options.ring_bytes >= 1024 && options.flush_interval_ms > 0);
+
+    if (AsyncWriter* writer = AsyncWriter::instance())
+        writer->configure(options);
+}
+
+void VT::flush_async_logging()
+{
+    if (AsyncWriter* writer = AsyncWriter::existing())
+        writer->flush();
+}
+
+uint64_t VT::async_logging_dropped()
+{
+    AsyncWriter* writer = AsyncWriter::existing();
+    return writer ? writer->dropped() : 0;
+}
+
+bool VT::detail_::async_write(LogLevel level, unsigned targets, std::FILE* stream, const std::string& msg,
+                              LogOverflow overflow, bool flush)
+{
+    AsyncWriter* writer = AsyncWriter::instance();
+    return writer && writer->write(level, targets, stream, msg, overflow, flush);
+}
+
+void VT::detail_::close_log_stream(std::FILE* stream)
+{
+    flush_async_logging();
+    std::fclose(stream);
+}
@@ -0,0 +1,910 @@
+#include "VTCPPLoggerBinary.h"
+#include "VTCompilerSpecific.h"
+#include "VTLogRing.h"
+#include "VTThreadAffinity.h"
+#include "VTTimer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+#include <assert.h>
+
+/*
+ * Every thread gets a single-producer single-consumer ring (VT::detail_::LogRing) per
+ * BinaryLogger it logs to. A record is a RecordHeader followed by the encoded arguments.
+ *
+ * Raw log file layout (native byte order, strings are uint32_t length + characters):
+ *   "VTBLOG01"
+ *   'N' name, int64 wall clock ns, int64 logger clock ns    -- once, first
+ *   'S' uint32 site, uint32 line, file, format, uint8 count, count * BinaryArgType
+ *   'T' uint32 thread, thread id
+ *   'R' uint32 thread, uint32 site, uint8 level, int64 logger clock ns, uint32 size, arguments
+ * 'S' and 'T' entries precede the first record that refers to them. Every logger opening
+ * the file appends a new session starting with the magic.
+ */
+
+// shut up fopen security warning in Visual Studio
+#ifdef _MSC_VER
+    #pragma warning(push)
+    #pragma warning(disable: 4996)
+#endif
+
+namespace
+{
+    const char kMagic[8] = { 'V', 'T', 'B', 'L', 'O', 'G', '0', '1' };
+
+    const uint32_t kSiteBits = 24;
+    const uint32_t kSiteMask = (1u << kSiteBits) - 1;
+
+    struct RecordHeader
+    {
+        uint32_t size;          // argument bytes
+        uint32_t site_level;    // site id | level << kSiteBits
+        int64_t timestamp;
+    };
+
+    inline size_t record_size(size_t args_size)
+    {
+        return VT::detail_::LogRing::record_size(sizeof(RecordHeader) + args_size);
+    }
+
+    int64_t now_ns()
+    {
+        return VT::Timer::now_ns(VT::Timer::TS_Tsc);
+    }
+
+
+    // call sites are shared by all loggers and live until the process exits
+    struct Site
+    {
+        std::string file;
+        int line;
+        std::string fmt;
+        std::vector<uint8_t> types;
+    };
+
+    class SiteRegistry
+    {
+    public:
+        static SiteRegistry& instance()
+        {
+            // leaked, loggers with static storage may need it during their destruction
+            static SiteRegistry* registry = new SiteRegistry();
+            return *registry;
+        }
+
+        uint32_t add(VT::detail_::BinarySite& site, const char* fmt, const uint8_t* types, size_t count)
+        {
+            std::lock_guard<std::mutex> l(lock_);
+
+            uint32_t id = site.id.load(std::memory_order_relaxed);
+            if (id != 0)
+                return id;  // registered by another thread meanwhile
+
+            if (sites_.size() >= kSiteMask)
+                throw std::runtime_error("Too many VT_BLOG call sites");
+
+            VT::d_::split_format(fmt);  // throws on a malformed format, now rather than in the writer
+
+            Site s;
+            s.file = site.file;
+            s.line = site.line;
+            s.fmt = fmt;
+            s.types.assign(types, types + count);
+            sites_.push_back(s);
+
+            id = static_cast<uint32_t>(sites_.size());
+            site.id.store(id, std::memory_order_release);
+            return id;
+        }
+
+        bool get(uint32_t id, Site& out)
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            if (id == 0 || id > sites_.size())
+                return false;
+            out = sites_[id - 1];
+            return true;
+        }
+
+    private:
+        std::mutex lock_;
+        std::vector<Site> sites_;
+    };
+
+
+    class Ring : public VT::detail_::LogRing
+    {
+    public:
+        Ring(size_t capacity, uint32_t index)
+            : LogRing(capacity)
+            , index(index)
+            , thread_id(VT::safe_sprintf_ret("0x{0:X}", std::this_thread::get_id()))
+            , announced(false)
+            , orphaned_(false)
+            , closed_(false)
+        { }
+
+        // consumer side, calls fn(header, args) for every record published so far
+        template <typename F>
+        void consume_records(F fn)
+        {
+            consume([&](const char* record, size_t /*size*/)
+            {
+                RecordHeader header;
+                std::memcpy(&header, record, sizeof(header));
+                fn(header, record + sizeof(header));
+            });
+        }
+
+        // owning thread exited
+        void orphan() { orphaned_.store(true); }
+        bool orphaned() const { return orphaned_.load(); }
+
+        // logger was destroyed
+        void close() { closed_.store(true); }
+        bool closed() const { return closed_.load(); }
+
+        const uint32_t index;
+        const std::string thread_id;
+        bool announced;  // writer thread only
+
+    private:
+        std::atomic<bool> orphaned_;
+        std::atomic<bool> closed_;
+    };
+
+
+    // rings of the calling thread, looked up by logger serial number (never reused)
+    struct ThreadRings
+    {
+        struct Entry
+        {
+            uint64_t logger;
+            std::shared_ptr<Ring> ring;
+        };
+
+        ~ThreadRings()
+        {
+            for (Entry& e : entries)
+                e.ring->orphan();
+        }
+
+        Ring* find(uint64_t logger)
+        {
+            for (Entry& e : entries)
+            {
+                if (e.logger == logger)
+                    return e.ring.get();
+            }
+            return nullptr;
+        }
+
+        void prune()
+        {
+            for (size_t i = 0; i < entries.size(); )
+            {
+                if (entries[i].ring->closed())
+                {
+                    entries[i] = std::move(entries.back());
+                    entries.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+
+        std::vector<Entry> entries;
+    };
+
+    ThreadRings& thread_rings()
+    {
+        static thread_local ThreadRings rings;
+        return rings;
+    }
+
+
+    // formats decoded records as VT::Logger does with default options
+    class Formatter
+    {
+    public:
+        struct Format
+        {
+            Format() : valid(false) { }
+
+            bool valid;
+            Site site;
+            VT::d_::Split split;
+            std::vector<int> anchors;  // argument index of every split chunk, -1 for text
+        };
+
+        explicit Formatter(std::FILE* out)
+            : out_(out)
+            , wall_ns_(0)
+            , clock_ns_(0)
+            , cached_second_(-1)
+        { }
+
+        void set_name(const std::string& name) { name_ = name; }
+
+        // maps logger clock to wall clock
+        void set_clock(int64_t wall_ns, int64_t clock_ns)
+        {
+            wall_ns_ = wall_ns;
+            clock_ns_ = clock_ns;
+        }
+
+        bool has_site(uint32_t id) const
+        {
+            return id < formats_.size() && formats_[id].valid;
+        }
+
+        // false on a malformed format
+        bool add_site(uint32_t id, const Site& site)
+        {
+            if (formats_.size() <= id)
+                formats_.resize(id + 1);
+
+            Format& f = formats_[id];
+            try
+            {
+                f.split = VT::d_::split_format(site.fmt);
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+
+            f.valid = true;
+            f.site = site;
+            f.anchors.clear();
+            for (const VT::d_::Substring& chunk : f.split)
+            {
+                int index = -1;
+                if (chunk.type == VT::d_::SubstrAnchor)
+                {
+                    size_t pos = chunk.content.find_first_of(":");
+                    index = std::atoi(chunk.content.substr(0, pos).c_str());
+                }
+                f.anchors.push_back(index);
+            }
+            return true;
+        }
+
+        // false if arguments don't match the site
+        bool write(const std::string& thread_id, uint32_t id, VT::LogLevel level, int64_t timestamp,
+                   const char* args, size_t size)
+        {
+            if (!has_site(id) || level > VT::LL_Critical)
+                return false;
+
+            const Format& f = formats_[id];
+            if (!decode_args(f.site.types, args, size))
+                return false;
+
+            line_.clear();
+            append_timestamp(timestamp);
+            line_.append(" [");
+            line_.append(name_);
+            line_.append("] ");
+            line_.append(thread_id);
+            line_.append(" <");
+            line_.append(VT::LogLevel_to_str(level));
+            line_.append("> ");
+
+            for (size_t i = 0; i < f.split.size(); ++i)
+            {
+                const VT::d_::Substring& chunk = f.split[i];
+                const int index = f.anchors[i];
+
+                if (chunk.type == VT::d_::SubstrText)
+                    line_.append(chunk.content);
+                else if (index >= 0 && index < static_cast<int>(args_.size()))
+                    append_arg(chunk.content, args_[index]);
+                else
+                    line_.append("{" + chunk.content + "}");  // as safe_sprintf leaves unknown anchors
+            }
+
+            line_.push_back('\n');
+            std::fwrite(line_.data(), 1, line_.size(), out_);
+            return true;
+        }
+
+    private:
+        struct Arg
+        {
+            uint8_t type;
+            const char* data;
+            size_t size;
+        };
+
+        static size_t pod_size(uint8_t type)
+        {
+            using namespace VT::detail_;
+            switch (type)
+            {
+            case BA_Bool:       return sizeof(bool);
+            case BA_Char:       return sizeof(char);
+            case BA_SChar:      return sizeof(signed char);
+            case BA_UChar:      return sizeof(unsigned char);
+            case BA_Short:      return sizeof(short);
+            case BA_UShort:     return sizeof(unsigned short);
+            case BA_Int:        return sizeof(int);
+            case BA_UInt:       return sizeof(unsigned int);
+            case BA_Long:       return sizeof(long);
+            case BA_ULong:      return sizeof(unsigned long);
+            case BA_LongLong:   return sizeof(long long);
+            case BA_ULongLong:  return sizeof(unsigned long long);
+            case BA_Float:      return sizeof(float);
+            case BA_Double:     return sizeof(double);
+            case BA_LongDouble: return sizeof(long double);
+            case BA_Pointer:    return sizeof(const void*);
+            default:            return 0;
+            }
+        }
+
+        bool decode_args(const std::vector<uint8_t>& types, const char* data, size_t size)
+        {
+            args_.clear();
+            const char* end = data + size;
+
+            for (uint8_t type : types)
+            {
+                Arg arg = { type, data, pod_size(type) };
+                if (type == VT::detail_::BA_String)
+                {
+                    uint32_t length;
+                    if (static_cast<size_t>(end - data) < sizeof(length))
+                        return false;
+                    std::memcpy(&length, data, sizeof(length));
+                    arg.data = data + sizeof(length);
+                    arg.size = length;
+                    data += sizeof(length);
+                }
+                else if (arg.size == 0)
+                {
+                    return false;
+                }
+
+                if (static_cast<size_t>(end - data) < arg.size)
+                    return false;
+                data += arg.size;
+                args_.push_back(arg);
+            }
+
+            return data == end;
+        }
+
+        template <typename T>
+        void append_pod(const std::string& anchor, const Arg& arg)
+        {
+            T value;
+            std::memcpy(&value, arg.data, sizeof(T));
+            line_.append(VT::d_::format_argument(anchor, value).content);
+        }
+
+        void append_arg(const std::string& anchor, const Arg& arg)
+        {
+            using namespace VT::detail_;
+            switch (arg.type)
+            {
+            case BA_Bool:       append_pod<bool>(anchor, arg); break;
+            case BA_Char:       append_pod<char>(anchor, arg); break;
+            case BA_SChar:      append_pod<signed char>(anchor, arg); break;
+            case BA_UChar:      append_pod<unsigned char>(anchor, arg); break;
+            case BA_Short:      append_pod<short>(anchor, arg); break;
+            case BA_UShort:     append_pod<unsigned short>(anchor, arg); break;
+            case BA_Int:        append_pod<int>(anchor, arg); break;
+            case BA_UInt:       append_pod<unsigned int>(anchor, arg); break;
+            case BA_Long:       append_pod<long>(anchor, arg); break;
+            case BA_ULong:      append_pod<unsigned long>(anchor, arg); break;
+            case BA_LongLong:   append_pod<long long>(anchor, arg); break;
+            case BA_ULongLong:  append_pod<unsigned long long>(anchor, arg); break;
+            case BA_Float:      append_pod<float>(anchor, arg); break;
+            case BA_Double:     append_pod<double>(anchor, arg); break;
+            case BA_LongDouble: append_pod<long double>(anchor, arg); break;
+            case BA_Pointer:    append_pod<const void*>(anchor, arg); break;
+            case BA_String:
+                line_.append(VT::d_::format_argument(anchor, std::string(arg.data, arg.size)).content);
+                break;
+            default:
+                assert(0);
+            }
+        }
+
+        // localtime only once a second
+        void append_timestamp(int64_t timestamp)
+        {
+            const int64_t wall = wall_ns_ + (timestamp - clock_ns_);
+            const int64_t second = (wall >= 0 ? wall / 1000000000 : (wall - 999999999) / 1000000000);
+
+            if (second != cached_second_)
+            {
+                time_t now = static_cast<time_t>(second);
+                struct tm timeinfo;
+#ifdef _WIN32
+                localtime_s(&timeinfo, &now);
+#else
+                localtime_r(&now, &timeinfo);
+#endif
+                char buf[80];
+                strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
+                cached_timestamp_ = buf;
+                cached_second_ = second;
+            }
+            line_.append(cached_timestamp_);
+        }
+
+        std::FILE* out_;
+        std::string name_;
+        int64_t wall_ns_;
+        int64_t clock_ns_;
+
+        std::vector<Format> formats_;  // by site id
+        std::vector<Arg> args_;
+        std::string line_;
+
+        int64_t cached_second_;
+        std::string cached_timestamp_;
+    };
+
+
+    // raw file writing and reading
+
+    template <typename T>
+    void put(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void put_string(std::string& out, const std::string& s)
+    {
+        put(out, static_cast<uint32_t>(s.size()));
+        out.append(s);
+    }
+
+    template <typename T>
+    bool get(std::FILE* in, T& value)
+    {
+        return std::fread(&value, sizeof(T), 1, in) == 1;
+    }
+
+    bool get_bytes(std::FILE* in, std::string& out, size_t size)
+    {
+        out.resize(size);
+        return size == 0 || std::fread(&out[0], 1, size, in) == size;
+    }
+
+    bool get_string(std::FILE* in, std::string& out)
+    {
+        uint32_t size;
+        return get(in, size) && get_bytes(in, out, size);
+    }
+}
+
+
+struct VT::BinaryLogger::Impl
+{
+    Impl(const std::string& name, std::FILE* stream, bool owns_stream, const BinaryLogOptions& options)
+        : name(name)
+        , stream(stream)
+        , owns_stream(owns_stream)
+        , options(options)
+        , serial(next_serial())
+        , clock_ns(now_ns())
+        , wall_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count())
+        , dropped(0)
+        , reported_dropped(0)
+        , pending_wake(false)
+        , next_ring_index(0)
+        , flush_requested(0)
+        , flush_completed(0)
+        , stop(false)
+        , formatter(stream)
+    {
+        assert(options.overflow != LOF_Sync);
+        assert(options.ring_bytes >= 1024 && options.poll_interval_ms > 0);
+
+        formatter.set_name(name);
+        formatter.set_clock(wall_ns, clock_ns);
+
+        if (options.raw)
+        {
+            out.append(kMagic, sizeof(kMagic));
+            out.push_back('N');
+            put_string(out, name);
+            put(out, wall_ns);
+            put(out, clock_ns);
+        }
+
+        thread = std::thread([this]{ loop(); });
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        thread.join();
+
+        for (auto& ring : rings)
+            ring->close();
+
+        if (owns_stream)
+            std::fclose(stream);
+    }
+
+    static uint64_t next_serial()
+    {
+        static std::atomic<uint64_t> serial(0);
+        return ++serial;
+    }
+
+    Ring* thread_ring()
+    {
+        ThreadRings& tr = thread_rings();
+        if (Ring* ring = tr.find(serial))
+            return ring;
+
+        tr.prune();
+
+        std::lock_guard<std::mutex> l(lock);
+        std::shared_ptr<Ring> ring(new Ring(options.ring_bytes, next_ring_index++));
+        rings.push_back(ring);
+
+        ThreadRings::Entry e = { serial, ring };
+        tr.entries.push_back(e);
+        return ring.get();
+    }
+
+    void wake_writer()
+    {
+        if (!pending_wake.exchange(true))
+            wake.notify_one();
+    }
+
+    // writer thread
+
+    void emit(Ring& ring, const RecordHeader& header, const char* args)
+    {
+        const uint32_t site_id = header.site_level & kSiteMask;
+        const LogLevel level = static_cast<LogLevel>(header.site_level >> kSiteBits);
+
+        if (!formatter.has_site(site_id))
+        {
+            Site site;
+            if (!SiteRegistry::instance().get(site_id, site))
+                return;
+            formatter.add_site(site_id, site);
+
+            if (options.raw)
+            {
+                out.push_back('S');
+                put(out, site_id);
+                put(out, static_cast<uint32_t>(site.line));
+                put_string(out, site.file);
+                put_string(out, site.fmt);
+                put(out, static_cast<uint8_t>(site.types.size()));
+                out.append(site.types.begin(), site.types.end());
+            }
+        }
+
+        if (!options.raw)
+        {
+            formatter.write(ring.thread_id, site_id, level, header.timestamp, args, header.size);
+            return;
+        }
+
+        if (!ring.announced)
+        {
+            out.push_back('T');
+            put(out, ring.index);
+            put_string(out, ring.thread_id);
+            ring.announced = true;
+        }
+
+        out.push_back('R');
+        put(out, ring.index);
+        put(out, site_id);
+        put(out, static_cast<uint8_t>(level));
+        put(out, header.timestamp);
+        put(out, header.size);
+        out.append(args, header.size);
+
+        if (out.size() >= 64 * 1024)
+            write_out();
+    }
+
+    void write_out()
+    {
+        if (!out.empty())
+        {
+            std::fwrite(out.data(), 1, out.size(), stream);
+            out.clear();
+        }
+    }
+
+    void loop()
+    {
+        VT::set_current_thread_name("vt-blog-writer");
+
+        std::vector<std::shared_ptr<Ring>> snapshot;
+
+        std::unique_lock<std::mutex> l(lock);
+        for (;;)
+        {
+            const uint64_t flush_ticket = flush_requested;
+            const bool stopping = stop;
+            pending_wake.store(false);
+
+            // forget rings of exited threads drained by the previous pass
+            for (size_t i = 0; i < rings.size(); )
+            {
+                if (rings[i]->orphaned() && rings[i]->empty())
+                {
+                    rings[i] = std::move(rings.back());
+                    rings.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            snapshot = rings;
+
+            l.unlock();
+
+            bool drained = false;
+            for (auto& ring : snapshot)
+            {
+                ring->consume_records([&](const RecordHeader& header, const char* args)
+                {
+                    emit(*ring, header, args);
+                    drained = true;
+                });
+            }
+            write_out();
+
+            if (drained || flush_ticket != flush_completed)
+                std::fflush(stream);
+
+            const uint64_t total_dropped = dropped.load(std::memory_order_relaxed);
+            if (total_dropped != reported_dropped && (drained || stopping))
+            {
+                std::cerr << "VT::BinaryLogger " << name << ": " << (total_dropped - reported_dropped)
+                          << " records dropped" << std::endl;
+                reported_dropped = total_dropped;
+            }
+
+            l.lock();
+
+            if (flush_ticket != flush_completed)
+            {
+                flush_completed = flush_ticket;
+                flushed.notify_all();
+            }
+
+            if (stopping)
+                break;
+
+            if (!pending_wake && flush_requested == flush_completed)
+                wake.wait_for(l, std::chrono::milliseconds(options.poll_interval_ms));
+        }
+    }
+
+    const std::string name;
+    std::FILE* stream;
+    const bool owns_stream;
+    const BinaryLogOptions options;
+    const uint64_t serial;
+
+    const int64_t clock_ns;
+    const int64_t wall_ns;
+
+    std::atomic<uint64_t> dropped;
+    uint64_t reported_dropped;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable flushed;
+    std::atomic<bool> pending_wake;
+
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint32_t next_ring_index;
+
+    uint64_t flush_requested;
+    uint64_t flush_completed;
+    bool stop;
+
+    // writer thread only
+    Formatter formatter;
+    std::string out;
+
+    std::thread thread;
+};
+
+
+VT::BinaryLogger::BinaryLogger(const std::string& name, std::FILE* stream, const BinaryLogOptions& options)
+    : level_(options.level)
+    , pimpl_(new Impl(name, stream, false, options))
+{
+}
+
+VT::BinaryLogger::BinaryLogger(const std::string& name, const std::string& filename, const BinaryLogOptions& options)
+    : level_(options.level)
+    , pimpl_(nullptr)
+{
+    std::FILE* file = std::fopen(filename.c_str(), options.raw ? "ab" : "a");
+    if (!file)
+        throw std::runtime_error("Can't open binary log file '" + filename + "'");
+
+    pimpl_ = new Impl(name, file, true, options);
+}
+
+VT::BinaryLogger::~BinaryLogger()
+{
+    delete pimpl_;
+}
+
+void VT::BinaryLogger::flush()
+{
+    std::unique_lock<std::mutex> l(pimpl_->lock);
+    const uint64_t ticket = ++pimpl_->flush_requested;
+    pimpl_->wake.notify_all();
+    pimpl_->flushed.wait(l, [&]{ return pimpl_->flush_completed >= ticket || pimpl_->stop; });
+}
+
+uint64_t VT::BinaryLogger::dropped() const
+{
+    return pimpl_->dropped.load(std::memory_order_relaxed);
+}
+
+char* VT::BinaryLogger::reserve(uint32_t site_id, LogLevel level, size_t args_size, void*& ring_out)
+{
+    const int64_t timestamp = now_ns();
+
+    Ring* ring = pimpl_->thread_ring();
+    const size_t need = record_size(args_size);
+
+    if (need > ring->capacity() / 2)
+    {
+        pimpl_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    char* record;
+    while (!(record = ring->reserve(sizeof(RecordHeader) + args_size)))
+    {
+        if (pimpl_->options.overflow == LOF_Drop)
+        {
+            pimpl_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        pimpl_->wake_writer();
+        std::this_thread::yield();
+    }
+
+    RecordHeader header = { static_cast<uint32_t>(args_size),
+                            site_id | (static_cast<uint32_t>(level) << kSiteBits), timestamp };
+    std::memcpy(record, &header, sizeof(header));
+
+    ring_out = ring;
+    return record + sizeof(header);
+}
+
+void VT::BinaryLogger::commit(void* ring_ptr)
+{
+    Ring* ring = static_cast<Ring*>(ring_ptr);
+    ring->commit();
+
+    if (ring->used() >= ring->capacity() / 2)
+        pimpl_->wake_writer();
+}
+
+
+uint32_t VT::detail_::register_binary_site(BinarySite& site, const char* fmt, const uint8_t* types, size_t count)
+{
+    return SiteRegistry::instance().add(site, fmt, types, count);
+}
+
+
+bool VT::decode_binary_log(std::FILE* in, std::FILE* out)
+{
+    std::unique_ptr<Formatter> formatter;
+    std::vector<std::string> threads;
+    std::string args;
+
+    for (;;)
+    {
+        int kind = std::fgetc(in);
+        if (kind == EOF)
+            return formatter != nullptr;
+
+        if (kind == kMagic[0])
+        {
+            char magic[sizeof(kMagic) - 1];
+            if (std::fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+                std::memcmp(magic, kMagic + 1, sizeof(magic)) != 0)
+                return false;
+
+            // new session
+            formatter.reset(new Formatter(out));
+            threads.clear();
+            continue;
+        }
+
+        if (!formatter)
+            return false;
+
+        switch (kind)
+        {
+        case 'N':
+        {
+            std::string name;
+            int64_t wall_ns, clock_ns;
+            if (!get_string(in, name) || !get(in, wall_ns) || !get(in, clock_ns))
+                return false;
+            formatter->set_name(name);
+            formatter->set_clock(wall_ns, clock_ns);
+            break;
+        }
+        case 'S':
+        {
+            uint32_t id, line;
+            uint8_t count;
+            Site site;
+            if (!get(in, id) || !get(in, line) || !get_string(in, site.file) || !get_string(in, site.fmt) ||
+                !get(in, count) || !get_bytes(in, args, count))
+                return false;
+            site.line = static_cast<int>(line);
+            site.types.assign(args.begin(), args.end());
+            if (!formatter->add_site(id, site))
+                return false;
+            break;
+        }
+        case 'T':
+        {
+            uint32_t index;
+            std::string thread_id;
+            if (!get(in, index) || !get_string(in, thread_id) || index > threads.size() + 1024)
+                return false;
+            if (threads.size() <= index)
+                threads.resize(index + 1);
+            threads[index] = thread_id;
+            break;
+        }
+        case 'R':
+        {
+            uint32_t thread, site, size;
+            uint8_t level;
+            int64_t timestamp;
+            if (!get(in, thread) || !get(in, site) || !get(in, level) || !get(in, timestamp) ||
+                !get(in, size) || !get_bytes(in, args, size) || thread >= threads.size())
+                return false;
+            if (!formatter->write(threads[thread], site, static_cast<LogLevel>(level), timestamp, args.data(), args.size()))
+                return false;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+
+#ifdef _MSC_VER
+    #pragma warning(pop)
+#endif
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "VTCPPLogger.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/*
+ * Binary (deferred formatting) logger for hot paths.
+ *
+ *   static VT::BinaryLogger log("net", "net.blog", opts);
+ *   VT_BLOG(log, VT::LL_Info, "packet {0} from {1}, {2} bytes", seq, peer_name, size);
+ *
+ * The calling thread only stores the call site id, a TSC timestamp and the raw bytes
+ * of the arguments into its own lock-free ring buffer. A background thread of the logger
+ * turns them into the usual text lines (same layout as VT::Logger) or, with
+ * BinaryLogOptions::raw, writes them out as they are together with the format strings,
+ * to be decoded later with VT::decode_binary_log().
+ *
+ * Format strings follow VT::safe_sprintf and must be string literals. Supported
+ * arguments are arithmetic types, pointers, C strings and std::string (strings are copied).
+ * Order of lines is kept within a thread, not across threads.
+ */
+
+namespace VT
+{
+    struct BinaryLogOptions
+    {
+        BinaryLogOptions()
+            : level(LL_Debug)
+            , raw(false)
+            , overflow(LOF_Drop)
+            , ring_bytes(1024 * 1024)
+            , poll_interval_ms(10)
+        { }
+
+        LogLevel level;
+        bool raw;               // write binary records instead of text
+        LogOverflow overflow;   // LOF_Block or LOF_Drop (LOF_Sync can't format on the calling thread)
+        size_t ring_bytes;      // per logging thread
+        int poll_interval_ms;   // the writer picks up records at least this often
+    };
+
+    namespace detail_
+    {
+        enum BinaryArgType
+        {
+            BA_Bool, BA_Char, BA_SChar, BA_UChar, BA_Short, BA_UShort, BA_Int, BA_UInt,
+            BA_Long, BA_ULong, BA_LongLong, BA_ULongLong, BA_Float, BA_Double, BA_LongDouble,
+            BA_Pointer, BA_String
+        };
+
+        // call site of VT_BLOG, registered on first use
+        struct BinarySite
+        {
+            constexpr BinarySite(const char* file, int line) : id(0), file(file), line(line) { }
+
+            std::atomic<uint32_t> id;
+            const char* file;
+            int line;
+        };
+
+        uint32_t register_binary_site(BinarySite& site, const char* fmt, const uint8_t* types, size_t count);
+
+        // encoding of a single argument, not defined for unsupported types
+
+        template <typename T>
+        struct BinaryArg;
+
+        template <typename T, BinaryArgType Type>
+        struct BinaryPodArg
+        {
+            static const uint8_t type = Type;
+            static size_t size(const T&) { return sizeof(T); }
+            static char* encode(char* out, const T& value)
+            {
+                std::memcpy(out, &value, sizeof(T));
+                return out + sizeof(T);
+            }
+        };
+
+        template <> struct BinaryArg<bool>               : BinaryPodArg<bool, BA_Bool> { };
+        template <> struct BinaryArg<char>               : BinaryPodArg<char, BA_Char> { };
+        template <> struct BinaryArg<signed char>        : BinaryPodArg<signed char, BA_SChar> { };
+        template <> struct BinaryArg<unsigned char>      : BinaryPodArg<unsigned char, BA_UChar> { };
+        template <> struct BinaryArg<short>              : BinaryPodArg<short, BA_Short> { };
+        template <> struct BinaryArg<unsigned short>     : BinaryPodArg<unsigned short, BA_UShort> { };
+        template <> struct BinaryArg<int>                : BinaryPodArg<int, BA_Int> { };
+        template <> struct BinaryArg<unsigned int>       : BinaryPodArg<unsigned int, BA_UInt> { };
+        template <> struct BinaryArg<long>               : BinaryPodArg<long, BA_Long> { };
+        template <> struct BinaryArg<unsigned long>      : BinaryPodArg<unsigned long, BA_ULong> { };
+        template <> struct BinaryArg<long long>          : BinaryPodArg<long long, BA_LongLong> { };
+        template <> struct BinaryArg<unsigned long long> : BinaryPodArg<unsigned long long, BA_ULongLong> { };
+        template <> struct BinaryArg<float>              : BinaryPodArg<float, BA_Float> { };
+        template <> struct BinaryArg<double>             : BinaryPodArg<double, BA_Double> { };
+        template <> struct BinaryArg<long double>        : BinaryPodArg<long double, BA_LongDouble> { };
+
+        template <typename T>
+        struct BinaryArg<T*>
+        {
+            static const uint8_t type = BA_Pointer;
+            static size_t size(T*) { return sizeof(const void*); }
+            static char* encode(char* out, T* value)
+            {
+                const void* p = value;
+                std::memcpy(out, &p, sizeof(p));
+                return out + sizeof(p);
+            }
+        };
+
+        // strings are stored as uint32_t length followed by the characters
+        struct BinaryStringArg
+        {
+            static const uint8_t type = BA_String;
+            static size_t size(const char* s) { return sizeof(uint32_t) + (s ? std::strlen(s) : 0); }
+            static size_t size(const std::string& s) { return sizeof(uint32_t) + s.size(); }
+            static char* encode(char* out, const char* s) { return encode(out, s, s ? std::strlen(s) : 0); }
+            static char* encode(char* out, const std::string& s) { return encode(out, s.data(), s.size()); }
+            static char* encode(char* out, const char* s, size_t length)
+            {
+                uint32_t n = static_cast<uint32_t>(length);
+                std::memcpy(out, &n, sizeof(n));
+                std::memcpy(out + sizeof(n), s, length);
+                return out + sizeof(n) + length;
+            }
+        };
+
+        template <> struct BinaryArg<char*>              : BinaryStringArg { };
+        template <> struct BinaryArg<const char*>        : BinaryStringArg { };
+        template <> struct BinaryArg<std::string>        : BinaryStringArg { };
+        template <size_t N> struct BinaryArg<char[N]>    : BinaryStringArg { };
+
+        inline size_t binary_args_size() { return 0; }
+
+        template <typename A, typename... Args>
+        size_t binary_args_size(const A& arg, const Args&... args)
+        {
+            return BinaryArg<A>::size(arg) + binary_args_size(args...);
+        }
+
+        inline char* binary_encode(char* out) { return out; }
+
+        template <typename A, typename... Args>
+        char* binary_encode(char* out, const A& arg, const Args&... args)
+        {
+            return binary_encode(BinaryArg<A>::encode(out, arg), args...);
+        }
+    }
+
+
+    class BinaryLogger
+    {
+    public:
+        // [stream] is not closed by the logger
+        BinaryLogger(const std::string& name, std::FILE* stream, const BinaryLogOptions& options = BinaryLogOptions());
+
+        // throws std::runtime_error when the file can't be opened
+        BinaryLogger(const std::string& name, const std::string& filename, const BinaryLogOptions& options = BinaryLogOptions());
+
+        // writes out everything logged so far
+        ~BinaryLogger();
+
+        bool enabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+        void set_level(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+
+        // blocks until records logged so far are written and flushed
+        void flush();
+
+        // records dropped because of a full ring (LOF_Drop)
+        uint64_t dropped() const;
+
+        // use VT_BLOG instead
+        template <typename... Args>
+        void write(detail_::BinarySite& site, LogLevel level, const char* fmt, const Args&... args);
+
+    private:
+        BinaryLogger(const BinaryLogger&);
+        BinaryLogger& operator=(const BinaryLogger&);
+
+        // header of the record is filled in, returns where the arguments go or null if dropped
+        char* reserve(uint32_t site_id, LogLevel level, size_t args_size, void*& ring);
+        void commit(void* ring);
+
+        std::atomic<int> level_;
+
+        struct Impl;
+        Impl* pimpl_;
+    };
+
+    // converts a raw binary log into text lines, returns false on a malformed or truncated input
+    bool decode_binary_log(std::FILE* in, std::FILE* out);
+
+
+    template <typename... Args>
+    void BinaryLogger::write(detail_::BinarySite& site, LogLevel level, const char* fmt, const Args&... args)
+    {
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if (id == 0)
+        {
+            const uint8_t types[] = { detail_::BinaryArg<Args>::type..., 0 };
+            id = detail_::register_binary_site(site, fmt, types, sizeof...(Args));
+        }
+
+        void* ring = nullptr;
+        char* out = reserve(id, level, detail_::binary_args_size(args...), ring);
+        if (!out)
+            return;  // dropped
+
+        detail_::binary_encode(out, args...);
+        commit(ring);
+    }
+}
+
+
+// arguments are not evaluated when [level] is disabled
+#define VT_BLOG(logger, level, ...)                                                         \
+    do {                                                                                    \
+        if ((logger).enabled(level))                                                        \
+        {                                                                                   \
+            static VT::detail_::BinarySite vt_blog_site_(__FILE__, __LINE__);               \
+            (logger).write(vt_blog_site_, level, __VA_ARGS__);                              \
+        }                                                                                   \
+    } while (0)
@@ -28,6 +28,10 @@
 #define dll_export __declspec(dllexport)
 #define dll_import __declspec(dllimport)
 
+// Spin-wait hint
+#include <intrin.h>
+#define VT_CPU_RELAX() _mm_pause()
+
 // x64 detection
 #ifdef _M_AMD64
 #define USE64
@@ -54,6 +58,15 @@
 #define dll_export
 #define dll_import
 
+// Spin-wait hint
+#if defined(__i386__) || defined(__x86_64__)
+#define VT_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define VT_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define VT_CPU_RELAX() ((void)0)
+#endif
+
 // x64 detection
 #ifdef __LP64__
 #define USE64
@@ -62,3 +75,6 @@
 #endif
 
 #endif
+
+// Used to pad data written by different threads to avoid false sharing
+#define VT_CACHE_LINE_SIZE 64
@@ -0,0 +1,31 @@
+#include "VTCoroutine.h"
+
+#ifdef VT_HAS_COROUTINES
+
+#include "VTTimerService.h"
+
+#include <algorithm>
+#include <climits>
+
+
+// a one-shot timer of the shared service posts the coroutine to its pool; the service
+// dispatches to ThreadPoolSingleton, whose queue is unbounded, so a sleeper is never dropped
+void VT::d_::resume_at(std::chrono::steady_clock::time_point deadline, ThreadPool& pool, std::coroutine_handle<> handle)
+{
+    const auto delay = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    const int delay_ms = static_cast<int>(std::min<int64_t>(std::max<int64_t>(delay.count(), 0), INT_MAX));
+
+    TimerService::instance().schedule_once(delay_ms, [&pool, handle]
+    {
+        try
+        {
+            pool.schedule().await_suspend(handle);
+        }
+        catch (...)
+        {
+            handle.resume();  // the pool rejected it (full queue), don't lose the coroutine
+        }
+    });
+}
+
+#endif // VT_HAS_COROUTINES
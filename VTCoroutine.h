@@ -0,0 +1,416 @@
+#pragma once
+
+#include "VTTaskGraph.h"
+
+/*
+ * C++20 coroutines on top of VT::ThreadPool.
+ *
+ *  * co_await pool.schedule() moves the coroutine to a pool thread
+ *  * CoTask<T> is a lazy coroutine, it starts when awaited and resumes its awaiter
+ *    by symmetric transfer (no stack growth in long co_await chains)
+ *  * VT::spawn(pool, task) starts a CoTask on the pool and returns TaskFuture<T>,
+ *    co_await future suspends until the future completes
+ *  * AsyncEvent is an awaitable counterpart of VT::Event
+ *  * co_await sleep_for(pool, 10ms) resumes on the pool after the delay
+ *
+ * Nothing is declared unless the compiler supports coroutines (VT_HAS_COROUTINES).
+ */
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+    #if __has_include(<coroutine>)
+        #define VT_HAS_COROUTINES
+    #endif
+#endif
+
+#ifdef VT_HAS_COROUTINES
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace VT
+{
+    template <typename T = void>
+    class CoTask;
+
+    namespace d_
+    {
+        // resumes whoever awaited the finished coroutine
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept { }
+        };
+
+        struct CoTaskPromiseBase
+        {
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+
+            void unhandled_exception() { error = std::current_exception(); }
+
+            void rethrow_if_failed() const
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template <typename T>
+        struct CoTaskPromise : CoTaskPromiseBase
+        {
+            CoTask<T> get_return_object();
+
+            template <typename U>
+            void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+            T take()
+            {
+                rethrow_if_failed();
+                return std::move(*result);
+            }
+
+            std::optional<T> result;
+        };
+
+        template <>
+        struct CoTaskPromise<void> : CoTaskPromiseBase
+        {
+            CoTask<void> get_return_object();
+
+            void return_void() { }
+
+            void take() { rethrow_if_failed(); }
+        };
+    }
+
+
+    // lazily started coroutine returning T (or throwing), awaitable once
+    template <typename T>
+    class [[nodiscard]] CoTask
+    {
+    public:
+        typedef d_::CoTaskPromise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> Handle;
+
+        CoTask() : handle_(nullptr) { }
+        explicit CoTask(Handle handle) : handle_(handle) { }
+        CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+
+        CoTask& operator=(CoTask&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle_)
+                    handle_.destroy();
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        ~CoTask()
+        {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        bool valid() const { return handle_ != nullptr; }
+        bool is_ready() const { return !handle_ || handle_.done(); }
+
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return handle.done(); }
+
+            // starts the task, it transfers back to the awaiter when it finishes
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().take(); }
+
+            Handle handle;
+        };
+
+        Awaiter operator co_await() && noexcept
+        {
+            assert(handle_ && "Awaiting an empty VT::CoTask");
+            return Awaiter{ handle_ };
+        }
+
+    private:
+        CoTask(const CoTask&) = delete;
+        CoTask& operator=(const CoTask&) = delete;
+
+        Handle handle_;
+    };
+
+    template <typename T>
+    CoTask<T> d_::CoTaskPromise<T>::get_return_object()
+    {
+        return CoTask<T>(CoTask<T>::Handle::from_promise(*this));
+    }
+
+    inline CoTask<void> d_::CoTaskPromise<void>::get_return_object()
+    {
+        return CoTask<void>(CoTask<void>::Handle::from_promise(*this));
+    }
+
+
+    namespace d_
+    {
+        // fire-and-forget coroutine, frees itself when it finishes
+        struct Detached
+        {
+            struct promise_type
+            {
+                Detached get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept { }
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+
+        template <typename T>
+        Detached run_detached(ThreadPool& pool, TaskOptions options, CoTask<T> task, std::shared_ptr<FutureState<T>> out)
+        {
+            try
+            {
+                co_await pool.schedule(options);
+                if constexpr (std::is_void<T>::value)
+                {
+                    co_await std::move(task);
+                    out->set_value();
+                }
+                else
+                {
+                    out->set_value(co_await std::move(task));
+                }
+            }
+            catch (...)
+            {
+                out->set_exception(std::current_exception());
+            }
+        }
+    }
+
+
+    // runs the coroutine on the pool, the future completes when it co_returns
+    template <typename T>
+    TaskFuture<T> spawn(ThreadPool& pool, CoTask<T> task, const TaskOptions& options = TaskOptions())
+    {
+        std::shared_ptr<d_::FutureState<T>> out = std::make_shared<d_::FutureState<T>>();
+        d_::run_detached(pool, options, std::move(task), out);
+        return TaskFuture<T>(&pool, out);
+    }
+
+
+    // co_await future resumes on the thread that completed the future
+    template <typename T>
+    struct FutureAwaiter
+    {
+        bool await_ready() const { return future.is_ready(); }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            future.state()->add_continuation([handle]{ handle.resume(); });
+        }
+
+        decltype(std::declval<const TaskFuture<T>&>().get()) await_resume() const
+        {
+            return future.state()->value();
+        }
+
+        TaskFuture<T> future;
+    };
+
+    template <typename T>
+    FutureAwaiter<T> operator co_await(const TaskFuture<T>& future)
+    {
+        assert(future.valid());
+        return FutureAwaiter<T>{ future };
+    }
+
+
+    /*
+     * Event for coroutines: awaiting it suspends the coroutine instead of blocking a thread.
+     *
+     * Same reset semantics as VT::Event. Waiters are resumed on the pool given to wait()
+     * or, by default, right on the thread calling signal().
+     */
+    class AsyncEvent
+    {
+    public:
+        explicit AsyncEvent(bool manual_reset = true)
+            : manual_reset_(manual_reset)
+            , signaled_(false)
+        { }
+
+        ~AsyncEvent()
+        {
+            assert(waiters_.empty() && "VT::AsyncEvent destroyed with suspended waiters");
+        }
+
+        bool is_manual_reset() const { return manual_reset_; }
+
+        bool is_signaled() const
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            return signaled_;
+        }
+
+        void signal()
+        {
+            std::vector<Waiter> ready;
+
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                if (manual_reset_)
+                {
+                    signaled_ = true;
+                    ready.swap(waiters_);
+                }
+                else if (waiters_.empty())
+                {
+                    signaled_ = true;
+                }
+                else
+                {
+                    ready.push_back(waiters_.front());
+                    waiters_.erase(waiters_.begin());
+                }
+            }
+
+            for (const Waiter& waiter : ready)
+                resume(waiter);
+        }
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            signaled_ = false;
+        }
+
+        class Awaiter
+        {
+        public:
+            Awaiter(AsyncEvent& event, ThreadPool* pool) : event_(event), pool_(pool) { }
+
+            bool await_ready() { return event_.try_consume(); }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard<std::mutex> l(event_.lock_);
+                if (event_.try_consume_locked())
+                    return false;
+
+                event_.waiters_.push_back(Waiter{ handle, pool_ });
+                return true;
+            }
+
+            void await_resume() const { }
+
+        private:
+            AsyncEvent& event_;
+            ThreadPool* pool_;
+        };
+
+        // if [pool] is given, the waiter resumes on it
+        Awaiter wait(ThreadPool* pool = nullptr) { return Awaiter(*this, pool); }
+
+        Awaiter operator co_await() { return wait(); }
+
+    private:
+        AsyncEvent(const AsyncEvent&) = delete;
+        AsyncEvent& operator=(const AsyncEvent&) = delete;
+
+        struct Waiter
+        {
+            std::coroutine_handle<> handle;
+            ThreadPool* pool;
+        };
+
+        bool try_consume()
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            return try_consume_locked();
+        }
+
+        bool try_consume_locked()
+        {
+            if (!signaled_)
+                return false;
+            if (!manual_reset_)
+                signaled_ = false;
+            return true;
+        }
+
+        static void resume(const Waiter& waiter)
+        {
+            if (waiter.pool)
+                waiter.pool->schedule().await_suspend(waiter.handle);
+            else
+                waiter.handle.resume();
+        }
+
+        const bool manual_reset_;
+        mutable std::mutex lock_;
+        bool signaled_;
+        std::vector<Waiter> waiters_;
+    };
+
+
+    namespace d_
+    {
+        // posts handle to the pool once deadline passes (one-shot timer of TimerService::instance())
+        void resume_at(std::chrono::steady_clock::time_point deadline, ThreadPool& pool, std::coroutine_handle<> handle);
+    }
+
+    class SleepAwaiter
+    {
+    public:
+        SleepAwaiter(ThreadPool& pool, std::chrono::steady_clock::time_point deadline)
+            : pool_(pool)
+            , deadline_(deadline)
+        { }
+
+        bool await_ready() const { return deadline_ <= std::chrono::steady_clock::now(); }
+        void await_suspend(std::coroutine_handle<> handle) { d_::resume_at(deadline_, pool_, handle); }
+        void await_resume() const { }
+
+    private:
+        ThreadPool& pool_;
+        std::chrono::steady_clock::time_point deadline_;
+    };
+
+    // suspends without holding a thread, resumes on the pool
+    inline SleepAwaiter sleep_until(ThreadPool& pool, std::chrono::steady_clock::time_point deadline)
+    {
+        return SleepAwaiter(pool, deadline);
+    }
+
+    template <typename Rep, typename Period>
+    SleepAwaiter sleep_for(ThreadPool& pool, std::chrono::duration<Rep, Period> delay)
+    {
+        return SleepAwaiter(pool, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+    }
+}
+
+#endif // VT_HAS_COROUTINES
@@ -1,78 +1,448 @@
 #pragma once
 
+#include "VTCompilerSpecific.h"
+#include "VTFutex.h"
+
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <algorithm>
 #include <assert.h>
 
+#ifdef __linux__
+    #define VT_EVENT_USE_FUTEX
+#endif
+
 namespace VT
 {
     static const int VT_INFINITE = -1;
 
+    /*
+     * Eventcount: lets a thread sleep until some condition becomes true without
+     * the condition itself knowing about waiters.
+     *
+     *  waiter:   key = ec.prepare_wait(); if (condition) ec.cancel_wait(); else ec.wait(key);
+     *  notifier: make condition true; ec.notify_all();
+     *
+     * notify_*() cost only a fence and a load when nobody is waiting.
+     */
+    class EventCount
+    {
+    public:
+        EventCount() : epoch_(0), waiters_(0) { }
+
+        uint32_t prepare_wait()
+        {
+            waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return epoch_.load(std::memory_order_acquire);
+        }
+
+        void cancel_wait()
+        {
+            waiters_.fetch_sub(1);
+        }
+
+        // returns false on timeout, if timeout == -1, waits infinitely
+        bool wait(uint32_t key, int timeout_ms = VT_INFINITE)
+        {
+            typedef std::chrono::steady_clock clock;
+            const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms == -1 ? 0 : timeout_ms);
+
+            bool notified = true;
+            while (epoch_.load(std::memory_order_acquire) == key)
+            {
+                int wait_ms = -1;
+                if (timeout_ms != -1)
+                {
+                    auto left_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now()).count();
+                    if (left_us <= 0)
+                    {
+                        notified = false;
+                        break;
+                    }
+                    wait_ms = static_cast<int>((left_us + 999) / 1000);
+                }
+                d_::futex_wait(&epoch_, key, wait_ms);
+            }
+
+            waiters_.fetch_sub(1);
+            return notified;
+        }
+
+        void notify_one() { notify(false); }
+        void notify_all() { notify(true); }
+
+    private:
+        EventCount(const EventCount&);
+        EventCount& operator=(const EventCount&);
+
+        void notify(bool all)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters_.load(std::memory_order_relaxed) == 0)
+                return;
+
+            epoch_.fetch_add(1, std::memory_order_release);
+            if (all)
+                d_::futex_wake_all(&epoch_);
+            else
+                d_::futex_wake_one(&epoch_);
+        }
+
+        std::atomic<uint32_t> epoch_;
+        std::atomic<uint32_t> waiters_;
+    };
+
+
+    // manual reset event stays signaled until reset(), releasing all waiters
+    // auto reset event releases exactly one waiter per signal() and resets itself
     class Event
     {
     public:
-		explicit Event(bool manual_reset = true)
-			: lock_()
-			, cond_()
-			, is_signaled_(false)
+        explicit Event(bool manual_reset = true)
+#ifdef VT_EVENT_USE_FUTEX
+            : state_(0)
+            , spin_limit_(kMinSpin)
+#else
+            : lock_()
+            , cond_()
+            , is_signaled_(false)
+#endif
             , manual_reset_(manual_reset)
-		{
-		}
+            , watcher_count_(0)
+        {
+        }
 
         ~Event() { }
 
-		void signal()
-		{
-			if (is_signaled_)
-				return;
-                
-            std::unique_lock<std::mutex> lk(lock_);
+        bool is_manual_reset() const { return manual_reset_; }
+
+        // eventcounts notified on every signal(), used by WaitSet
+        void attach(EventCount* watcher)
+        {
+            std::lock_guard<std::mutex> lk(watchers_lock_);
+            watchers_.push_back(watcher);
+            watcher_count_.store(watchers_.size());
+        }
+
+        void detach(EventCount* watcher)
+        {
+            std::lock_guard<std::mutex> lk(watchers_lock_);
+            watchers_.erase(std::remove(watchers_.begin(), watchers_.end(), watcher), watchers_.end());
+            watcher_count_.store(watchers_.size());
+        }
+
+#ifdef VT_EVENT_USE_FUTEX
+
+        // state_ layout: bit 0 - signaled, the rest - number of parked waiters (in units of kWaiter)
+
+        void signal()
+        {
+            uint32_t old = state_.fetch_or(kSignaled);
+
+            if (old & kSignaled)
+                return;
+
+            notify_watchers();
+
+            if (old < kWaiter)
+                return;  // nobody to wake, no syscall
 
             if (manual_reset_)
-				is_signaled_ = true;
+                d_::futex_wake_all(&state_);
+            else
+                d_::futex_wake_one(&state_);
+        }
 
-			cond_.notify_all();
-		}
+        void reset()
+        {
+            state_.fetch_and(~kSignaled);
+        }
 
-		void reset()
-		{
-			is_signaled_ = false;
-		}
-        
         // return true if event is signaled and false on timeout
         // if timeout == -1, waits infinitely
-		bool wait(int timeout_ms = VT_INFINITE)
-		{
-			assert( (timeout_ms >= 0 || timeout_ms == VT_INFINITE) && "Incorrect timeout value" );
-            
-			std::unique_lock<std::mutex> lk(lock_);
-            
-            if (is_signaled_)
+        bool wait(int timeout_ms = VT_INFINITE)
+        {
+            assert( (timeout_ms >= 0 || timeout_ms == VT_INFINITE) && "Incorrect timeout value" );
+
+            if (try_consume())
                 return true;
 
-			if (timeout_ms != -1)
-			{
-				bool res = cond_.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&]{ return is_signaled_ == true; });
-				return res;  // res is true if event was signaled before timeout
-			}
-			else
-			{
-				cond_.wait(lk, [&]{ return is_signaled_ == true; });
-				return true;
-			}
-		}
+            if (timeout_ms == 0)
+                return false;
+
+            // spin adaptively: grow the budget when spinning pays off, shrink it when we end up parking anyway
+            int limit = spin_limit_.load(std::memory_order_relaxed);
+            for (int i = 0; i < limit; ++i)
+            {
+                VT_CPU_RELAX();
+                if (try_consume())
+                {
+                    spin_limit_.store(limit < kMaxSpin ? limit * 2 : kMaxSpin, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            spin_limit_.store(limit > kMinSpin ? limit / 2 : kMinSpin, std::memory_order_relaxed);
+
+            return park(timeout_ms);
+        }
+
+        bool is_signaled() const { return (state_.load() & kSignaled) != 0; }
+
+#else
+
+        void signal()
+        {
+            {
+                std::lock_guard<std::mutex> lk(lock_);
+
+                if (is_signaled_)
+                    return;
+
+                is_signaled_ = true;
+
+                if (manual_reset_)
+                    cond_.notify_all();
+                else
+                    cond_.notify_one();
+            }
+
+            notify_watchers();
+        }
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lk(lock_);
+            is_signaled_ = false;
+        }
+
+        // return true if event is signaled and false on timeout
+        // if timeout == -1, waits infinitely
+        bool wait(int timeout_ms = VT_INFINITE)
+        {
+            assert( (timeout_ms >= 0 || timeout_ms == VT_INFINITE) && "Incorrect timeout value" );
+
+            std::unique_lock<std::mutex> lk(lock_);
+
+            bool res = true;
+            if (timeout_ms != -1)
+                res = cond_.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&]{ return is_signaled_ == true; });
+            else
+                cond_.wait(lk, [&]{ return is_signaled_ == true; });
+
+            if (res && !manual_reset_)
+                is_signaled_ = false;
+
+            return res;  // res is true if event was signaled before timeout
+        }
 
         bool is_signaled() const { return is_signaled_; }
 
+#endif
+
     private:
         Event(const Event&);
         Event& operator=(const Event&);
 
+        void notify_watchers()
+        {
+            if (watcher_count_.load() == 0)
+                return;
+
+            std::lock_guard<std::mutex> lk(watchers_lock_);
+            for (EventCount* watcher : watchers_)
+                watcher->notify_all();
+        }
+
+#ifdef VT_EVENT_USE_FUTEX
+
+        static const uint32_t kSignaled = 1;
+        static const uint32_t kWaiter = 2;
+        static const int kMinSpin = 16;
+        static const int kMaxSpin = 4096;
+
+        bool try_consume()
+        {
+            uint32_t s = state_.load();
+
+            if (manual_reset_)
+                return (s & kSignaled) != 0;
+
+            while (s & kSignaled)
+            {
+                if (state_.compare_exchange_weak(s, s & ~kSignaled))
+                    return true;
+            }
+            return false;
+        }
+
+        bool park(int timeout_ms)
+        {
+            typedef std::chrono::steady_clock clock;
+            const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms == -1 ? 0 : timeout_ms);
+
+            uint32_t s = state_.fetch_add(kWaiter) + kWaiter;
+
+            for (;;)
+            {
+                // consume signal and unregister in one step
+                while (s & kSignaled)
+                {
+                    uint32_t target = (manual_reset_ ? s : (s & ~kSignaled)) - kWaiter;
+                    if (state_.compare_exchange_weak(s, target))
+                        return true;
+                }
+
+                int wait_ms = -1;
+                if (timeout_ms != -1)
+                {
+                    auto left_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now()).count();
+                    if (left_us <= 0)
+                    {
+                        state_.fetch_sub(kWaiter);
+                        return false;
+                    }
+                    wait_ms = static_cast<int>((left_us + 999) / 1000);
+                }
+
+                d_::futex_wait(&state_, s, wait_ms);
+                s = state_.load();
+            }
+        }
+
+        std::atomic<uint32_t> state_;
+        std::atomic<int> spin_limit_;
+
+#else
+
         std::mutex lock_;
         std::condition_variable cond_;
         std::atomic<bool> is_signaled_;
+
+#endif
+
         bool manual_reset_;
+
+        std::atomic<size_t> watcher_count_;
+        std::mutex watchers_lock_;
+        std::vector<EventCount*> watchers_;
     };
-}
 
+
+    /*
+     * Lets one thread wait on several events and conditions with a single park.
+     *
+     * Events notify the set on signal() by themselves. For conditions
+     * (e.g. "queue is not empty") whoever makes the condition true must call notify().
+     * Auto reset events are consumed when reported as fired.
+     */
+    class WaitSet
+    {
+    public:
+        WaitSet() { }
+
+        ~WaitSet()
+        {
+            for (Event* event : events_)
+            {
+                if (event)
+                    event->detach(&count_);
+            }
+        }
+
+        // return index of added source
+        size_t add(Event& event)
+        {
+            event.attach(&count_);
+            events_.push_back(&event);
+            conditions_.push_back(std::function<bool()>());
+            return events_.size() - 1;
+        }
+
+        size_t add(const std::function<bool()>& condition)
+        {
+            events_.push_back(nullptr);
+            conditions_.push_back(condition);
+            return events_.size() - 1;
+        }
+
+        // call after making any added condition true
+        void notify() { count_.notify_all(); }
+
+        // returns index of the first fired source or -1 on timeout
+        // if [fired] is given, it receives indexes of all fired sources
+        // if timeout == -1, waits infinitely
+        int wait(int timeout_ms = VT_INFINITE, std::vector<size_t>* fired = nullptr)
+        {
+            typedef std::chrono::steady_clock clock;
+            const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms == -1 ? 0 : timeout_ms);
+
+            for (;;)
+            {
+                int index = poll(fired);
+                if (index != -1)
+                    return index;
+
+                uint32_t key = count_.prepare_wait();
+
+                index = poll(fired);
+                if (index != -1)
+                {
+                    count_.cancel_wait();
+                    return index;
+                }
+
+                int wait_ms = -1;
+                if (timeout_ms != -1)
+                {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+                    wait_ms = static_cast<int>(left > 0 ? left : 0);
+                }
+
+                if (!count_.wait(key, wait_ms))
+                    return poll(fired);
+            }
+        }
+
+    private:
+        WaitSet(const WaitSet&);
+        WaitSet& operator=(const WaitSet&);
+
+        int poll(std::vector<size_t>* fired)
+        {
+            int first = -1;
+            if (fired)
+                fired->clear();
+
+            for (size_t i = 0; i < events_.size(); ++i)
+            {
+                bool ready = false;
+                if (events_[i])
+                    ready = (events_[i]->is_manual_reset() ? events_[i]->is_signaled() : events_[i]->wait(0));
+                else
+                    ready = conditions_[i]();
+
+                if (!ready)
+                    continue;
+
+                if (first == -1)
+                    first = static_cast<int>(i);
+
+                if (!fired)
+                    break;
+
+                fired->push_back(i);
+            }
+
+            return first;
+        }
+
+        EventCount count_;
+        std::vector<Event*> events_;
+        std::vector<std::function<bool()>> conditions_;
+    };
+}
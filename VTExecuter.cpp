@@ -1,55 +1,34 @@
 #include "VTExecuter.h"
 
-#include "VTEvent.hpp"
-
-#include <functional>
-#include <thread>
-#include <iostream>
-
 struct VT::Executer::impl
 {
-    impl(const std::function<void()>& update_fnc, int update_interval_ms)
-        : interval_ms_(update_interval_ms)
-        , fnc_(update_fnc)
-        , thread_(std::bind(std::mem_fn(&Executer::impl::worker), this))
-    { }
-
-    ~impl()
+    impl(TimerService& service, const std::function<void()>& fnc, int interval_ms, TimerMode mode)
+        : service_(service)
+        , id_(0)
     {
-        stop_.signal();
-        thread_.join();
+        assert(mode != TM_OneShot);
+
+        if (interval_ms > 0 && fnc)
+            id_ = service_.schedule_periodic(interval_ms, fnc, mode);
     }
 
-    void worker()
+    ~impl()
     {
-        if (interval_ms_ == 0 || !fnc_)
-            return;
-
-        while (!stop_.wait(interval_ms_))
-        {
-            try
-            {
-                fnc_();
-            }
-            catch (const std::exception& ex)
-            {
-                std::cerr << "Exception in VT::Executer thread: " << ex.what() << std::endl;
-            }
-            catch (...)
-            {
-                std::cerr << "Uknown error in VT::Executer thread." << std::endl;
-            }
-        }
+        if (id_)
+            service_.cancel(id_, true);
     }
 
-    int interval_ms_;
-    VT::Event stop_;
-    std::function<void()> fnc_;
-    std::thread thread_;
+    TimerService& service_;
+    TimerService::TimerId id_;
 };
 
-VT::Executer::Executer(const std::function<void()>& call_fnc, int call_interval_ms)
-    : d(new impl(call_fnc, call_interval_ms))
+VT::Executer::Executer(const std::function<void()>& call_fnc, int call_interval_ms, TimerMode mode)
+    : d(new impl(TimerService::instance(), call_fnc, call_interval_ms, mode))
+{
+}
+
+VT::Executer::Executer(TimerService& service, const std::function<void()>& call_fnc, int call_interval_ms, TimerMode mode)
+    : d(new impl(service, call_fnc, call_interval_ms, mode))
 {
 }
 
@@ -57,4 +36,3 @@ VT::Executer::~Executer()
 {
     delete d;
 }
-
@@ -1,15 +1,21 @@
 #pragma once
 
 #include "VTUtil.h"
+#include "VTTimerService.h"
 
 #include <functional>
 
 namespace VT
 {
+    // calls fnc every call_interval_ms on the timer service's pool (no thread of its own),
+    // the first call happens after one interval; interval 0 or empty fnc disables it
     class Executer
     {
     public:
-        Executer(const std::function<void()>& fnc, int call_interval_ms);
+        Executer(const std::function<void()>& fnc, int call_interval_ms, TimerMode mode = TM_FixedRate);
+        Executer(TimerService& service, const std::function<void()>& fnc, int call_interval_ms, TimerMode mode = TM_FixedRate);
+
+        // returns after a running call of fnc finishes, fnc is not called anymore
         ~Executer();
 
     private:
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Thin wrappers around futex (Linux) and WaitOnAddress (Windows 8+)
+// used to park threads on a 32-bit atomic word without a mutex
+
+namespace VT
+{
+    namespace d_
+    {
+        // blocks while *addr == expected, may return spuriously
+        // returns false on timeout, if timeout == -1, waits infinitely
+        bool futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, int timeout_ms = -1);
+
+        void futex_wake_one(std::atomic<uint32_t>* addr);
+        void futex_wake_all(std::atomic<uint32_t>* addr);
+    }
+}
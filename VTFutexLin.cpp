@@ -0,0 +1,48 @@
+#include "VTFutex.h"
+
+#include <climits>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit integer");
+
+namespace
+{
+    long futex(std::atomic<uint32_t>* addr, int op, uint32_t val, const timespec* timeout)
+    {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val, timeout, nullptr, 0);
+    }
+}
+
+
+bool VT::d_::futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, int timeout_ms)
+{
+    timespec ts;
+    timespec* pts = nullptr;
+
+    if (timeout_ms != -1)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        pts = &ts;
+    }
+
+    // EAGAIN (value already changed) and EINTR are treated as spurious wakeups
+    long ret = futex(addr, FUTEX_WAIT_PRIVATE, expected, pts);
+    return !(ret == -1 && errno == ETIMEDOUT);
+}
+
+
+void VT::d_::futex_wake_one(std::atomic<uint32_t>* addr)
+{
+    futex(addr, FUTEX_WAKE_PRIVATE, 1, nullptr);
+}
+
+
+void VT::d_::futex_wake_all(std::atomic<uint32_t>* addr)
+{
+    futex(addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+}
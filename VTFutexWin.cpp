@@ -0,0 +1,27 @@
+#include "VTFutex.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+
+#include <windows.h>
+
+
+bool VT::d_::futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, int timeout_ms)
+{
+    DWORD timeout = (timeout_ms == -1 ? INFINITE : static_cast<DWORD>(timeout_ms));
+    BOOL ret = WaitOnAddress(reinterpret_cast<volatile VOID*>(addr), &expected, sizeof(expected), timeout);
+    return !(ret == FALSE && GetLastError() == ERROR_TIMEOUT);
+}
+
+
+void VT::d_::futex_wake_one(std::atomic<uint32_t>* addr)
+{
+    WakeByAddressSingle(reinterpret_cast<PVOID>(addr));
+}
+
+
+void VT::d_::futex_wake_all(std::atomic<uint32_t>* addr)
+{
+    WakeByAddressAll(reinterpret_cast<PVOID>(addr));
+}
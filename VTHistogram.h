@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <assert.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+/*
+ * Log-linear histograms for latencies and sizes.
+ *
+ * Every power of two range is split into 8 linear sub-buckets, so a value is
+ * reported with at most 12.5% relative error, the whole uint64_t range takes
+ * 496 buckets. Histogram records concurrently with relaxed atomics and is read
+ * through snapshot(); HistogramSnapshot is a plain copy that can be merged and queried.
+ */
+
+namespace VT
+{
+    namespace d_
+    {
+        inline unsigned floor_log2(uint64_t v)
+        {
+            assert(v != 0);
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanReverse64(&index, v);
+            return index;
+#elif defined(__GNUC__)
+            return 63 - __builtin_clzll(v);
+#else
+            unsigned r = 0;
+            while (v >>= 1)
+                ++r;
+            return r;
+#endif
+        }
+    }
+
+
+    class HistogramSnapshot
+    {
+    public:
+        static const unsigned kSubBucketBits = 3;
+        static const size_t kSubBuckets = size_t(1) << kSubBucketBits;
+        static const size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+        HistogramSnapshot()
+            : counts_(kBucketCount, 0)
+            , count_(0)
+            , sum_(0)
+            , min_(std::numeric_limits<uint64_t>::max())
+            , max_(0)
+        { }
+
+        static size_t bucket_index(uint64_t value)
+        {
+            if (value < kSubBuckets)
+                return static_cast<size_t>(value);
+
+            unsigned exp = d_::floor_log2(value);
+            size_t sub = static_cast<size_t>(value >> (exp - kSubBucketBits)) & (kSubBuckets - 1);
+            return (exp - kSubBucketBits + 1) * kSubBuckets + sub;
+        }
+
+        // smallest value falling into the bucket
+        static uint64_t bucket_lower(size_t index)
+        {
+            assert(index < kBucketCount);
+            if (index < kSubBuckets)
+                return index;
+
+            unsigned exp = static_cast<unsigned>(index / kSubBuckets) + kSubBucketBits - 1;
+            uint64_t sub = index % kSubBuckets;
+            return (kSubBuckets + sub) << (exp - kSubBucketBits);
+        }
+
+        // largest value falling into the bucket
+        static uint64_t bucket_upper(size_t index)
+        {
+            return index + 1 < kBucketCount ? bucket_lower(index + 1) - 1 : std::numeric_limits<uint64_t>::max();
+        }
+
+        void record(uint64_t value, uint64_t times = 1)
+        {
+            counts_[bucket_index(value)] += times;
+            count_ += times;
+            sum_ += value * times;
+            if (value < min_)
+                min_ = value;
+            if (value > max_)
+                max_ = value;
+        }
+
+        void merge(const HistogramSnapshot& other)
+        {
+            for (size_t i = 0; i < kBucketCount; ++i)
+                counts_[i] += other.counts_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            if (other.min_ < min_)
+                min_ = other.min_;
+            if (other.max_ > max_)
+                max_ = other.max_;
+        }
+
+        uint64_t count() const { return count_; }
+        uint64_t sum() const { return sum_; }
+        uint64_t min() const { return count_ ? min_ : 0; }
+        uint64_t max() const { return max_; }
+        double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+        // value not exceeded by [percent] (0..100) of recorded values,
+        // upper bound of the bucket it falls into, limited by max()
+        uint64_t percentile(double percent) const
+        {
+            if (count_ == 0)
+                return 0;
+
+            uint64_t rank = static_cast<uint64_t>(percent / 100.0 * count_ + 0.5);
+            if (rank < 1)
+                rank = 1;
+            if (rank > count_)
+                rank = count_;
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBucketCount; ++i)
+            {
+                seen += counts_[i];
+                if (seen >= rank)
+                    return bucket_upper(i) < max_ ? bucket_upper(i) : max_;
+            }
+            return max_;
+        }
+
+        const std::vector<uint64_t>& buckets() const { return counts_; }
+
+    private:
+        friend class Histogram;
+
+        std::vector<uint64_t> counts_;
+        uint64_t count_;
+        uint64_t sum_;
+        uint64_t min_;
+        uint64_t max_;
+    };
+
+
+    class Histogram
+    {
+    public:
+        Histogram()
+        {
+            reset();
+        }
+
+        // wait-free, safe to call from any number of threads
+        void record(uint64_t value)
+        {
+            counts_[HistogramSnapshot::bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+            count_.fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t current = min_.load(std::memory_order_relaxed);
+            while (value < current && !min_.compare_exchange_weak(current, value, std::memory_order_relaxed))
+                ;
+
+            current = max_.load(std::memory_order_relaxed);
+            while (value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed))
+                ;
+        }
+
+        // not atomic as a whole: values recorded meanwhile may be partially included
+        HistogramSnapshot snapshot() const
+        {
+            HistogramSnapshot s;
+            for (size_t i = 0; i < HistogramSnapshot::kBucketCount; ++i)
+                s.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+            s.count_ = count_.load(std::memory_order_relaxed);
+            s.sum_ = sum_.load(std::memory_order_relaxed);
+            s.min_ = min_.load(std::memory_order_relaxed);
+            s.max_ = max_.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        void reset()
+        {
+            for (size_t i = 0; i < HistogramSnapshot::kBucketCount; ++i)
+                counts_[i].store(0, std::memory_order_relaxed);
+            count_.store(0, std::memory_order_relaxed);
+            sum_.store(0, std::memory_order_relaxed);
+            min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+            max_.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        Histogram(const Histogram&);
+        Histogram& operator=(const Histogram&);
+
+        std::atomic<uint64_t> counts_[HistogramSnapshot::kBucketCount];
+        std::atomic<uint64_t> count_;
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> min_;
+        std::atomic<uint64_t> max_;
+    };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "VTCompilerSpecific.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+/*
+ * Single-producer single-consumer byte ring of variable-size records, shared by the
+ * async and the binary loggers.
+ *
+ * A record is an 8-byte frame followed by the payload padded to 8 bytes, so every
+ * record starts at a multiple of 8. A record never wraps around the end of the ring:
+ * when it doesn't fit into the tail, the tail is skipped with a padding frame. The
+ * tail is then at least 8 bytes (offsets are multiples of 8), so the frame always fits.
+ */
+
+namespace VT
+{
+    namespace detail_
+    {
+        class LogRing
+        {
+        public:
+            explicit LogRing(size_t capacity)
+                : mask_(round_up_pow2(capacity) - 1)
+                , buffer_(new char[mask_ + 1])
+                , pending_(0)
+                , head_(0)
+                , tail_(0)
+            { }
+
+            size_t capacity() const { return mask_ + 1; }
+
+            // bytes taken by a record with [size] bytes of payload
+            static size_t record_size(size_t size)
+            {
+                return sizeof(Frame) + ((size + 7) & ~size_t(7));
+            }
+
+            bool empty() const
+            {
+                return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+            }
+
+            // producer side
+
+            size_t used() const
+            {
+                return static_cast<size_t>(head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+            }
+
+            // payload of a new record (not published until commit()), null if there is no room right now
+            char* reserve(size_t size)
+            {
+                const size_t need = record_size(size);
+                uint64_t head = head_.load(std::memory_order_relaxed);
+                size_t offset = static_cast<size_t>(head & mask_);
+                const size_t skip = (capacity() - offset < need ? capacity() - offset : 0);
+
+                if (capacity() - used() < need + skip)
+                    return nullptr;
+
+                if (skip)
+                {
+                    Frame padding = { 0, kSkip };
+                    std::memcpy(buffer_.get() + offset, &padding, sizeof(padding));
+                    head += skip;
+                    offset = 0;
+                }
+
+                Frame frame = { static_cast<uint32_t>(size), 0 };
+                std::memcpy(buffer_.get() + offset, &frame, sizeof(frame));
+
+                pending_ = head + need;
+                return buffer_.get() + offset + sizeof(frame);
+            }
+
+            void commit()
+            {
+                head_.store(pending_, std::memory_order_release);
+            }
+
+            // consumer side, calls fn(payload, size) for every record published so far
+            template <typename F>
+            size_t consume(F fn)
+            {
+                uint64_t tail = tail_.load(std::memory_order_relaxed);
+                const uint64_t head = head_.load(std::memory_order_acquire);
+                size_t count = 0;
+
+                while (tail != head)
+                {
+                    const size_t offset = static_cast<size_t>(tail & mask_);
+                    Frame frame;
+                    std::memcpy(&frame, buffer_.get() + offset, sizeof(frame));
+
+                    if (frame.flags & kSkip)
+                    {
+                        tail += capacity() - offset;
+                        continue;
+                    }
+
+                    fn(static_cast<const char*>(buffer_.get() + offset + sizeof(frame)), static_cast<size_t>(frame.size));
+                    tail += record_size(frame.size);
+                    ++count;
+                }
+
+                tail_.store(tail, std::memory_order_release);
+                return count;
+            }
+
+        private:
+            LogRing(const LogRing&);
+            LogRing& operator=(const LogRing&);
+
+            struct Frame
+            {
+                uint32_t size;      // payload bytes
+                uint32_t flags;
+            };
+
+            static const uint32_t kSkip = 1;  // rest of the ring is unused
+
+            static size_t round_up_pow2(size_t v)
+            {
+                size_t p = 64;
+                while (p < v)
+                    p <<= 1;
+                return p;
+            }
+
+            const size_t mask_;
+            std::unique_ptr<char[]> buffer_;
+            uint64_t pending_;  // producer only
+
+            char pad0_[VT_CACHE_LINE_SIZE];
+            std::atomic<uint64_t> head_;
+            char pad1_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+            std::atomic<uint64_t> tail_;
+            char pad2_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+        };
+    }
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "VTThreadPool.h"
+#include "VTEvent.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <assert.h>
+
+/*
+ * Data-parallel algorithms on top of VT::ThreadPool.
+ *
+ *  * ranges are split recursively in halves until they are not bigger than grain,
+ *    one half is posted to the pool and the other one is processed by the current thread
+ *  * grain == 0 picks a grain giving about 4 chunks per pool thread
+ *  * calling thread takes part in the work and runs queued pool tasks while it waits,
+ *    so it is safe to call these from inside pool tasks
+ *  * first exception thrown by the body is rethrown in the calling thread after all
+ *    started work finishes
+ */
+
+namespace VT
+{
+    // set of tasks that can be waited for together; tasks may add more tasks to the group
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool& pool)
+            : pool_(pool)
+            , pending_(0)
+            , notifying_(0)
+        { }
+
+        ~TaskGroup()
+        {
+            wait_no_throw();
+        }
+
+        ThreadPool& pool() { return pool_; }
+
+        template <typename F>
+        void run(F&& work)
+        {
+            typedef typename std::decay<F>::type Fn;
+
+            // ThreadPool::Task keeps only nothrow movable callables in place
+            static_assert(std::is_nothrow_move_constructible<Runner<Fn>>::value ||
+                          !std::is_nothrow_move_constructible<Fn>::value, "Runner move must be noexcept");
+
+            pending_.fetch_add(1);
+            try
+            {
+                pool_.post(Runner<Fn>(this, std::forward<F>(work)));
+            }
+            catch (...)
+            {
+                done();  // e.g. QueueFullError, wait() must not wait for it
+                throw;
+            }
+        }
+
+        // runs work inline, capturing its exception the same way pool tasks do
+        template <typename F>
+        void run_here(F&& work)
+        {
+            try
+            {
+                work();
+            }
+            catch (...)
+            {
+                set_exception(std::current_exception());
+            }
+        }
+
+        // helps the pool while waiting, rethrows first exception of group's tasks
+        void wait()
+        {
+            wait_no_throw();
+
+            if (error_)
+            {
+                std::exception_ptr error = error_;
+                error_ = std::exception_ptr();
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        TaskGroup(const TaskGroup&);
+        TaskGroup& operator=(const TaskGroup&);
+
+        template <typename F>
+        struct Runner
+        {
+            Runner(TaskGroup* g, F&& f) : group(g), fn(std::move(f)) { }
+            Runner(TaskGroup* g, const F& f) : group(g), fn(f) { }
+            Runner(Runner&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+                : group(other.group), fn(std::move(other.fn))
+            { }
+
+            void operator()()
+            {
+                group->run_here(fn);
+                group->done();
+            }
+
+            TaskGroup* group;
+            F fn;
+        };
+
+        void done()
+        {
+            // the group may be destroyed as soon as a waiter sees pending_ == 0,
+            // wait_no_throw() also waits for notifying_ to drop before returning
+            notifying_.fetch_add(1);
+            if (pending_.fetch_sub(1) == 1)
+                finished_.notify_all();
+            notifying_.fetch_sub(1);
+        }
+
+        void set_exception(std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> l(error_lock_);
+            if (!error_)
+                error_ = error;
+        }
+
+        void wait_no_throw()
+        {
+            while (pending_.load() != 0)
+            {
+                if (pool_.try_run_pending_task())
+                    continue;
+
+                // the rest is running on other threads
+                uint32_t key = finished_.prepare_wait();
+                if (pending_.load() == 0)
+                    finished_.cancel_wait();
+                else
+                    finished_.wait(key, 1);  // wake up now and then to help with newly queued work
+            }
+
+            while (notifying_.load() != 0)
+                std::this_thread::yield();
+        }
+
+        ThreadPool& pool_;
+        std::atomic<size_t> pending_;
+        std::atomic<size_t> notifying_;  // done() calls still touching the group
+        EventCount finished_;
+        std::mutex error_lock_;
+        std::exception_ptr error_;
+    };
+
+
+    namespace d_
+    {
+        // element of its own, std::vector<bool> would pack concurrently written partials into shared words
+        template <typename T>
+        struct ReducePartial
+        {
+            T value;
+        };
+
+        template <typename Index>
+        Index auto_grain(ThreadPool& pool, Index begin, Index end)
+        {
+            Index chunks = static_cast<Index>(pool.thread_count() * 4);
+            Index grain = (end - begin) / (chunks > 0 ? chunks : 1);
+            return grain > 0 ? grain : 1;
+        }
+
+        // calls body(b, e) on subranges of [begin, end) not bigger than grain
+        template <typename Index, typename Body>
+        void split_range(TaskGroup& group, Index begin, Index end, Index grain, const Body& body)
+        {
+            while (end - begin > grain)
+            {
+                Index mid = begin + (end - begin) / 2;
+                group.run([&group, mid, end, grain, &body]{ split_range(group, mid, end, grain, body); });
+                end = mid;
+            }
+
+            if (begin < end)
+                body(begin, end);
+        }
+
+        template <typename Index, typename Body>
+        void parallel_range(ThreadPool& pool, Index begin, Index end, Index grain, const Body& body)
+        {
+            if (!(begin < end))
+                return;
+
+            if (grain <= 0)
+                grain = auto_grain(pool, begin, end);
+
+            TaskGroup group(pool);
+            group.run_here([&]{ split_range(group, begin, end, grain, body); });
+            group.wait();
+        }
+
+        template <typename RandomIt, typename Compare>
+        void parallel_sort_impl(TaskGroup& group, RandomIt first, RandomIt last, Compare comp, size_t cutoff)
+        {
+            typedef typename std::iterator_traits<RandomIt>::value_type Value;
+
+            while (static_cast<size_t>(last - first) > cutoff)
+            {
+                // median of three
+                RandomIt mid = first + (last - first) / 2;
+                RandomIt back = last - 1;
+                if (comp(*mid, *first))
+                    std::iter_swap(mid, first);
+                if (comp(*back, *mid))
+                {
+                    std::iter_swap(back, mid);
+                    if (comp(*mid, *first))
+                        std::iter_swap(mid, first);
+                }
+                Value pivot = *mid;
+
+                // three-way partition keeps equal elements out of both halves
+                RandomIt lower = std::partition(first, last, [&](const Value& v) { return comp(v, pivot); });
+                RandomIt upper = std::partition(lower, last, [&](const Value& v) { return !comp(pivot, v); });
+
+                group.run([&group, first, lower, comp, cutoff]{ parallel_sort_impl(group, first, lower, comp, cutoff); });
+                first = upper;
+            }
+
+            std::sort(first, last, comp);
+        }
+    }
+
+
+    // calls fn(i) for every i in [begin, end)
+    template <typename Index, typename F>
+    void parallel_for(ThreadPool& pool, Index begin, Index end, Index grain, const F& fn)
+    {
+        d_::parallel_range(pool, begin, end, grain, [&fn](Index b, Index e)
+        {
+            for (Index i = b; i < e; ++i)
+                fn(i);
+        });
+    }
+
+    template <typename Index, typename F>
+    void parallel_for(ThreadPool& pool, Index begin, Index end, const F& fn)
+    {
+        parallel_for(pool, begin, end, Index(0), fn);
+    }
+
+
+    // reduces [begin, end) in chunks: partial = chunk_fn(b, e, identity), result combines partials
+    // in order of the chunks, so combine needs to be associative but not commutative;
+    // T needs to be copyable, bool is fine (partials are not kept in a std::vector<bool>)
+    template <typename Index, typename T, typename ChunkFn, typename Combine>
+    T parallel_reduce(ThreadPool& pool, Index begin, Index end, Index grain, const T& identity,
+                      const ChunkFn& chunk_fn, const Combine& combine)
+    {
+        if (!(begin < end))
+            return identity;
+
+        if (grain <= 0)
+            grain = d_::auto_grain(pool, begin, end);
+
+        const size_t chunks = static_cast<size_t>((end - begin + grain - 1) / grain);
+        std::vector<d_::ReducePartial<T>> partials(chunks, d_::ReducePartial<T>{ identity });
+
+        d_::parallel_range(pool, size_t(0), chunks, size_t(1), [&](size_t b, size_t e)
+        {
+            for (size_t c = b; c < e; ++c)
+            {
+                Index from = begin + static_cast<Index>(c) * grain;
+                Index to = (end - from > grain ? from + grain : end);
+                partials[c].value = chunk_fn(from, to, identity);
+            }
+        });
+
+        T result = identity;
+        for (size_t c = 0; c < chunks; ++c)
+            result = combine(result, partials[c].value);
+        return result;
+    }
+
+
+    // out[i] = fn(in[i]) for random access iterators
+    template <typename InIt, typename OutIt, typename F>
+    OutIt parallel_transform(ThreadPool& pool, InIt first, InIt last, OutIt out, const F& fn, size_t grain = 0)
+    {
+        const size_t count = static_cast<size_t>(last - first);
+        d_::parallel_range(pool, size_t(0), count, grain, [&](size_t b, size_t e)
+        {
+            for (size_t i = b; i < e; ++i)
+                out[i] = fn(first[i]);
+        });
+        return out + count;
+    }
+
+
+    // parallel quicksort, not stable; ranges shorter than cutoff are sorted with std::sort
+    template <typename RandomIt, typename Compare>
+    void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp, size_t cutoff = 2048)
+    {
+        TaskGroup group(pool);
+        group.run_here([&]{ d_::parallel_sort_impl(group, first, last, comp, cutoff > 1 ? cutoff : 2); });
+        group.wait();
+    }
+
+    template <typename RandomIt>
+    void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last)
+    {
+        parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+    }
+}
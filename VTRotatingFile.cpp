@@ -0,0 +1,306 @@
+#include "VTRotatingFile.h"
+#include "VTThreadAffinity.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <assert.h>
+
+// shut up fopen security warning in Visual Studio
+#ifdef _MSC_VER
+    #pragma warning(push)
+    #pragma warning(disable: 4996)
+#endif
+
+namespace
+{
+    int64_t now_s()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool exists(const std::string& path)
+    {
+        std::FILE* f = std::fopen(path.c_str(), "rb");
+        if (f)
+            std::fclose(f);
+        return f != nullptr;
+    }
+
+    bool non_empty(const std::string& path)
+    {
+        std::FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        bool result = (std::fgetc(f) != EOF);
+        std::fclose(f);
+        return result;
+    }
+
+    // moves both the plain and the compressed version
+    void move_segment(const std::string& from, const std::string& to)
+    {
+        static const char* const suffixes[] = { "", ".gz" };
+        for (const char* suffix : suffixes)
+        {
+            if (exists(from + suffix))
+            {
+                std::remove((to + suffix).c_str());
+                std::rename((from + suffix).c_str(), (to + suffix).c_str());
+            }
+        }
+    }
+
+    void remove_segment(const std::string& path)
+    {
+        std::remove(path.c_str());
+        std::remove((path + ".gz").c_str());
+    }
+}
+
+
+struct VT::RotatingFile::Impl
+{
+    explicit Impl(const RotatingFileOptions& options)
+        : options(options)
+        , next_rotation_s(0)
+        , compressing(false)
+        , stop(false)
+    {
+        assert(!options.path.empty() && options.max_files >= 0 && options.rotate_interval_s >= 0);
+        assert(!options.use_mmap || options.max_bytes > 0);
+    }
+
+    ~Impl()
+    {
+        if (compressor.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> l(compress_lock);
+                stop = true;
+            }
+            compress_wake.notify_all();
+            compressor.join();
+        }
+    }
+
+    std::string archived(int index) const
+    {
+        std::ostringstream oss;
+        oss << options.path << '.' << index;
+        return oss.str();
+    }
+
+    void schedule_rotation()
+    {
+        if (options.rotate_interval_s > 0)
+            next_rotation_s = (now_s() / options.rotate_interval_s + 1) * options.rotate_interval_s;
+    }
+
+    void open_segment()
+    {
+        segment.reset(new d_::LogSegment(options.path, options.preallocate ? options.max_bytes : 0,
+                                         options.use_mmap));
+        schedule_rotation();
+    }
+
+    // [path] must be closed
+    void shift()
+    {
+        wait_compressed();  // path.1 is not renamed under gzip's feet
+
+        if (options.max_files == 0)
+        {
+            std::remove(options.path.c_str());
+            return;
+        }
+
+        remove_segment(archived(options.max_files));
+        for (int i = options.max_files - 1; i >= 1; --i)
+            move_segment(archived(i), archived(i + 1));
+
+        std::remove(archived(1).c_str());
+        if (std::rename(options.path.c_str(), archived(1).c_str()) == 0 && options.compress)
+            compress(archived(1));
+    }
+
+    // false if the segment can't be created, writes are dropped until it can
+    bool reopen()
+    {
+        try
+        {
+            open_segment();
+            return true;
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << "VT::RotatingFile: " << ex.what() << std::endl;
+            return false;
+        }
+    }
+
+    void rotate()
+    {
+        segment.reset();
+        shift();
+        reopen();
+    }
+
+    // compression
+
+    void compress(const std::string& path)
+    {
+        std::lock_guard<std::mutex> l(compress_lock);
+        if (!compressor.joinable())
+            compressor = std::thread([this]{ compress_loop(); });
+        queue.push_back(path);
+        compress_wake.notify_all();
+    }
+
+    void wait_compressed()
+    {
+        std::unique_lock<std::mutex> l(compress_lock);
+        compress_done.wait(l, [this]{ return queue.empty() && !compressing; });
+    }
+
+    void compress_loop()
+    {
+        VT::set_current_thread_name("vt-log-gzip");
+
+        std::unique_lock<std::mutex> l(compress_lock);
+        for (;;)
+        {
+            compress_wake.wait(l, [this]{ return stop || !queue.empty(); });
+            if (queue.empty())
+                break;  // stopping
+
+            std::string path = queue.front();
+            queue.pop_front();
+            compressing = true;
+            l.unlock();
+
+            if (!d_::gzip_file(path))
+                std::cerr << "VT::RotatingFile: failed to compress " << path << std::endl;
+
+            l.lock();
+            compressing = false;
+            compress_done.notify_all();
+        }
+    }
+
+    const RotatingFileOptions options;
+
+    std::mutex lock;
+    std::unique_ptr<d_::LogSegment> segment;
+    int64_t next_rotation_s;
+
+    std::mutex compress_lock;
+    std::condition_variable compress_wake;
+    std::condition_variable compress_done;
+    std::deque<std::string> queue;
+    bool compressing;
+    bool stop;
+    std::thread compressor;
+};
+
+
+VT::RotatingFile::RotatingFile(const RotatingFileOptions& options)
+    : d(new Impl(options))
+{
+    try
+    {
+        if (non_empty(options.path))
+            d->shift();
+        d->open_segment();
+    }
+    catch (...)
+    {
+        delete d;
+        throw;
+    }
+}
+
+VT::RotatingFile::~RotatingFile()
+{
+    d->segment.reset();
+    delete d;
+}
+
+void VT::RotatingFile::write(const char* data, size_t size)
+{
+    std::lock_guard<std::mutex> l(d->lock);
+
+    if (!d->segment && !d->reopen())
+        return;
+
+    if (d->next_rotation_s > 0 && now_s() >= d->next_rotation_s)
+    {
+        if (d->segment->size() > 0)
+            d->rotate();
+        else
+            d->schedule_rotation();  // nothing to rotate
+        if (!d->segment)
+            return;
+    }
+
+    const size_t max_bytes = d->options.max_bytes;
+    if (max_bytes > 0 && d->segment->size() + size > max_bytes)
+    {
+        // stdio may pass partial lines, finish the segment at the last line end that fits
+        size_t head = (d->segment->size() < max_bytes ? max_bytes - d->segment->size() : 0);
+        while (head > 0 && data[head - 1] != '\n')
+            --head;
+
+        d->segment->write(data, head);
+        data += head;
+        size -= head;
+
+        if (d->segment->size() > 0)
+            d->rotate();
+    }
+
+    if (d->segment)
+        d->segment->write(data, size);
+}
+
+void VT::RotatingFile::rotate()
+{
+    std::lock_guard<std::mutex> l(d->lock);
+    d->rotate();
+}
+
+size_t VT::RotatingFile::size() const
+{
+    std::lock_guard<std::mutex> l(d->lock);
+    return d->segment ? d->segment->size() : 0;
+}
+
+std::FILE* VT::RotatingFile::open(const RotatingFileOptions& options)
+{
+    std::unique_ptr<RotatingFile> file;
+    try
+    {
+        file.reset(new RotatingFile(options));
+    }
+    catch (const std::exception&)
+    {
+        return nullptr;
+    }
+
+    std::FILE* stream = d_::open_rotating_stream(file.get());
+    if (stream)
+        file.release();  // owned by the stream now
+    return stream;
+}
+
+
+#ifdef _MSC_VER
+    #pragma warning(pop)
+#endif
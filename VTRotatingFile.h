@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/*
+ * Log file rotated by size and/or time, with a bounded number of closed segments.
+ *
+ * The active segment is [path]; closed ones are shifted to path.1 (newest), path.2, ...,
+ * path.<max_files>, older ones are deleted. With [compress] closed segments are gzipped
+ * in the background (path.1.gz, ...).
+ *
+ * Segments are preallocated to max_bytes with fallocate so that writes don't change the
+ * file size, and can be written through a shared memory mapping instead of write() calls;
+ * a segment is trimmed to the written size when it is closed. Until then readers see
+ * the preallocated tail as zeros. Preallocation, mmap and compression are Linux only.
+ */
+
+namespace VT
+{
+    struct RotatingFileOptions
+    {
+        RotatingFileOptions()
+            : max_bytes(64 * 1024 * 1024)
+            , rotate_interval_s(0)
+            , max_files(10)
+            , preallocate(true)
+            , use_mmap(false)
+            , compress(false)
+        { }
+
+        std::string path;
+        size_t max_bytes;           // size trigger, 0: none
+        int rotate_interval_s;      // time trigger at multiples of the interval since the epoch (UTC), 0: none
+        int max_files;              // closed segments kept
+        bool preallocate;           // fallocate max_bytes for every segment
+        bool use_mmap;              // write through a mapping of max_bytes, needs max_bytes
+        bool compress;              // gzip closed segments
+    };
+
+    class RotatingFile
+    {
+    public:
+        // an existing non-empty [path] is rotated first; throws std::runtime_error
+        explicit RotatingFile(const RotatingFileOptions& options);
+
+        // closes the active segment, waits for pending compression
+        ~RotatingFile();
+
+        // thread-safe, rotates before the write if it would exceed max_bytes
+        void write(const char* data, size_t size);
+
+        void rotate();
+
+        // bytes in the active segment
+        size_t size() const;
+
+        // stdio stream writing into a new RotatingFile, fclose() destroys it;
+        // nullptr if the file can't be opened or the platform has no custom streams (Windows)
+        static std::FILE* open(const RotatingFileOptions& options);
+
+    private:
+        RotatingFile(const RotatingFile&);
+        RotatingFile& operator=(const RotatingFile&);
+
+        struct Impl;
+        Impl* d;
+    };
+
+    namespace d_
+    {
+        // platform part of RotatingFile
+
+        class LogSegment
+        {
+        public:
+            // creates/truncates [path], throws std::runtime_error
+            LogSegment(const std::string& path, size_t preallocate, bool use_mmap);
+
+            // trims the file to size()
+            ~LogSegment();
+
+            void write(const char* data, size_t size);
+            size_t size() const;
+
+        private:
+            LogSegment(const LogSegment&);
+            LogSegment& operator=(const LogSegment&);
+
+            struct Impl;
+            Impl* d;
+        };
+
+        // replaces [path] with path.gz, blocks until done; false on failure
+        bool gzip_file(const std::string& path);
+
+        std::FILE* open_rotating_stream(RotatingFile* file);
+    }
+}
@@ -0,0 +1,153 @@
+#include "VTRotatingFile.h"
+#include "VTUtil.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+
+struct VT::d_::LogSegment::Impl
+{
+    Impl() : fd(-1), map(nullptr), capacity(0), size(0) { }
+
+    std::string path;
+    int fd;
+    char* map;          // first [capacity] bytes of the file when mmap is used
+    size_t capacity;    // preallocated bytes
+    size_t size;        // written bytes
+};
+
+
+VT::d_::LogSegment::LogSegment(const std::string& path, size_t preallocate, bool use_mmap)
+    : d(new Impl())
+{
+    d->path = path;
+    d->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (d->fd == -1)
+    {
+        delete d;
+        create_system_exception("Can't open log file " + path);
+    }
+
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t capacity = (preallocate + page - 1) / page * page;
+
+    // blocks are reserved and the size set once, so writes don't update the inode size;
+    // file systems without fallocate get a sparse file for the mapping
+    if (capacity > 0 && posix_fallocate(d->fd, 0, static_cast<off_t>(capacity)) == 0)
+        d->capacity = capacity;
+
+    if (use_mmap && capacity > 0)
+    {
+        if (d->capacity == 0 && ftruncate(d->fd, static_cast<off_t>(capacity)) == 0)
+            d->capacity = capacity;
+
+        if (d->capacity > 0)
+        {
+            void* map = mmap(nullptr, d->capacity, PROT_WRITE, MAP_SHARED, d->fd, 0);
+            if (map != MAP_FAILED)
+                d->map = static_cast<char*>(map);
+        }
+    }
+}
+
+VT::d_::LogSegment::~LogSegment()
+{
+    if (d->map)
+        munmap(d->map, d->capacity);
+
+    if (d->capacity > d->size && ftruncate(d->fd, static_cast<off_t>(d->size)) != 0)
+        std::fprintf(stderr, "VT::RotatingFile: failed to trim %s: %s\n", d->path.c_str(), VT::strerror(errno).c_str());
+
+    ::close(d->fd);
+    delete d;
+}
+
+void VT::d_::LogSegment::write(const char* data, size_t size)
+{
+    if (d->map && d->size + size <= d->capacity)
+    {
+        std::memcpy(d->map + d->size, data, size);
+        d->size += size;
+        return;
+    }
+
+    while (size > 0)
+    {
+        ssize_t written = pwrite(d->fd, data, size, static_cast<off_t>(d->size));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;  // disk full and alike, there's nobody to report to
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        d->size += static_cast<size_t>(written);
+    }
+}
+
+size_t VT::d_::LogSegment::size() const
+{
+    return d->size;
+}
+
+
+bool VT::d_::gzip_file(const std::string& path)
+{
+    std::string arg0 = "gzip";
+    std::string arg1 = "-f";
+    std::string arg2 = path;
+    char* argv[] = { &arg0[0], &arg1[0], &arg2[0], nullptr };
+
+    pid_t pid;
+    if (posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0)
+        return false;
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+namespace
+{
+    ssize_t stream_write(void* cookie, const char* data, size_t size)
+    {
+        static_cast<VT::RotatingFile*>(cookie)->write(data, size);
+        return static_cast<ssize_t>(size);
+    }
+
+    int stream_close(void* cookie)
+    {
+        delete static_cast<VT::RotatingFile*>(cookie);
+        return 0;
+    }
+}
+
+std::FILE* VT::d_::open_rotating_stream(RotatingFile* file)
+{
+    cookie_io_functions_t io;
+    std::memset(&io, 0, sizeof(io));
+    io.write = stream_write;
+    io.close = stream_close;
+
+    std::FILE* stream = fopencookie(file, "w", io);
+    if (stream)
+        setvbuf(stream, nullptr, _IOFBF, 64 * 1024);  // async loggers write batches
+    return stream;
+}
@@ -0,0 +1,64 @@
+#include "VTRotatingFile.h"
+
+#include <stdexcept>
+
+// shut up fopen security warning in Visual Studio
+#ifdef _MSC_VER
+    #pragma warning(push)
+    #pragma warning(disable: 4996)
+#endif
+
+// no preallocation, mapping or compression on Windows, segments are plain files
+
+struct VT::d_::LogSegment::Impl
+{
+    Impl() : file(nullptr), size(0) { }
+
+    std::FILE* file;
+    size_t size;
+};
+
+
+VT::d_::LogSegment::LogSegment(const std::string& path, size_t /*preallocate*/, bool /*use_mmap*/)
+    : d(new Impl())
+{
+    d->file = std::fopen(path.c_str(), "wb");
+    if (!d->file)
+    {
+        delete d;
+        throw std::runtime_error("Can't open log file " + path);
+    }
+    setvbuf(d->file, nullptr, _IONBF, 0);
+}
+
+VT::d_::LogSegment::~LogSegment()
+{
+    std::fclose(d->file);
+    delete d;
+}
+
+void VT::d_::LogSegment::write(const char* data, size_t size)
+{
+    d->size += std::fwrite(data, 1, size, d->file);
+}
+
+size_t VT::d_::LogSegment::size() const
+{
+    return d->size;
+}
+
+
+bool VT::d_::gzip_file(const std::string& /*path*/)
+{
+    return false;
+}
+
+std::FILE* VT::d_::open_rotating_stream(RotatingFile* /*file*/)
+{
+    return nullptr;
+}
+
+
+#ifdef _MSC_VER
+    #pragma warning(pop)
+#endif
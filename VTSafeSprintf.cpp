@@ -68,36 +68,166 @@ VT::d_::Split VT::d_::split_format(const std::string& fmt)
 }
 
 
-void VT::d_::join(std::string& out, const Split& split)
+void VT::d_::modify_stream(std::ostringstream& oss, const std::string format)
+{
+    if (format.find_first_of("xX") != format.npos)
+        oss << std::hex;
+}
+
+
+
+namespace
 {
-    for (const Substring& chunk : split)
+    template <typename T>
+    void append_decimal(std::string& out, T value)
     {
-        if (chunk.type == SubstrText)
-            out.append(chunk.content);
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        char* p = end;
+        const bool negative = (value < 0);
+        unsigned long long rest = (negative ? 0ull - static_cast<unsigned long long>(value)
+                                            : static_cast<unsigned long long>(value));
+        do
+        {
+            *--p = static_cast<char>('0' + rest % 10);
+            rest /= 10;
+        } while (rest != 0);
+
+        if (negative)
+            *--p = '-';
+
+        out.append(p, static_cast<size_t>(end - p));
+    }
+
+    template <typename T>
+    void append_integer(std::string& out, T value, bool hex)
+    {
+        if (hex)
+            VT::d_::append_value<T>(out, value, hex);
         else
+            append_decimal(out, value);
+    }
+
+    struct RuntimeFormatter
+    {
+        void text(size_t begin, size_t end)
+        {
+            out.append(fmt + begin, end - begin);
+        }
+
+        void anchor(size_t begin, size_t end)
+        {
+            if (count == 0)
+            {
+                keep(begin, end);
+                return;
+            }
+
+            size_t colon = begin;
+            while (colon < end && fmt[colon] != ':')
+                ++colon;
+
+            if (colon == begin)
+                throw std::runtime_error("No position marker provided");
+
+            size_t index = 0;
+            for (size_t i = begin; i < colon; ++i)
+            {
+                if (fmt[i] < '0' || fmt[i] > '9')
+                    throw std::runtime_error("Position marker is not a number: " + std::string(fmt + begin, colon - begin));
+                if (index < count)
+                    index = index * 10 + static_cast<size_t>(fmt[i] - '0');
+            }
+
+            if (index >= count)
+            {
+                keep(begin, end);
+                return;
+            }
+
+            // without a spec the whole anchor is searched, as before
+            bool hex = false;
+            for (size_t i = (colon < end ? colon + 1 : begin); i < end; ++i)
+                hex = hex || fmt[i] == 'x' || fmt[i] == 'X';
+
+            args[index].append(out, args[index].value, hex);
+        }
+
+        void error(const char* reason)
+        {
+            throw std::runtime_error(std::string("Error in format string: ") + reason + ".");
+        }
+
+        // anchors without an argument stay in the output
+        void keep(size_t begin, size_t end)
         {
             out.push_back('{');
-            out.append(chunk.content);
+            out.append(fmt + begin, end - begin);
             out.push_back('}');
         }
-    }
+
+        std::string& out;
+        const char* fmt;
+        const VT::d_::FormatArg* args;
+        size_t count;
+    };
 }
 
 
-bool VT::d_::has_index(const std::string& substr, int index)
+void VT::d_::append_value(std::string& out, const std::string& value, bool /*hex*/)
 {
-    size_t pos = substr.find_first_of(":");
+    out.append(value);
+}
 
-    if ((pos != substr.npos && pos < 1) || (pos == substr.npos && substr.size() < 1))
-        throw std::runtime_error("No position marker provided");
 
-    return index == stoi(substr.substr(0, pos));
+void VT::d_::append_value(std::string& out, const char* value, bool /*hex*/)
+{
+    if (value)
+        out.append(value);  // streams print nothing for null
 }
 
 
-void VT::d_::modify_stream(std::ostringstream& oss, const std::string format)
+void VT::d_::append_value(std::string& out, int value, bool hex)                { append_integer(out, value, hex); }
+void VT::d_::append_value(std::string& out, unsigned int value, bool hex)       { append_integer(out, value, hex); }
+void VT::d_::append_value(std::string& out, long value, bool hex)               { append_integer(out, value, hex); }
+void VT::d_::append_value(std::string& out, unsigned long value, bool hex)      { append_integer(out, value, hex); }
+void VT::d_::append_value(std::string& out, long long value, bool hex)          { append_integer(out, value, hex); }
+void VT::d_::append_value(std::string& out, unsigned long long value, bool hex) { append_integer(out, value, hex); }
+
+
+void VT::d_::format_runtime(std::string& out, const char* fmt, size_t size, const FormatArg* args, size_t count)
 {
-    if (format.find_first_of("xX") != format.npos)
-        oss << std::hex;
+    RuntimeFormatter formatter = { out, fmt, args, count };
+    parse_format(fmt, size, formatter);
+}
+
+
+#ifdef VT_HAS_CONSTEVAL_FORMAT
+
+void VT::d_::invalid_format_string(const char* reason)
+{
+    throw std::runtime_error(std::string("Error in format string: ") + reason + ".");
+}
+
+
+void VT::d_::format_compiled(std::string& out, const CompiledFormat& format, const FormatArg* args)
+{
+    if (format.count == 0)
+    {
+        // too long for the segment table, already checked
+        RuntimeFormatter formatter = { out, format.fmt, args, static_cast<size_t>(-1) };
+        parse_format(format.fmt, format.size, formatter);
+        return;
+    }
+
+    for (size_t i = 0; i < format.count; ++i)
+    {
+        const FormatSegment& segment = format.segments[i];
+        if (segment.arg < 0)
+            out.append(format.fmt + segment.begin, segment.end - segment.begin);
+        else
+            args[segment.arg].append(out, args[segment.arg].value, segment.hex);
+    }
 }
 
+#endif
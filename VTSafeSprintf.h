@@ -22,12 +22,31 @@
  *    precision   ::=  integer
  *    type        ::=  "b" | "c" | "d" | "e" | "E" | "f" | "F" | "g" | "G" | "n" | "o" | "s" | "x" | "X" | "%"
  *
+ *  Only "x"/"X" (hexadecimal) affects the output so far.
+ *
+ *  Checking
+ *  --------
+ *    With C++20 string literal formats are parsed at compile time (see FormatString): malformed ones don't
+ *    compile and the call only converts the arguments. Other formats are parsed on every call and throw
+ *    std::runtime_error; their anchors without an argument are left in the output.
+ *
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 
+// format strings of literals are checked at compile time (C++20), see FormatString
+#if defined(__cpp_consteval) && !defined(_MSC_VER)
+    #define VT_HAS_CONSTEVAL_FORMAT
+    #define VT_FORMAT_CONSTEXPR constexpr
+#else
+    #define VT_FORMAT_CONSTEXPR
+#endif
+
 namespace VT
 {
     namespace d_
@@ -76,9 +95,8 @@ namespace VT
 
         typedef std::vector<Substring> Split;
 
+        // used by the binary log decoder, which keeps the split of every format
         Split split_format(const std::string& fmt);
-        void join(std::string& out, const Split& split);
-        bool has_index(const std::string& substr, int index);
         void modify_stream(std::ostringstream& oss, const std::string format);
 
         template <typename A>
@@ -92,81 +110,354 @@ namespace VT
             return Substring(SubstrText, oss.str());
         }
 
-        // No variadic templates in Visual Studio 2012
-#ifndef _MSC_VER
+        // argument conversion, only hex ("x" or "X" in the spec) changes the output
 
-        // base case for variadic template handling recursion
-        inline void safe_sprintf_worker(int /*index*/, Split& /*fmt*/) {}
+        template <typename T>
+        void append_value(std::string& out, const T& value, bool hex)
+        {
+            std::ostringstream oss;
+            if (hex)
+                oss << std::hex;
+            oss << value;
+            out.append(oss.str());
+        }
 
-        template <typename A, typename... Args>
-        void safe_sprintf_worker(int index, Split& fmt, A&& arg, Args&&... args)
+        void append_value(std::string& out, const std::string& value, bool hex);
+        void append_value(std::string& out, const char* value, bool hex);
+        void append_value(std::string& out, int value, bool hex);
+        void append_value(std::string& out, unsigned int value, bool hex);
+        void append_value(std::string& out, long value, bool hex);
+        void append_value(std::string& out, unsigned long value, bool hex);
+        void append_value(std::string& out, long long value, bool hex);
+        void append_value(std::string& out, unsigned long long value, bool hex);
+
+        // type-erased argument, so anchors find theirs by index
+        struct FormatArg
         {
-            for (Substring& substr : fmt)
-            {
-                if (substr.type == SubstrAnchor && has_index(substr.content, index))
-                    substr = format_argument(substr.content, std::forward<A>(arg));
-            }
-            safe_sprintf_worker(index + 1, fmt, std::forward<Args>(args)...);
+            const void* value;
+            void (*append)(std::string& out, const void* value, bool hex);
+        };
+
+        template <typename T>
+        void append_argument(std::string& out, const void* value, bool hex)
+        {
+            append_value(out, *static_cast<const T*>(value), hex);
         }
 
-#else  // limit to 3 arguments
+        template <typename T>
+        FormatArg make_format_arg(const T& value)
+        {
+            FormatArg arg = { &value, &append_argument<T> };
+            return arg;
+        }
 
-        template <typename A0>
-        void safe_sprintf_worker(int index, Split& fmt, A0&& arg0)
+        // single pass over the format, anchors with indexes out of [0, count) are kept as they are
+        void format_runtime(std::string& out, const char* fmt, size_t size, const FormatArg* args, size_t count);
+
+        /*
+         * Tokenizer shared by the runtime and the compile-time formatting: calls
+         * sink.text(begin, end) for literal text ("{{" is kept as is), sink.anchor(begin, end)
+         * for the content between the braces of an anchor and sink.error(message) when the
+         * closing brace is missing.
+         */
+        template <typename Sink>
+        VT_FORMAT_CONSTEXPR void parse_format(const char* fmt, size_t size, Sink& sink)
         {
-            for (Substring& substr : fmt)
+            size_t pos = 0;
+            while (pos < size)
             {
-                if (substr.type == SubstrAnchor && has_index(substr.content, index))
-                    substr = format_argument(substr.content, std::forward<A0>(arg0));
+                size_t start = pos;
+                while (start < size && fmt[start] != '{')
+                    ++start;
+
+                if (start == size)
+                {
+                    sink.text(pos, size);
+                    return;
+                }
+
+                if (start + 1 < size && fmt[start + 1] == '{')
+                {
+                    sink.text(pos, start + 2);
+                    pos = start + 2;
+                    continue;
+                }
+
+                if (start != pos)
+                    sink.text(pos, start);
+
+                // closing brace that isn't doubled
+                size_t end = start + 1;
+                for (;;)
+                {
+                    while (end < size && fmt[end] != '}')
+                        ++end;
+
+                    if (end == size)
+                    {
+                        sink.error("no closing curly brace");
+                        return;
+                    }
+
+                    if (end + 1 < size && fmt[end + 1] == '}')
+                    {
+                        end += 3;
+                        if (end > size)
+                            end = size;
+                        continue;
+                    }
+                    break;
+                }
+
+                sink.anchor(start + 1, end);
+                pos = end + 1;
             }
         }
 
-        template <typename A0, typename A1>
-        void safe_sprintf_worker(int index, Split& fmt, A0&& arg0, A1&& arg1)
+#ifdef VT_HAS_CONSTEVAL_FORMAT
+
+        // not constexpr, so calling it in a consteval context is a compile error naming [reason]
+        void invalid_format_string(const char* reason);
+
+        // [[fill]align][sign][#][0][width][,][.precision][type]
+        constexpr bool valid_format_spec(const char* spec, size_t size)
         {
-            for (Substring& substr : fmt)
+            auto is_align = [](char c) { return c == '<' || c == '>' || c == '=' || c == '^'; };
+            auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+            auto is_one_of = [](char c, const char* chars)
+            {
+                for (; *chars; ++chars)
+                {
+                    if (*chars == c)
+                        return true;
+                }
+                return false;
+            };
+
+            size_t i = 0;
+            if (size >= 2 && is_align(spec[1]))
+            {
+                if (spec[0] == '{' || spec[0] == '}')
+                    return false;
+                i = 2;
+            }
+            else if (size >= 1 && is_align(spec[0]))
+                i = 1;
+
+            if (i < size && is_one_of(spec[i], "+- "))
+                ++i;
+            if (i < size && spec[i] == '#')
+                ++i;
+            if (i < size && spec[i] == '0')
+                ++i;
+            while (i < size && is_digit(spec[i]))
+                ++i;
+            if (i < size && spec[i] == ',')
+                ++i;
+            if (i < size && spec[i] == '.')
             {
-                if (substr.type == SubstrAnchor && has_index(substr.content, index))
-                    substr = format_argument(substr.content, std::forward<A0>(arg0));
+                ++i;
+                if (i == size || !is_digit(spec[i]))
+                    return false;
+                while (i < size && is_digit(spec[i]))
+                    ++i;
             }
-            safe_sprintf_worker(index + 1, fmt, std::forward<A1>(arg1));
+            if (i < size && is_one_of(spec[i], "bcdeEfFgGnosxX%"))
+                ++i;
+
+            return i == size;
         }
 
-        template <typename A0, typename A1, typename A2>
-        void safe_sprintf_worker(int index, Split& fmt, A0&& arg0, A1&& arg1, A2&& arg2)
+        // piece of a checked format: literal text, or argument [arg] with the hex flag
+        struct FormatSegment
+        {
+            uint16_t begin;
+            uint16_t end;
+            int8_t arg;   // -1 for text
+            bool hex;
+        };
+
+        const size_t kMaxFormatSegments = 16;
+
+        struct CompiledFormat
+        {
+            const char* fmt;
+            size_t size;
+            FormatSegment segments[kMaxFormatSegments];
+            size_t count;       // 0 with longer formats, they are checked but parsed at runtime
+        };
+
+        void format_compiled(std::string& out, const CompiledFormat& format, const FormatArg* args);
+
+        struct FormatChecker
         {
-            for (Substring& substr : fmt)
+            constexpr void text(size_t begin, size_t end)
             {
-                if (substr.type == SubstrAnchor && has_index(substr.content, index))
-                    substr = format_argument(substr.content, std::forward<A0>(arg0));
+                add(begin, end, -1, false);
+            }
+
+            constexpr void anchor(size_t begin, size_t end)
+            {
+                size_t colon = begin;
+                while (colon < end && fmt[colon] != ':')
+                    ++colon;
+
+                if (colon == begin)
+                    invalid_format_string("no position marker provided");
+
+                size_t index = 0;
+                for (size_t i = begin; i < colon; ++i)
+                {
+                    if (fmt[i] < '0' || fmt[i] > '9')
+                        invalid_format_string("position marker is not a number");
+                    index = index * 10 + static_cast<size_t>(fmt[i] - '0');
+                    if (index >= arg_count)
+                        invalid_format_string("position marker exceeds the number of arguments");
+                }
+                if (index >= arg_count)
+                    invalid_format_string("position marker exceeds the number of arguments");
+
+                const size_t spec = (colon < end ? colon + 1 : end);
+                if (!valid_format_spec(fmt + spec, end - spec))
+                    invalid_format_string("malformed format specification");
+
+                bool hex = false;
+                for (size_t i = spec; i < end; ++i)
+                    hex = hex || fmt[i] == 'x' || fmt[i] == 'X';
+
+                add(begin, end, static_cast<int>(index), hex);
             }
-            safe_sprintf_worker(index + 1, fmt, std::forward<A1>(arg1), std::forward<A2>(arg2));
-        }
+
+            constexpr void error(const char* reason)
+            {
+                if (reason)
+                    invalid_format_string(reason);
+            }
+
+            constexpr void add(size_t begin, size_t end, int arg, bool hex)
+            {
+                if (overflow || end > 0xFFFF || arg > 127 || result.count == kMaxFormatSegments)
+                {
+                    overflow = true;
+                    return;
+                }
+                FormatSegment& segment = result.segments[result.count++];
+                segment.begin = static_cast<uint16_t>(begin);
+                segment.end = static_cast<uint16_t>(end);
+                segment.arg = static_cast<int8_t>(arg);
+                segment.hex = hex;
+            }
+
+            const char* fmt;
+            size_t arg_count;
+            CompiledFormat& result;
+            bool overflow;
+        };
 
 #endif
     }
 
+#ifdef VT_HAS_CONSTEVAL_FORMAT
+
+    /*
+     * Format string literal checked at compile time against the number of arguments
+     * (C++20): a missing closing brace, a position marker that isn't a number or has no
+     * argument and a spec not matching the mini-language are compile errors. It is
+     * created implicitly from string literals passed to safe_sprintf(); strings known
+     * only at runtime use the std::string overloads.
+     */
+    template <size_t ArgCount>
+    class FormatString
+    {
+    public:
+        template <size_t N>
+        consteval FormatString(const char (&fmt)[N])
+            : format_{ fmt, N - 1, {}, 0 }
+        {
+            d_::FormatChecker checker{ fmt, ArgCount, format_, false };
+            d_::parse_format(fmt, N - 1, checker);
+            if (checker.overflow)
+                format_.count = 0;
+        }
+
+        const d_::CompiledFormat& compiled() const { return format_; }
+
+    private:
+        d_::CompiledFormat format_;
+    };
+
+    namespace d_
+    {
+        // literals (const char arrays) go to the FormatString overloads
+        template <typename S>
+        struct IsRuntimeFormat
+        {
+            typedef typename std::remove_reference<S>::type Type;
+            static const bool value = std::is_convertible<S, std::string>::value &&
+                                      !(std::is_array<Type>::value &&
+                                        std::is_const<typename std::remove_extent<Type>::type>::value);
+        };
+
+        inline void format(std::string& out, const std::string& fmt, const FormatArg* args, size_t count)
+        {
+            format_runtime(out, fmt.data(), fmt.size(), args, count);
+        }
+    }
+
     /*
      * Appends string formatted according to [fmt] and specified arguments [args] to [out] string.
      */
-#ifndef _MSC_VER
+    template <typename... Args>
+    void safe_sprintf(std::string& out, FormatString<sizeof...(Args)> fmt, Args&&... args)
+    {
+        const d_::FormatArg list[sizeof...(Args) + 1] = { d_::make_format_arg(args)... };
+        d_::format_compiled(out, fmt.compiled(), list);
+    }
+
+    template <typename S, typename... Args>
+    typename std::enable_if<d_::IsRuntimeFormat<S>::value>::type
+    safe_sprintf(std::string& out, S&& fmt, Args&&... args)
+    {
+        const d_::FormatArg list[sizeof...(Args) + 1] = { d_::make_format_arg(args)... };
+        d_::format(out, fmt, list, sizeof...(Args));
+    }
+
+    // Version returning formatted string
+    template <typename... Args>
+    std::string safe_sprintf_ret(FormatString<sizeof...(Args)> fmt, Args&&... args)
+    {
+        std::string out;
+        safe_sprintf(out, fmt, std::forward<Args>(args)...);
+        return out;
+    }
+
+    template <typename S, typename... Args>
+    typename std::enable_if<d_::IsRuntimeFormat<S>::value, std::string>::type
+    safe_sprintf_ret(S&& fmt, Args&&... args)
+    {
+        std::string out;
+        safe_sprintf(out, std::forward<S>(fmt), std::forward<Args>(args)...);
+        return out;
+    }
+
+#elif !defined(_MSC_VER)
 
+    /*
+     * Appends string formatted according to [fmt] and specified arguments [args] to [out] string.
+     */
     template <typename... Args>
     void safe_sprintf(std::string& out, const std::string& fmt, Args&&... args)
     {
-        auto split = d_::split_format(fmt);
-        d_::safe_sprintf_worker(0, split, std::forward<Args>(args)...);
-        d_::join(out, split);
+        const d_::FormatArg list[sizeof...(Args) + 1] = { d_::make_format_arg(args)... };
+        d_::format_runtime(out, fmt.data(), fmt.size(), list, sizeof...(Args));
     }
 
     // Version returning formatted string
     template <typename... Args>
     std::string safe_sprintf_ret(const std::string& fmt, Args&&... args)
     {
-        auto split = d_::split_format(fmt);
-        d_::safe_sprintf_worker(0, split, std::forward<Args>(args)...);
         std::string out;
-        d_::join(out, split);
+        safe_sprintf(out, fmt, std::forward<Args>(args)...);
         return out;
     }
 
@@ -175,25 +466,22 @@ namespace VT
     template <typename A0>
     void safe_sprintf(std::string& out, const std::string& fmt, A0&& arg0)
     {
-        auto split = d_::split_format(fmt);
-        d_::safe_sprintf_worker(0, split, std::forward<A0>(arg0));
-        d_::join(out, split);
+        const d_::FormatArg list[] = { d_::make_format_arg(arg0) };
+        d_::format_runtime(out, fmt.data(), fmt.size(), list, 1);
     }
 
     template <typename A0, typename A1>
     void safe_sprintf(std::string& out, const std::string& fmt, A0&& arg0, A1&& arg1)
     {
-        auto split = d_::split_format(fmt);
-        d_::safe_sprintf_worker(0, split, std::forward<A0>(arg0), std::forward<A1>(arg1));
-        d_::join(out, split);
+        const d_::FormatArg list[] = { d_::make_format_arg(arg0), d_::make_format_arg(arg1) };
+        d_::format_runtime(out, fmt.data(), fmt.size(), list, 2);
     }
 
     template <typename A0, typename A1, typename A2>
     void safe_sprintf(std::string& out, const std::string& fmt, A0&& arg0, A1&& arg1, A2&& arg2)
     {
-        auto split = d_::split_format(fmt);
-        d_::safe_sprintf_worker(0, split, std::forward<A0>(arg0), std::forward<A1>(arg1), std::forward<A2>(arg2));
-        d_::join(out, split);
+        const d_::FormatArg list[] = { d_::make_format_arg(arg0), d_::make_format_arg(arg1), d_::make_format_arg(arg2) };
+        d_::format_runtime(out, fmt.data(), fmt.size(), list, 3);
     }
 
 #endif
@@ -0,0 +1,213 @@
+#include "VTTaskGraph.h"
+
+#include <stdexcept>
+#include <thread>
+
+
+struct VT::TaskGraph::NodeData
+{
+    NodeData(ThreadPool::Task&& task, const TaskOptions& options)
+        : task(std::move(task))
+        , options(options)
+        , dependencies(0)
+        , remaining(0)
+        , failed(false)
+    { }
+
+    ThreadPool::Task task;
+    TaskOptions options;
+    std::vector<Node> successors;
+    size_t dependencies;
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed;  // some dependency threw, task is skipped
+};
+
+
+VT::TaskGraph::TaskGraph(ThreadPool& pool)
+    : pool_(pool)
+    , pending_(0)
+    , notifying_(0)
+{
+}
+
+VT::TaskGraph::~TaskGraph()
+{
+    wait_no_throw();
+}
+
+VT::TaskGraph::Node VT::TaskGraph::add(ThreadPool::Task task, const TaskOptions& options)
+{
+    assert(pending_.load() == 0 && "Changing VT::TaskGraph while it runs");
+
+    nodes_.emplace_back(std::move(task), options);
+    return nodes_.size() - 1;
+}
+
+void VT::TaskGraph::precede(Node before, Node after)
+{
+    assert(pending_.load() == 0 && "Changing VT::TaskGraph while it runs");
+    assert(before < nodes_.size() && after < nodes_.size() && before != after);
+
+    nodes_[before].successors.push_back(after);
+    nodes_[after].dependencies++;
+}
+
+void VT::TaskGraph::run()
+{
+    assert(pending_.load() == 0 && "VT::TaskGraph is already running");
+
+    // Kahn's algorithm: every node must be reachable from the roots
+    std::vector<size_t> indegree(nodes_.size());
+    std::vector<Node> ready;
+    for (Node i = 0; i < nodes_.size(); ++i)
+    {
+        indegree[i] = nodes_[i].dependencies;
+        if (indegree[i] == 0)
+            ready.push_back(i);
+    }
+
+    const size_t roots = ready.size();
+    for (size_t i = 0; i < ready.size(); ++i)
+    {
+        for (Node next : nodes_[ready[i]].successors)
+        {
+            if (--indegree[next] == 0)
+                ready.push_back(next);
+        }
+    }
+
+    if (ready.size() != nodes_.size())
+        throw std::logic_error("VT::TaskGraph has a cycle");
+
+    for (NodeData& node : nodes_)
+    {
+        node.remaining.store(node.dependencies, std::memory_order_relaxed);
+        node.failed.store(false, std::memory_order_relaxed);
+    }
+    error_ = std::exception_ptr();
+    pending_.store(nodes_.size());
+
+    for (size_t i = 0; i < roots; ++i)
+        schedule(ready[i]);
+}
+
+void VT::TaskGraph::wait()
+{
+    wait_no_throw();
+
+    if (error_)
+    {
+        std::exception_ptr error = error_;
+        error_ = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+void VT::TaskGraph::schedule(Node node)
+{
+    // the pool must not drop it, cancelled tasks are skipped in execute()
+    // so that their dependants are released
+    TaskOptions options = nodes_[node].options;
+    options.cancel = nullptr;
+
+    try
+    {
+        pool_.post([this, node]{ execute(node); }, options);
+    }
+    catch (...)
+    {
+        // e.g. QueueFullError under QF_Reject: the node fails as if its task threw
+        set_error(std::current_exception());
+        finish(node, true);
+    }
+}
+
+void VT::TaskGraph::execute(Node node)
+{
+    NodeData& data = nodes_[node];
+    bool failed = data.failed.load(std::memory_order_relaxed) || data.options.cancel.is_cancelled();
+
+    if (!failed)
+    {
+        try
+        {
+            data.task();
+        }
+        catch (...)
+        {
+            failed = true;
+            set_error(std::current_exception());
+        }
+    }
+
+    finish(node, failed);
+}
+
+void VT::TaskGraph::finish(Node node, bool failed)
+{
+    // skipped dependants are finished here instead of being posted
+    std::vector<Node> skipped;
+
+    for (;;)
+    {
+        // release successors, the last finished dependency posts the task
+        for (Node next : nodes_[node].successors)
+        {
+            NodeData& succ = nodes_[next];
+            if (failed)
+                succ.failed.store(true, std::memory_order_relaxed);
+
+            if (succ.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                if (succ.failed.load(std::memory_order_relaxed))
+                    skipped.push_back(next);
+                else
+                    schedule(next);
+            }
+        }
+
+        done();  // the graph may be gone after this unless skipped nodes remain
+
+        if (skipped.empty())
+            break;
+
+        node = skipped.back();
+        skipped.pop_back();
+        failed = true;
+    }
+}
+
+void VT::TaskGraph::set_error(std::exception_ptr error)
+{
+    std::lock_guard<std::mutex> l(error_lock_);
+    if (!error_)
+        error_ = error;
+}
+
+void VT::TaskGraph::done()
+{
+    // a waiter may destroy the graph as soon as it sees pending_ == 0,
+    // wait_no_throw() also waits for notifying_ to drop before returning
+    notifying_.fetch_add(1);
+    if (pending_.fetch_sub(1) == 1)
+        finished_.notify_all();
+    notifying_.fetch_sub(1);
+}
+
+void VT::TaskGraph::wait_no_throw()
+{
+    while (pending_.load() != 0)
+    {
+        if (pool_.try_run_pending_task())
+            continue;
+
+        uint32_t key = finished_.prepare_wait();
+        if (pending_.load() == 0)
+            finished_.cancel_wait();
+        else
+            finished_.wait(key, 1);  // wake up now and then to help with newly queued work
+    }
+
+    while (notifying_.load() != 0)
+        std::this_thread::yield();
+}
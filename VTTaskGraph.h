@@ -0,0 +1,587 @@
+#pragma once
+
+#include "VTThreadPool.h"
+#include "VTUniqueFunction.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+
+/*
+ * Futures with continuations and task graphs on top of VT::ThreadPool.
+ *
+ *  * VT::spawn(pool, fn) runs fn on the pool and returns TaskFuture
+ *  * future.then(fn) posts fn to the pool right from the thread that completed
+ *    the antecedent, nobody blocks waiting for it; errors skip the continuation
+ *    and propagate to the resulting future
+ *  * when_all / when_any combine several futures
+ *  * TaskGraph runs a DAG of tasks, a task is posted by the worker that finished
+ *    its last dependency
+ *
+ * TaskFuture::get() and TaskGraph::wait() run queued pool work while they wait,
+ * so they don't deadlock when called from inside pool tasks.
+ */
+
+namespace VT
+{
+    template <typename T>
+    class TaskFuture;
+
+    namespace d_
+    {
+        class FutureStateBase
+        {
+        public:
+            typedef UniqueFunction<void()> Continuation;
+
+            FutureStateBase()
+                : ready_(false)
+                , drop_(DS_None)
+            { }
+
+            bool is_ready() const
+            {
+                return ready_.load(std::memory_order_acquire);
+            }
+
+            // waits while helping the pool (if given) to run queued tasks
+            void wait(ThreadPool* pool)
+            {
+                while (!is_ready())
+                {
+                    if (pool && pool->try_run_pending_task())
+                        continue;
+
+                    std::unique_lock<std::mutex> l(lock_);
+                    if (pool)
+                        cond_.wait_for(l, std::chrono::milliseconds(1), [this]{ return is_ready(); });
+                    else
+                        cond_.wait(l, [this]{ return is_ready(); });
+                }
+            }
+
+            // runs continuation right away if the state is already completed
+            void add_continuation(Continuation&& continuation)
+            {
+                {
+                    std::lock_guard<std::mutex> l(lock_);
+                    if (!is_ready())
+                    {
+                        continuations_.push_back(std::move(continuation));
+                        return;
+                    }
+                }
+                continuation();
+            }
+
+            void set_exception(std::exception_ptr error)
+            {
+                error_ = error;
+                complete();
+            }
+
+            std::exception_ptr error() const
+            {
+                assert(is_ready());
+                return error_;
+            }
+
+            // the task producing this state was destroyed without running
+            void break_promise()
+            {
+                int held = DS_Held;
+                if (!drop_.compare_exchange_strong(held, DS_Dropped))
+                    set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+
+            // while held, a dropped task leaves the state pending; release_drop() returns true
+            // if that happened and the caller has to complete the state itself
+            void hold_drop() { drop_.store(DS_Held); }
+            bool release_drop() { return drop_.exchange(DS_None) == DS_Dropped; }
+
+        protected:
+            void complete()
+            {
+                std::vector<Continuation> continuations;
+
+                {
+                    std::lock_guard<std::mutex> l(lock_);
+                    assert(!is_ready() && "Future state completed twice");
+                    ready_.store(true, std::memory_order_release);
+                    continuations.swap(continuations_);
+                }
+                cond_.notify_all();
+
+                for (auto& continuation : continuations)
+                    continuation();
+            }
+
+            void rethrow_if_failed() const
+            {
+                if (error_)
+                    std::rethrow_exception(error_);
+            }
+
+        private:
+            FutureStateBase(const FutureStateBase&);
+            FutureStateBase& operator=(const FutureStateBase&);
+
+            enum DropState { DS_None, DS_Held, DS_Dropped };
+
+            std::atomic<bool> ready_;
+            std::atomic<int> drop_;
+            std::exception_ptr error_;
+            std::mutex lock_;
+            std::condition_variable cond_;
+            std::vector<Continuation> continuations_;
+        };
+
+
+        template <typename T>
+        class FutureState : public FutureStateBase
+        {
+        public:
+            FutureState() : has_value_(false) { }
+
+            ~FutureState()
+            {
+                if (has_value_)
+                    reinterpret_cast<T*>(&storage_)->~T();
+            }
+
+            void set_value(T value)
+            {
+                new (&storage_) T(std::move(value));
+                has_value_ = true;
+                complete();
+            }
+
+            const T& value() const
+            {
+                rethrow_if_failed();
+                return *reinterpret_cast<const T*>(&storage_);
+            }
+
+            // used to pass value to continuations
+            const T& unchecked_value() const
+            {
+                return *reinterpret_cast<const T*>(&storage_);
+            }
+
+        private:
+            typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_;
+            bool has_value_;
+        };
+
+        template <>
+        class FutureState<void> : public FutureStateBase
+        {
+        public:
+            void set_value()
+            {
+                complete();
+            }
+
+            void value() const
+            {
+                rethrow_if_failed();
+            }
+        };
+
+
+        // invokes callable and stores its result or exception in out
+        template <typename R, typename C>
+        void fulfil(FutureState<R>& out, C& callable)
+        {
+            try
+            {
+                out.set_value(callable());
+            }
+            catch (...)
+            {
+                out.set_exception(std::current_exception());
+            }
+        }
+
+        template <typename C>
+        void fulfil(FutureState<void>& out, C& callable)
+        {
+            try
+            {
+                callable();
+                out.set_value();
+            }
+            catch (...)
+            {
+                out.set_exception(std::current_exception());
+            }
+        }
+
+
+        // continuation gets the value of the antecedent, or nothing for void
+        template <typename T, typename F>
+        struct ThenResult
+        {
+            typedef decltype(std::declval<F&>()(std::declval<const T&>())) type;
+
+            static type call(F& fn, const FutureState<T>& in) { return fn(in.unchecked_value()); }
+        };
+
+        template <typename F>
+        struct ThenResult<void, F>
+        {
+            typedef decltype(std::declval<F&>()()) type;
+
+            static type call(F& fn, const FutureState<void>&) { return fn(); }
+        };
+
+
+        // for tasks dropped by the pool without running (e.g. cancelled)
+        template <typename R>
+        void break_promise(std::shared_ptr<FutureState<R>>& out)
+        {
+            if (out)
+                out->break_promise();
+        }
+
+        template <typename R, typename F>
+        struct SpawnTask
+        {
+            SpawnTask(const std::shared_ptr<FutureState<R>>& out, F&& fn) : out(out), fn(std::move(fn)) { }
+            SpawnTask(SpawnTask&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+                : out(std::move(other.out)), fn(std::move(other.fn))
+            { }
+            ~SpawnTask() { break_promise(out); }
+
+            void operator()()
+            {
+                fulfil(*out, fn);
+                out.reset();
+            }
+
+            std::shared_ptr<FutureState<R>> out;
+            F fn;
+        };
+
+        template <typename T, typename R, typename F>
+        struct ThenTask
+        {
+            ThenTask(const std::shared_ptr<FutureState<T>>& in, const std::shared_ptr<FutureState<R>>& out, F&& fn)
+                : in(in), out(out), fn(std::move(fn))
+            { }
+
+            ThenTask(ThenTask&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+                : in(std::move(other.in)), out(std::move(other.out)), fn(std::move(other.fn))
+            { }
+
+            ~ThenTask() { break_promise(out); }
+
+            void operator()()
+            {
+                if (in->error())
+                {
+                    out->set_exception(in->error());
+                }
+                else
+                {
+                    Call call = { fn, *in };
+                    fulfil(*out, call);
+                }
+                out.reset();
+            }
+
+            struct Call
+            {
+                R operator()() { return ThenResult<T, F>::call(fn, in); }
+
+                F& fn;
+                const FutureState<T>& in;
+            };
+
+            std::shared_ptr<FutureState<T>> in;
+            std::shared_ptr<FutureState<R>> out;
+            F fn;
+        };
+
+        // posts the task to the pool, or runs it in place when there is no pool;
+        // if the pool rejects the task, [out] fails with the exception of post()
+        template <typename Task>
+        struct PostTo
+        {
+            PostTo(ThreadPool* pool, const TaskOptions& options, Task&& task, const std::shared_ptr<FutureStateBase>& out)
+                : pool(pool), options(options), task(std::move(task)), out(out)
+            { }
+
+            PostTo(PostTo&& other) noexcept(std::is_nothrow_move_constructible<Task>::value)
+                : pool(other.pool), options(std::move(other.options)), task(std::move(other.task)), out(std::move(other.out))
+            { }
+
+            void operator()()
+            {
+                if (!pool)
+                {
+                    task();
+                    return;
+                }
+
+                // the task is destroyed before post() throws, don't let it report broken_promise
+                std::exception_ptr error;
+                out->hold_drop();
+                try
+                {
+                    pool->post(ThreadPool::Task(std::move(task)), options);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                if (out->release_drop())
+                    out->set_exception(error ? error : std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+
+            ThreadPool* pool;
+            TaskOptions options;
+            Task task;
+            std::shared_ptr<FutureStateBase> out;
+        };
+    }
+
+
+    template <typename T>
+    class TaskFuture
+    {
+    public:
+        TaskFuture()
+            : pool_(nullptr)
+        { }
+
+        TaskFuture(ThreadPool* pool, const std::shared_ptr<d_::FutureState<T>>& state)
+            : pool_(pool)
+            , state_(state)
+        { }
+
+        bool valid() const { return state_ != nullptr; }
+        bool is_ready() const { return state_->is_ready(); }
+
+        void wait() const { state_->wait(pool_); }
+
+        // returns value or rethrows the exception of the task
+        decltype(std::declval<const d_::FutureState<T>&>().value()) get() const
+        {
+            wait();
+            return state_->value();
+        }
+
+        // fn(const T&) or fn() for void, posted to the pool when this future completes
+        template <typename F>
+        TaskFuture<typename d_::ThenResult<T, typename std::decay<F>::type>::type>
+        then(F&& fn, const TaskOptions& options = TaskOptions()) const
+        {
+            typedef typename std::decay<F>::type Fn;
+            typedef typename d_::ThenResult<T, Fn>::type R;
+            typedef d_::ThenTask<T, R, Fn> Then;
+
+            // ThreadPool::Task keeps only nothrow movable callables in place
+            static_assert(std::is_nothrow_move_constructible<d_::PostTo<Then>>::value ||
+                          !std::is_nothrow_move_constructible<Fn>::value, "ThenTask move must be noexcept");
+
+            std::shared_ptr<d_::FutureState<R>> out = std::make_shared<d_::FutureState<R>>();
+            state_->add_continuation(d_::PostTo<Then>(pool_, options, Then(state_, out, Fn(std::forward<F>(fn))), out));
+            return TaskFuture<R>(pool_, out);
+        }
+
+        // for combinators
+        const std::shared_ptr<d_::FutureState<T>>& state() const { return state_; }
+        ThreadPool* pool() const { return pool_; }
+
+    private:
+        ThreadPool* pool_;
+        std::shared_ptr<d_::FutureState<T>> state_;
+    };
+
+
+    template <typename F>
+    TaskFuture<decltype(std::declval<typename std::decay<F>::type&>()())>
+    spawn(ThreadPool& pool, F&& fn, const TaskOptions& options = TaskOptions())
+    {
+        typedef typename std::decay<F>::type Fn;
+        typedef decltype(std::declval<Fn&>()()) R;
+
+        // ThreadPool::Task keeps only nothrow movable callables in place
+        static_assert(std::is_nothrow_move_constructible<d_::SpawnTask<R, Fn>>::value ||
+                      !std::is_nothrow_move_constructible<Fn>::value, "SpawnTask move must be noexcept");
+
+        std::shared_ptr<d_::FutureState<R>> out = std::make_shared<d_::FutureState<R>>();
+        pool.post(ThreadPool::Task(d_::SpawnTask<R, Fn>(out, Fn(std::forward<F>(fn)))), options);
+        return TaskFuture<R>(&pool, out);
+    }
+
+
+    namespace d_
+    {
+        struct WhenAllState
+        {
+            explicit WhenAllState(size_t count)
+                : remaining(count)
+                , out(std::make_shared<FutureState<void>>())
+            { }
+
+            std::atomic<size_t> remaining;
+            std::mutex error_lock;
+            std::exception_ptr error;
+            std::shared_ptr<FutureState<void>> out;
+        };
+
+        template <typename T>
+        struct WhenAllNotify
+        {
+            void operator()()
+            {
+                if (std::exception_ptr e = in->error())
+                {
+                    std::lock_guard<std::mutex> l(all->error_lock);
+                    if (!all->error)
+                        all->error = e;
+                }
+
+                if (all->remaining.fetch_sub(1) == 1)
+                {
+                    if (all->error)
+                        all->out->set_exception(all->error);
+                    else
+                        all->out->set_value();
+                }
+            }
+
+            std::shared_ptr<WhenAllState> all;
+            std::shared_ptr<FutureState<T>> in;
+        };
+
+        struct WhenAnyState
+        {
+            WhenAnyState()
+                : fired(false)
+                , out(std::make_shared<FutureState<size_t>>())
+            { }
+
+            std::atomic<bool> fired;
+            std::shared_ptr<FutureState<size_t>> out;
+        };
+
+        struct WhenAnyNotify
+        {
+            void operator()()
+            {
+                if (!any->fired.exchange(true))
+                    any->out->set_value(index);
+            }
+
+            std::shared_ptr<WhenAnyState> any;
+            size_t index;
+        };
+    }
+
+
+    // completes when all futures complete, fails with the first error
+    template <typename T>
+    TaskFuture<void> when_all(const std::vector<TaskFuture<T>>& futures)
+    {
+        ThreadPool* pool = futures.empty() ? nullptr : futures.front().pool();
+        std::shared_ptr<d_::WhenAllState> all = std::make_shared<d_::WhenAllState>(futures.size());
+
+        if (futures.empty())
+            all->out->set_value();
+
+        for (const auto& future : futures)
+        {
+            d_::WhenAllNotify<T> notify = { all, future.state() };
+            future.state()->add_continuation(notify);
+        }
+
+        return TaskFuture<void>(pool, all->out);
+    }
+
+    // completes with index of the first completed future (successfully or not)
+    template <typename T>
+    TaskFuture<size_t> when_any(const std::vector<TaskFuture<T>>& futures)
+    {
+        assert(!futures.empty());
+
+        ThreadPool* pool = futures.empty() ? nullptr : futures.front().pool();
+        std::shared_ptr<d_::WhenAnyState> any = std::make_shared<d_::WhenAnyState>();
+
+        for (size_t i = 0; i < futures.size(); ++i)
+        {
+            d_::WhenAnyNotify notify = { any, i };
+            futures[i].state()->add_continuation(notify);
+        }
+
+        return TaskFuture<size_t>(pool, any->out);
+    }
+
+
+    /*
+     * Directed acyclic graph of tasks.
+     *
+     *   TaskGraph g(pool);
+     *   auto load = g.add(...);
+     *   auto parse = g.add(...);
+     *   g.precede(load, parse);
+     *   g.run();
+     *   g.wait();
+     *
+     * When a task throws, tasks depending on it (directly or not) are skipped and
+     * wait() rethrows the first exception. Tasks with a cancelled TaskOptions::cancel
+     * token are skipped the same way, without an error. Graph can be run again after wait().
+     */
+    class TaskGraph
+    {
+    public:
+        typedef size_t Node;
+
+        explicit TaskGraph(ThreadPool& pool);
+        ~TaskGraph();
+
+        Node add(ThreadPool::Task task, const TaskOptions& options = TaskOptions());
+
+        // [after] starts only when [before] finished
+        void precede(Node before, Node after);
+
+        // throws std::logic_error if the graph has a cycle
+        void run();
+
+        // helps the pool while waiting, rethrows first exception of graph's tasks
+        void wait();
+
+    private:
+        TaskGraph(const TaskGraph&);
+        TaskGraph& operator=(const TaskGraph&);
+
+        struct NodeData;
+
+        void schedule(Node node);
+        void execute(Node node);
+        void finish(Node node, bool failed);
+        void set_error(std::exception_ptr error);
+        void done();
+        void wait_no_throw();
+
+        ThreadPool& pool_;
+        std::deque<NodeData> nodes_;
+        std::atomic<size_t> pending_;
+        std::atomic<size_t> notifying_;  // done() calls still touching the graph
+        std::mutex error_lock_;
+        std::exception_ptr error_;
+        EventCount finished_;
+    };
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPU placement and naming of threads, used by VT::ThreadPool workers
+
+namespace VT
+{
+    // pins calling thread to the given CPUs, returns false if it failed
+    // (on Windows only CPUs of the first processor group, 0..63, can be used)
+    bool set_current_thread_affinity(const std::vector<int>& cpus);
+
+    // name shown in debuggers, perf and top; Linux keeps only the first 15 characters
+    void set_current_thread_name(const std::string& name);
+
+    // CPU the calling thread is running on right now, -1 if unknown
+    int current_cpu();
+
+    // CPUs of every NUMA node, a single node with all CPUs on non-NUMA systems
+    std::vector<std::vector<int>> numa_nodes();
+}
@@ -0,0 +1,108 @@
+#include "VTThreadAffinity.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+    // parses sysfs cpu lists like "0-3,8,10-11"
+    std::vector<int> parse_cpu_list(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::istringstream ss(list);
+        std::string range;
+
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty() || range[0] == '\n')
+                continue;
+
+            size_t dash = range.find('-');
+            int first = std::atoi(range.c_str());
+            int last = (dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1));
+
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+
+        return cpus;
+    }
+}
+
+
+bool VT::set_current_thread_affinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+
+    if (CPU_COUNT(&set) == 0)
+        return false;
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+void VT::set_current_thread_name(const std::string& name)
+{
+    // kernel limit is 16 bytes including terminating zero
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+}
+
+
+int VT::current_cpu()
+{
+    return sched_getcpu();
+}
+
+
+std::vector<std::vector<int>> VT::numa_nodes()
+{
+    std::vector<std::pair<int, std::vector<int>>> found;
+
+    if (DIR* dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != std::string::npos)
+                continue;
+
+            std::ifstream in("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(in, list);
+
+            std::vector<int> cpus = parse_cpu_list(list);
+            if (!cpus.empty())  // memory-only nodes have no CPUs
+                found.push_back(std::make_pair(std::atoi(name.c_str() + 4), cpus));
+        }
+        closedir(dir);
+    }
+
+    std::sort(found.begin(), found.end());
+
+    std::vector<std::vector<int>> nodes;
+    for (auto& node : found)
+        nodes.push_back(std::move(node.second));
+
+    if (nodes.empty())
+    {
+        nodes.resize(1);
+        unsigned count = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned cpu = 0; cpu < count; ++cpu)
+            nodes[0].push_back(static_cast<int>(cpu));
+    }
+
+    return nodes;
+}
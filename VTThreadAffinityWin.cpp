@@ -0,0 +1,83 @@
+#include "VTThreadAffinity.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+
+#include <windows.h>
+#include <thread>
+#include <algorithm>
+
+
+bool VT::set_current_thread_affinity(const std::vector<int>& cpus)
+{
+    DWORD_PTR mask = 0;
+
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8))
+            mask |= DWORD_PTR(1) << cpu;
+    }
+
+    if (mask == 0)
+        return false;
+
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+
+void VT::set_current_thread_name(const std::string& name)
+{
+    // SetThreadDescription exists since Windows 10 1607, look it up at run time
+    typedef HRESULT (WINAPI *SetThreadDescriptionFn)(HANDLE, PCWSTR);
+
+    static SetThreadDescriptionFn set_description = reinterpret_cast<SetThreadDescriptionFn>(
+        GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+
+    if (!set_description)
+        return;
+
+    std::wstring wname(name.begin(), name.end());
+    set_description(GetCurrentThread(), wname.c_str());
+}
+
+
+int VT::current_cpu()
+{
+    return static_cast<int>(GetCurrentProcessorNumber());
+}
+
+
+std::vector<std::vector<int>> VT::numa_nodes()
+{
+    std::vector<std::vector<int>> nodes;
+
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (ULONG node = 0; node <= highest; ++node)
+        {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask) || mask == 0)
+                continue;
+
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < 64; ++cpu)
+            {
+                if (mask & (ULONGLONG(1) << cpu))
+                    cpus.push_back(cpu);
+            }
+            nodes.push_back(cpus);
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.resize(1);
+        unsigned count = (std::max)(std::thread::hardware_concurrency(), 1u);
+        for (unsigned cpu = 0; cpu < count; ++cpu)
+            nodes[0].push_back(static_cast<int>(cpu));
+    }
+
+    return nodes;
+}
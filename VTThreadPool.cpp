@@ -1,14 +1,21 @@
 #include "VTThreadPool.h"
 
+#include "VTThreadAffinity.h"
 #include "VTTimer.h"
 #include "VTUtil.h"
+#include "VTWorkStealingDeque.h"
 
 #include <algorithm>
 #include <thread>
 #include <memory>
+#include <string>
 #include <vector>
+#include <deque>
 #include <mutex>
 #include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
 
 #include <assert.h>
 
@@ -22,66 +29,605 @@ namespace VT
 {
     namespace d_
     {
+#ifdef VT_THREAD_POOL_STATS
+
+        typedef std::chrono::steady_clock stats_clock;
+
+        inline uint64_t to_ns(stats_clock::duration d)
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        }
+
+        struct EnqueueStamp
+        {
+            EnqueueStamp() : time(stats_clock::now()) { }
+
+            stats_clock::time_point time;
+        };
+
+        // written by its worker (and by outsiders for the shared slot), read by snapshots
+        struct WorkerStats
+        {
+            WorkerStats() : tasks(0), steals(0), busy_ns(0) { }
+
+            std::atomic<uint64_t> tasks;
+            std::atomic<uint64_t> steals;
+            std::atomic<uint64_t> busy_ns;
+            Histogram queue_wait_ns;
+            Histogram run_time_ns;
+        };
+
+        class PoolStats
+        {
+        public:
+            PoolStats()
+                : cancelled_(0)
+                , rejected_(0)
+                , caller_runs_(0)
+                , started_(0)
+                , retired_(0)
+            { }
+
+            // slot of the worker with given index, stays valid while the pool lives
+            WorkerStats* worker(size_t index)
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                while (workers_.size() <= index)
+                    workers_.emplace_back();
+                return &workers_[index];
+            }
+
+            WorkerStats* outside() { return &outside_; }
+
+            template <typename Work>
+            void execute(WorkerStats* slot, Work& work)
+            {
+                const stats_clock::time_point start = stats_clock::now();
+                const uint64_t waited = to_ns(start - work.enqueued.time);
+
+                if (!work.execute())
+                {
+                    cancelled_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+
+                const uint64_t ran = to_ns(stats_clock::now() - start);
+                slot->tasks.fetch_add(1, std::memory_order_relaxed);
+                slot->busy_ns.fetch_add(ran, std::memory_order_relaxed);
+                slot->queue_wait_ns.record(waited);
+                slot->run_time_ns.record(ran);
+            }
+
+            void stolen(WorkerStats* slot) { slot->steals.fetch_add(1, std::memory_order_relaxed); }
+            void cancelled(size_t count) { cancelled_.fetch_add(count, std::memory_order_relaxed); }
+            void rejected() { rejected_.fetch_add(1, std::memory_order_relaxed); }
+            void caller_runs() { caller_runs_.fetch_add(1, std::memory_order_relaxed); }
+            void thread_started() { started_.fetch_add(1, std::memory_order_relaxed); }
+            void thread_retired() { retired_.fetch_add(1, std::memory_order_relaxed); }
+
+            void fill(ThreadPoolStats& out) const
+            {
+                std::lock_guard<std::mutex> l(lock_);
+
+                out.enabled = true;
+                out.cancelled = cancelled_.load(std::memory_order_relaxed);
+                out.rejected = rejected_.load(std::memory_order_relaxed);
+                out.caller_runs = caller_runs_.load(std::memory_order_relaxed);
+                out.threads_started = started_.load(std::memory_order_relaxed);
+                out.threads_retired = retired_.load(std::memory_order_relaxed);
+
+                for (const WorkerStats& worker : workers_)
+                    add(out, worker);
+                add(out, outside_);
+            }
+
+        private:
+            PoolStats(const PoolStats&);
+            PoolStats& operator=(const PoolStats&);
+
+            static void add(ThreadPoolStats& out, const WorkerStats& worker)
+            {
+                ThreadPoolStats::Worker w;
+                w.tasks = worker.tasks.load(std::memory_order_relaxed);
+                w.steals = worker.steals.load(std::memory_order_relaxed);
+                w.busy_ns = worker.busy_ns.load(std::memory_order_relaxed);
+                out.workers.push_back(w);
+
+                out.completed += w.tasks;
+                out.queue_wait_ns.merge(worker.queue_wait_ns.snapshot());
+                out.run_time_ns.merge(worker.run_time_ns.snapshot());
+            }
+
+            mutable std::mutex lock_;
+            std::deque<WorkerStats> workers_;  // deque keeps slots in place while growing
+            WorkerStats outside_;
+            std::atomic<uint64_t> cancelled_;
+            std::atomic<uint64_t> rejected_;
+            std::atomic<uint64_t> caller_runs_;
+            std::atomic<uint64_t> started_;
+            std::atomic<uint64_t> retired_;
+        };
+
+#else
+
+        // stats compiled out: nothing is stored or timed
+
+        struct EnqueueStamp { };
+        struct WorkerStats { };
+
+        class PoolStats
+        {
+        public:
+            WorkerStats* worker(size_t) { return nullptr; }
+            WorkerStats* outside() { return nullptr; }
+
+            template <typename Work>
+            void execute(WorkerStats*, Work& work) { work.execute(); }
+
+            void stolen(WorkerStats*) { }
+            void cancelled(size_t) { }
+            void rejected() { }
+            void caller_runs() { }
+            void thread_started() { }
+            void thread_retired() { }
+            void fill(ThreadPoolStats&) const { }
+        };
+
+#endif
+
+
         struct WorkData
         {
-            WorkData(const std::function<void()> work,
-                     std::promise<void>&& result)
-               : work(work)
-               , result(std::move(result))
+            WorkData()
+                : next(nullptr)
+            { }
+
+            WorkData(ThreadPool::Task&& work, const CancellationToken& cancel)
+                : work(std::move(work))
+                , cancel(cancel)
+                , next(nullptr)
             { }
 
             WorkData(WorkData&& other)
-                : work(other.work)
-                , result(std::move(other.result))
+                : work(std::move(other.work))
+                , cancel(std::move(other.cancel))
+                , enqueued(other.enqueued)
+                , next(nullptr)
             { }
 
             WorkData& operator=(WorkData&& rhs)
             {
-                work = rhs.work;
-                result = std::move(rhs.result);
+                work = std::move(rhs.work);
+                cancel = std::move(rhs.cancel);
+                enqueued = rhs.enqueued;
                 return *this;
             }
 
-            std::function<void()> work;
-            std::promise<void> result;
+            bool is_cancelled() const { return cancel.is_cancelled(); }
+
+            // returns false if the task was skipped because of cancellation
+            bool execute()
+            {
+                assert(work);
+
+                if (cancel.is_cancelled())  // cancelled after it left the queue
+                {
+                    work = nullptr;
+                    return false;
+                }
+
+                // tasks from submit() handle their exceptions themselves, only post() tasks get here
+                try
+                {
+                    work();
+                }
+                catch (const std::exception& ex)
+                {
+                    std::cerr << "Exception in VT::ThreadPool task: " << ex.what() << std::endl;
+                }
+                catch (...)
+                {
+                    std::cerr << "Uknown error in VT::ThreadPool task." << std::endl;
+                }
+
+                work = nullptr;
+                cancel = nullptr;
+                return true;
+            }
+
+            ThreadPool::Task work;
+            CancellationToken cancel;
+            EnqueueStamp enqueued;
+            WorkData* next;  // free list link in work stealing mode
+        };
+
+
+        // Queue of pending tasks ordered by priority class, then by deadline (EDF),
+        // then by submission order. Not thread safe, owner locks it.
+        template <typename T>
+        class TaskQueue
+        {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            TaskQueue()
+                : size_(0)
+                , seq_(0)
+            { }
+
+            void push(T&& item, const TaskOptions& options)
+            {
+                assert(options.priority < TP_Count);
+
+                Entry entry;
+                entry.item = std::move(item);
+                entry.enqueued = clock::now();
+                entry.deadline = options.deadline;
+                entry.seq = seq_++;
+
+                Class& cls = classes_[options.priority];
+                if (options.has_deadline())
+                {
+                    cls.by_deadline.push_back(std::move(entry));
+                    std::push_heap(cls.by_deadline.begin(), cls.by_deadline.end(), LaterDeadline());
+                }
+                else
+                {
+                    cls.fifo.push_back(std::move(entry));
+                }
+
+                ++size_;
+            }
+
+            // returns false when empty
+            bool pop(T& item)
+            {
+                for (size_t p = 0; p < TP_Count; ++p)
+                {
+                    Class& cls = classes_[p];
+                    Entry entry;
+
+                    if (!cls.by_deadline.empty())
+                    {
+                        std::pop_heap(cls.by_deadline.begin(), cls.by_deadline.end(), LaterDeadline());
+                        entry = std::move(cls.by_deadline.back());
+                        cls.by_deadline.pop_back();
+                    }
+                    else if (!cls.fifo.empty())
+                    {
+                        entry = std::move(cls.fifo.front());
+                        cls.fifo.pop_front();
+                    }
+                    else
+                    {
+                        continue;
+                    }
+
+                    record_wait(static_cast<TaskPriority>(p), clock::now() - entry.enqueued);
+                    item = std::move(entry.item);
+                    --size_;
+                    return true;
+                }
+
+                return false;
+            }
+
+            // for tasks that skipped the queue
+            void record_direct(TaskPriority priority)
+            {
+                record_wait(priority, clock::duration::zero());
+            }
+
+            bool empty() const { return size_ == 0; }
+            size_t size() const { return size_; }
+
+            // true if there are queued tasks with priority higher than normal
+            bool has_urgent() const
+            {
+                return !classes_[TP_High].fifo.empty() || !classes_[TP_High].by_deadline.empty();
+            }
+
+            // enqueue time of the oldest task, approximate for tasks with deadlines
+            // (only the earliest deadline of each class is looked at)
+            clock::time_point oldest_enqueued() const
+            {
+                clock::time_point oldest = clock::time_point::max();
+                for (size_t p = 0; p < TP_Count; ++p)
+                {
+                    if (!classes_[p].fifo.empty())
+                        oldest = std::min(oldest, classes_[p].fifo.front().enqueued);
+                    if (!classes_[p].by_deadline.empty())
+                        oldest = std::min(oldest, classes_[p].by_deadline.front().enqueued);
+                }
+                return oldest;
+            }
+
+            PriorityStats stats(TaskPriority priority) const
+            {
+                assert(priority < TP_Count);
+                return stats_[priority];
+            }
+
+            // moves items matching pred to [removed], keeping order of the rest
+            template <typename Pred>
+            void remove_if(Pred pred, std::vector<T>& removed)
+            {
+                const size_t before = removed.size();
+
+                for (size_t p = 0; p < TP_Count; ++p)
+                {
+                    Class& cls = classes_[p];
+
+                    std::deque<Entry> fifo;
+                    for (auto& entry : cls.fifo)
+                    {
+                        if (pred(entry.item))
+                            removed.push_back(std::move(entry.item));
+                        else
+                            fifo.push_back(std::move(entry));
+                    }
+                    cls.fifo.swap(fifo);
+
+                    std::vector<Entry> by_deadline;
+                    for (auto& entry : cls.by_deadline)
+                    {
+                        if (pred(entry.item))
+                            removed.push_back(std::move(entry.item));
+                        else
+                            by_deadline.push_back(std::move(entry));
+                    }
+                    std::make_heap(by_deadline.begin(), by_deadline.end(), LaterDeadline());
+                    cls.by_deadline.swap(by_deadline);
+                }
+
+                size_ -= removed.size() - before;
+            }
+
+            // moves all items out, used on shutdown
+            template <typename F>
+            void drain(F f)
+            {
+                T item;
+                while (pop(item))
+                    f(item);
+            }
+
+        private:
+            struct Entry
+            {
+                T item;
+                clock::time_point enqueued;
+                clock::time_point deadline;
+                uint64_t seq;
+            };
+
+            struct LaterDeadline
+            {
+                bool operator()(const Entry& lhs, const Entry& rhs) const
+                {
+                    if (lhs.deadline != rhs.deadline)
+                        return lhs.deadline > rhs.deadline;
+                    return lhs.seq > rhs.seq;
+                }
+            };
+
+            struct Class
+            {
+                std::deque<Entry> fifo;
+                std::vector<Entry> by_deadline;  // heap
+            };
+
+            void record_wait(TaskPriority priority, clock::duration waited)
+            {
+                uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+                PriorityStats& st = stats_[priority];
+                ++st.tasks;
+                st.total_wait_us += us;
+                st.max_wait_us = std::max(st.max_wait_us, us);
+            }
+
+            Class classes_[TP_Count];
+            PriorityStats stats_[TP_Count];
+            size_t size_;
+            uint64_t seq_;
+        };
+
+        // applied by every pool thread when it starts
+        struct ThreadSetup
+        {
+            ThreadSetup(const ThreadPool::Options& options, const void* owner)
+                : name(options.name)
+                , cpus(options.cpus)
+                , owner(owner)
+            { }
+
+            void apply(size_t index) const
+            {
+                current_owner = owner;
+
+                if (!name.empty())
+                    set_current_thread_name(name + "-" + std::to_string(index));
+
+                if (!cpus.empty())
+                    set_current_thread_affinity(std::vector<int>(1, cpus[index % cpus.size()]));
+            }
+
+            std::string name;
+            std::vector<int> cpus;
+            const void* owner;
+
+            static THREAD_LOCAL const void* current_owner;  // pool the calling thread belongs to
         };
 
+
+        // shared by workers of the classic pool to decide whether an idle one may retire
+        struct Elastic
+        {
+            Elastic(size_t min_threads, int idle_timeout_ms)
+                : live(0)
+                , min_threads(min_threads)
+                , idle_timeout_ms(idle_timeout_ms)
+            { }
+
+            std::atomic<size_t> live;         // started, not trimmed and not retired
+            std::atomic<size_t> min_threads;  // idle threads don't retire below this
+            const int idle_timeout_ms;        // -1: never retire
+        };
+
+
         class WorkerThread
         {
         public:
-            WorkerThread(VT::Event& free_notify);
+            WorkerThread(VT::EventCount& free_notify, Elastic& elastic, PoolStats& stats, const ThreadSetup& setup, size_t index);
             WorkerThread();  // no definition, used to prevent error in MSVC with make_shared
             ~WorkerThread();
 
+            // reserves a free thread for do_work(), fails if it is busy or retired
+            bool try_claim();
             void do_work(WorkData&& work_data);
-            void terminate();
+
+            // asks thread to exit after its current task, returns false if it has already retired
+            bool terminate();
 
             bool wait(int timeout_ms = -1);
 
             bool is_free();
+            bool is_retired() const { return state_.load() == Retired; }
+            bool has_exited() const { return exited_.load(); }
+            size_t index() const { return index_; }
 
         private:
+            enum State { Idle, Busy, Retired };
+
             void worker();
+            bool try_retire();
 
             WorkData work_data_;
-            bool terminated_;
+            std::atomic<bool> terminated_;
+            std::atomic<bool> exited_;
+            std::atomic<int> state_;
+            std::atomic<bool> counted_;  // still counted in Elastic::live
             VT::Event working_;
             VT::Event free_;
-            VT::Event& free_notify_;
+            VT::EventCount& free_notify_;
+            Elastic& elastic_;
+            PoolStats& stats_;
+            WorkerStats* slot_;
+            size_t index_;
             std::thread thread_;
         };
+
+
+        class StealingScheduler
+        {
+        public:
+            StealingScheduler(const ThreadPool::Options& options, const ThreadSetup& setup, PoolStats& stats);
+            ~StealingScheduler();
+
+            void submit(ThreadPool::Task&& task, const TaskOptions& options);
+
+            // removes queued tasks with cancelled tokens from the shared queue,
+            // those already in worker deques are skipped when they come up
+            void purge_cancelled();
+
+            size_t thread_count() const;
+            size_t max_thread_count() const;
+            void set_thread_count(size_t count);
+            void set_max_thread_count(size_t count);
+
+            bool wait_for_all(int timeout_ms);
+            bool wait_for_all(const CancellationToken& cancel, int timeout_ms);
+            void wake_waiters();  // lets wait_for_all() see a cancellation
+            bool try_run_pending_task();
+            PriorityStats priority_stats(TaskPriority priority) const;
+            size_t queue_depth() const { return pending_.load(); }
+
+        private:
+            struct Worker
+            {
+                Worker()
+                    : owner(nullptr)
+                    , index(0)
+                    , stats(nullptr)
+                    , retire(false)
+                    , rand_state(0)
+                { }
+
+                StealingScheduler* owner;
+                size_t index;
+                WorkerStats* stats;
+                WorkStealingDeque<WorkData*> deque;
+                std::atomic<bool> retire;
+                uint32_t rand_state;
+                std::thread thread;
+            };
+
+            void worker_loop(Worker* self);
+            WorkData* find_work(Worker* self);
+            WorkData* take_injected();
+            void execute(WorkData* work);
+            void wake_one();
+            void resize(size_t count);
+
+            // WorkData nodes are recycled through a per-thread free list on pool threads,
+            // so tasks submitted from workers don't touch the heap
+            static WorkData* alloc_node(ThreadPool::Task&& task, const CancellationToken& cancel);
+            static void free_node(WorkData* node);
+            static void drain_free_nodes();
+            static const size_t kMaxFreeNodes = 1024;
+
+            static THREAD_LOCAL Worker* current_;
+            static THREAD_LOCAL WorkData* free_nodes_;
+            static THREAD_LOCAL size_t free_count_;
+
+            std::vector<std::unique_ptr<Worker>> workers_;
+            ThreadSetup setup_;
+            PoolStats& stats_;
+            const size_t capacity_;
+            const QueueFullPolicy full_policy_;
+            VT::EventCount not_full_;
+            size_t running_;
+            size_t max_running_;
+            mutable std::mutex control_lock_;   // thread count changes
+
+            // work submitted from outside of the pool or with non-default priority/deadline
+            TaskQueue<WorkData*> injected_;
+            mutable std::mutex inject_lock_;
+            std::atomic<size_t> injected_size_; // to skip the lock when empty
+            std::atomic<bool> injected_urgent_; // high priority work waits in injected_
+
+            std::atomic<size_t> pending_;       // queued, not yet started
+            std::atomic<size_t> outstanding_;   // queued or running
+            std::atomic<size_t> sleepers_;
+            std::atomic<bool> stopping_;
+
+            std::mutex sleep_lock_;
+            std::condition_variable sleep_cond_;
+            std::mutex done_lock_;
+            std::condition_variable done_cond_;
+        };
     }
 }
 
 
-VT::d_::WorkerThread::WorkerThread(VT::Event& free_notify)
-    : work_data_(nullptr, std::promise<void>())
+VT::d_::WorkerThread::WorkerThread(VT::EventCount& free_notify, Elastic& elastic, PoolStats& stats, const ThreadSetup& setup, size_t index)
+    : work_data_()
     , terminated_(false)
+    , exited_(false)
+    , state_(Idle)
+    , counted_(true)
     , free_notify_(free_notify)
-    , thread_(std::bind(std::mem_fn(&WorkerThread::worker), this))
+    , elastic_(elastic)
+    , stats_(stats)
+    , slot_(stats.worker(index))
+    , index_(index)
+    , thread_()
 {
+    elastic_.live.fetch_add(1);
+    stats_.thread_started();
     free_.signal();
-    free_notify_.signal();
+    thread_ = std::thread([this, setup, index]{ setup.apply(index); worker(); });
+    free_notify_.notify_all();
 }
 
 
@@ -96,172 +642,881 @@ void VT::d_::WorkerThread::worker()
 {
     for (;;)
     {
-        working_.wait();
+        if (!working_.wait(elastic_.idle_timeout_ms))
+        {
+            if (try_retire())
+                break;
+            continue;  // work was handed to us meanwhile
+        }
 
         if (terminated_)
+            break;
+
+        stats_.execute(slot_, work_data_);
+
+        working_.reset();
+        state_.store(Idle);
+        free_.signal();
+        free_notify_.notify_all();
+
+        if (terminated_)  // terminate() signal could be lost by reset() above
+            break;
+    }
+
+    exited_ = true;
+    free_notify_.notify_all();  // lets the scheduler join us
+}
+
+
+bool VT::d_::WorkerThread::try_retire()
+{
+    size_t live = elastic_.live.load();
+    for (;;)
+    {
+        if (live <= elastic_.min_threads.load())
+            return false;
+        if (elastic_.live.compare_exchange_weak(live, live - 1))
+            break;
+    }
+
+    int idle = Idle;
+    if (!state_.compare_exchange_strong(idle, Retired))
+    {
+        elastic_.live.fetch_add(1);  // claimed meanwhile, work is on its way
+        return false;
+    }
+
+    if (!counted_.exchange(false))
+        elastic_.live.fetch_add(1);  // trimmed meanwhile, terminate() already took us off the count
+    else
+        stats_.thread_retired();
+
+    return true;
+}
+
+
+bool VT::d_::WorkerThread::try_claim()
+{
+    int idle = Idle;
+    return state_.compare_exchange_strong(idle, Busy);
+}
+
+
+void VT::d_::WorkerThread::do_work(WorkData&& work_data)
+{
+    assert(state_.load() == Busy && "WorkerThread::try_claim() must succeed before do_work()");
+
+    work_data_ = std::move(work_data);
+    free_.reset();
+    working_.signal();
+}
+
+
+bool VT::d_::WorkerThread::terminate()
+{
+    terminated_ = true;
+    working_.signal();
+
+    if (!counted_.exchange(false))
+        return false;
+
+    elastic_.live.fetch_sub(1);
+    stats_.thread_retired();
+    return true;
+}
+
+
+bool VT::d_::WorkerThread::wait(int timeout_ms)
+{
+    return free_.wait(timeout_ms);
+}
+
+
+bool VT::d_::WorkerThread::is_free()
+{
+    return state_.load() != Busy && free_.is_signaled();
+}
+
+
+THREAD_LOCAL const void* VT::d_::ThreadSetup::current_owner = nullptr;
+THREAD_LOCAL VT::d_::StealingScheduler::Worker* VT::d_::StealingScheduler::current_ = nullptr;
+THREAD_LOCAL VT::d_::WorkData* VT::d_::StealingScheduler::free_nodes_ = nullptr;
+THREAD_LOCAL size_t VT::d_::StealingScheduler::free_count_ = 0;
+
+
+VT::d_::StealingScheduler::StealingScheduler(const ThreadPool::Options& options, const ThreadSetup& setup, PoolStats& stats)
+    : setup_(setup)
+    , stats_(stats)
+    , capacity_(options.queue_capacity)
+    , full_policy_(options.queue_full_policy)
+    , running_(0)
+    , max_running_(options.max_thread_count)
+    , injected_size_(0)
+    , injected_urgent_(false)
+    , pending_(0)
+    , outstanding_(0)
+    , sleepers_(0)
+    , stopping_(false)
+{
+    const size_t thread_count = options.thread_count;
+    const size_t max_thread_count = options.max_thread_count;
+    assert(max_thread_count >= 1);
+
+    for (size_t i = 0; i < max_thread_count; ++i)
+    {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+        workers_.back()->owner = this;
+        workers_.back()->index = i;
+        workers_.back()->stats = stats_.worker(i);
+        workers_.back()->rand_state = static_cast<uint32_t>(i * 2654435761u + 1);
+    }
+
+    set_thread_count(std::max<size_t>(thread_count, 1));
+}
+
+
+VT::d_::StealingScheduler::~StealingScheduler()
+{
+    {
+        std::lock_guard<std::mutex> l(sleep_lock_);
+        stopping_ = true;
+    }
+    sleep_cond_.notify_all();
+    not_full_.notify_all();
+
+    for (auto& worker : workers_)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+
+    // work that was never started, its futures will report broken promise
+    for (auto& worker : workers_)
+    {
+        while (WorkData* work = worker->deque.pop())
+            delete work;
+    }
+    injected_.drain([](WorkData* work) { delete work; });
+}
+
+
+VT::d_::WorkData* VT::d_::StealingScheduler::alloc_node(ThreadPool::Task&& task, const CancellationToken& cancel)
+{
+    WorkData* node = free_nodes_;
+    if (!node)
+        return new WorkData(std::move(task), cancel);
+
+    free_nodes_ = node->next;
+    --free_count_;
+    node->next = nullptr;
+    node->work = std::move(task);
+    node->cancel = cancel;
+    node->enqueued = EnqueueStamp();
+    return node;
+}
+
+
+void VT::d_::StealingScheduler::free_node(WorkData* node)
+{
+    // only pool threads keep a cache, they drain it on exit
+    if (!current_ || free_count_ >= kMaxFreeNodes)
+    {
+        delete node;
+        return;
+    }
+
+    node->next = free_nodes_;
+    free_nodes_ = node;
+    ++free_count_;
+}
+
+
+void VT::d_::StealingScheduler::drain_free_nodes()
+{
+    while (free_nodes_)
+    {
+        WorkData* node = free_nodes_;
+        free_nodes_ = node->next;
+        delete node;
+    }
+    free_count_ = 0;
+}
+
+
+void VT::d_::StealingScheduler::submit(ThreadPool::Task&& task, const TaskOptions& options)
+{
+    Worker* self = current_;
+
+    if (capacity_ && pending_.load() >= capacity_)
+    {
+        if (full_policy_ == QF_Reject)
+        {
+            stats_.rejected();
+            throw QueueFullError();
+        }
+
+        // blocking a worker could leave nobody to make room
+        if (full_policy_ == QF_CallerRuns || (self && self->owner == this))
+        {
+            WorkData work(std::move(task), options.cancel);
+            stats_.caller_runs();
+            stats_.execute(self && self->owner == this ? self->stats : stats_.outside(), work);
             return;
+        }
+
+        for (;;)
+        {
+            uint32_t key = not_full_.prepare_wait();
+            if (pending_.load() < capacity_ || stopping_)
+            {
+                not_full_.cancel_wait();
+                break;
+            }
+            not_full_.wait(key);
+        }
+    }
+
+    // counted before it is published: a thief may run it and decrement right away
+    WorkData* work = alloc_node(std::move(task), options.cancel);
+    outstanding_.fetch_add(1);
+    pending_.fetch_add(1);
+
+    // local deques are plain LIFO, so only default priority work goes there
+    if (self && self->owner == this && options.priority == TP_Normal && !options.has_deadline())
+    {
+        self->deque.push(work);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> l(inject_lock_);
+        injected_.push(std::move(work), options);
+        injected_size_.store(injected_.size());
+        injected_urgent_.store(injected_.has_urgent());
+    }
+
+    wake_one();
+}
+
+
+void VT::d_::StealingScheduler::wake_one()
+{
+    // pairs with sleepers_ increment in worker_loop: either we see the sleeper
+    // or the sleeper sees our pending_ increment before it parks
+    if (sleepers_.load() > 0)
+    {
+        std::lock_guard<std::mutex> l(sleep_lock_);
+        sleep_cond_.notify_one();
+    }
+}
+
+
+VT::d_::WorkData* VT::d_::StealingScheduler::take_injected()
+{
+    if (injected_size_.load() == 0)
+        return nullptr;
+
+    std::lock_guard<std::mutex> l(inject_lock_);
+
+    WorkData* work = nullptr;
+    if (!injected_.pop(work))
+        return nullptr;
+
+    injected_size_.store(injected_.size());
+    injected_urgent_.store(injected_.has_urgent());
+    return work;
+}
+
+
+// self is nullptr when called from a thread that doesn't belong to this pool
+VT::d_::WorkData* VT::d_::StealingScheduler::find_work(Worker* self)
+{
+    if (injected_urgent_.load())
+    {
+        if (WorkData* work = take_injected())
+            return work;
+    }
+
+    if (self)
+    {
+        if (WorkData* work = self->deque.pop())
+            return work;
+    }
+
+    if (WorkData* work = take_injected())
+        return work;
+
+    // xorshift to pick the first victim
+    static THREAD_LOCAL uint32_t outsider_rand_state = 2463534242u;
+    uint32_t& state = (self ? self->rand_state : outsider_rand_state);
+    uint32_t x = state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state = x;
+
+    const size_t count = workers_.size();
+    const size_t start = x % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Worker* victim = workers_[(start + i) % count].get();
+        if (victim == self)
+            continue;
+
+        if (WorkData* work = victim->deque.steal())
+        {
+            stats_.stolen(self ? self->stats : stats_.outside());
+            return work;
+        }
+    }
+
+    return nullptr;
+}
+
+
+void VT::d_::StealingScheduler::execute(WorkData* work)
+{
+    pending_.fetch_sub(1);
+    if (capacity_)
+        not_full_.notify_one();
+
+    Worker* self = current_;
+    stats_.execute(self && self->owner == this ? self->stats : stats_.outside(), *work);
+    free_node(work);
+
+    if (outstanding_.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> l(done_lock_);
+        done_cond_.notify_all();
+    }
+}
+
+
+void VT::d_::StealingScheduler::purge_cancelled()
+{
+    std::vector<WorkData*> removed;
+
+    {
+        std::lock_guard<std::mutex> l(inject_lock_);
+        injected_.remove_if([](WorkData* work) { return work->is_cancelled(); }, removed);
+        injected_size_.store(injected_.size());
+        injected_urgent_.store(injected_.has_urgent());
+    }
 
-        assert(work_data_.work);
+    if (removed.empty())
+        return;
 
-        try
+    for (WorkData* work : removed)
+        delete work;  // futures of removed tasks report broken_promise
+    stats_.cancelled(removed.size());
+
+    pending_.fetch_sub(removed.size());
+    if (capacity_)
+        not_full_.notify_all();
+
+    if (outstanding_.fetch_sub(removed.size()) == removed.size())
+    {
+        std::lock_guard<std::mutex> l(done_lock_);
+        done_cond_.notify_all();
+    }
+}
+
+
+void VT::d_::StealingScheduler::worker_loop(Worker* self)
+{
+    current_ = self;
+
+    for (;;)
+    {
+        if (stopping_ || self->retire)
+            break;
+
+        if (WorkData* work = find_work(self))
+        {
+            execute(work);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(sleep_lock_);
+        sleepers_.fetch_add(1);
+        sleep_cond_.wait(l, [&]{ return pending_.load() > 0 || stopping_ || self->retire; });
+        sleepers_.fetch_sub(1);
+    }
+
+    drain_free_nodes();
+    current_ = nullptr;
+}
+
+
+size_t VT::d_::StealingScheduler::thread_count() const
+{
+    std::lock_guard<std::mutex> l(control_lock_);
+    return running_;
+}
+
+
+size_t VT::d_::StealingScheduler::max_thread_count() const
+{
+    std::lock_guard<std::mutex> l(control_lock_);
+    return max_running_;
+}
+
+
+void VT::d_::StealingScheduler::set_thread_count(size_t count)
+{
+    std::lock_guard<std::mutex> l(control_lock_);
+    assert(count >= 1 && count <= max_running_);
+    resize(std::min(std::max<size_t>(count, 1), max_running_));
+}
+
+
+void VT::d_::StealingScheduler::set_max_thread_count(size_t count)
+{
+    std::lock_guard<std::mutex> l(control_lock_);
+    assert(count >= 1 && count <= workers_.size() && "Can't grow work stealing pool past its initial size");
+    max_running_ = std::min(std::max<size_t>(count, 1), workers_.size());
+    if (running_ > max_running_)
+        resize(max_running_);
+}
+
+
+void VT::d_::StealingScheduler::resize(size_t count)
+{
+    // control_lock_ is held, submitters never take it
+
+    for (; running_ < count; ++running_)
+    {
+        Worker* worker = workers_[running_].get();
+        if (worker->thread.joinable())
+            worker->thread.join();
+        worker->retire = false;
+        worker->thread = std::thread([this, worker]{ setup_.apply(worker->index); worker_loop(worker); });
+        stats_.thread_started();
+    }
+
+    if (running_ > count)
+    {
         {
-            work_data_.work();
-            work_data_.result.set_value();
+            std::lock_guard<std::mutex> sl(sleep_lock_);
+            for (size_t i = count; i < running_; ++i)
+                workers_[i]->retire = true;
         }
-        catch (...)
+        sleep_cond_.notify_all();
+
+        // work left in retired deques is stolen by remaining workers
+        for (size_t i = count; i < running_; ++i)
         {
-            work_data_.result.set_exception(std::current_exception());
+            workers_[i]->thread.join();
+            stats_.thread_retired();
         }
+        running_ = count;
+    }
+}
+
+
+bool VT::d_::StealingScheduler::try_run_pending_task()
+{
+    Worker* self = current_;
+    WorkData* work = find_work(self && self->owner == this ? self : nullptr);
+    if (!work)
+        return false;
 
-        work_data_.work = nullptr;
-        working_.reset();
-        free_.signal();
-        free_notify_.signal();
-    }
+    execute(work);
+    return true;
 }
 
 
-void VT::d_::WorkerThread::do_work(WorkData&& work_data)
+VT::PriorityStats VT::d_::StealingScheduler::priority_stats(TaskPriority priority) const
 {
-    work_data_ = std::move(work_data);
-    free_.reset();
-    working_.signal();
+    std::lock_guard<std::mutex> l(inject_lock_);
+    return injected_.stats(priority);
 }
 
 
-void VT::d_::WorkerThread::terminate()
+bool VT::d_::StealingScheduler::wait_for_all(int timeout_ms)
 {
-    terminated_ = true;
-    working_.signal();
+    std::unique_lock<std::mutex> l(done_lock_);
+    auto done = [&]{ return outstanding_.load() == 0; };
+
+    if (timeout_ms == -1)
+    {
+        done_cond_.wait(l, done);
+        return true;
+    }
+
+    return done_cond_.wait_for(l, std::chrono::milliseconds(timeout_ms), done);
 }
 
 
-bool VT::d_::WorkerThread::wait(int timeout_ms)
+bool VT::d_::StealingScheduler::wait_for_all(const CancellationToken& cancel, int timeout_ms)
 {
-    return free_.wait(timeout_ms);
+    std::unique_lock<std::mutex> l(done_lock_);
+    auto done = [&]{ return cancel.is_cancelled() || outstanding_.load() == 0; };
+
+    if (timeout_ms == -1)
+        done_cond_.wait(l, done);
+    else if (!done_cond_.wait_for(l, std::chrono::milliseconds(timeout_ms), done))
+        return false;
+
+    return !cancel.is_cancelled();
 }
 
 
-bool VT::d_::WorkerThread::is_free()
+void VT::d_::StealingScheduler::wake_waiters()
 {
-    return free_.is_signaled();
+    std::lock_guard<std::mutex> l(done_lock_);
+    done_cond_.notify_all();
 }
 
 
 struct VT::ThreadPool::Impl
 {
-    explicit Impl(size_t max_thread_count)
-        : max_thread_count_(max_thread_count)
+    typedef std::shared_ptr<d_::WorkerThread> ThreadPtr;
+
+    explicit Impl(const Options& options)
+        : max_thread_count_(options.max_thread_count)
+        , grow_queue_depth_(std::max<size_t>(options.grow_queue_depth, 1))
+        , grow_latency_ms_(options.grow_latency_ms)
+        , capacity_(options.queue_capacity)
+        , full_policy_(options.queue_full_policy)
+        , full_waiters_(0)
         , dead_(false)
-        , thread_(std::bind(std::mem_fn(&ThreadPool::Impl::scheduler_loop), this))
+        , setup_(options, this)
+        , elastic_(options.thread_count, options.idle_timeout_ms)
+        , cancel_hook_(std::make_shared<d_::CancelHook>())
+        , stealing_(options.work_stealing ? new d_::StealingScheduler(options, setup_, stats_) : nullptr)
+        , thread_(options.work_stealing ? std::thread() : std::thread(std::bind(std::mem_fn(&ThreadPool::Impl::scheduler_loop), this)))
     {
-        assert(max_thread_count >= 1);
+        assert(options.max_thread_count >= 1);
+
+        cancel_hook_->callback = [this]
+        {
+            if (stealing_)
+                stealing_->purge_cancelled();
+            else
+                purge_cancelled();
+        };
     }
 
     ~Impl()
     {
+        {
+            // waits for a cancel() running the callback right now
+            std::lock_guard<std::mutex> l(cancel_hook_->lock);
+            cancel_hook_->callback = nullptr;
+        }
+
+        if (stealing_)
+            return;  // scheduler destructor joins its workers
+
         {
             std::lock_guard<std::mutex> l(lock_);
             dead_ = true;
-            has_queue_.signal();         //  to force scheduler to exit the loop
         }
+        not_full_.notify_all();
+        wake_.notify_all();              //  to force scheduler to exit the loop
         // thread_.join() will take the lock, so we need to release it here
         thread_.join();
         // destructors of worker threads will take care of joining existing threads
     }
 
-    std::shared_ptr<VT::d_::WorkerThread> free_thread()
+    // claims a free thread, the caller must hand it work
+    ThreadPtr free_thread()
     {
-        auto it = std::find_if(threads_.begin(), threads_.end(), std::mem_fn(&d_::WorkerThread::is_free));
-        if (it != threads_.end())
-            return *it;
-        else
-            return std::shared_ptr<d_::WorkerThread>();
+        for (auto& thread : threads_)
+        {
+            if (thread->try_claim())
+                return thread;
+        }
+        return ThreadPtr();
     }
 
-    void add_thread()
+    // lock_ is held
+    void reap_retired()
     {
-        threads_.push_back(std::make_shared<d_::WorkerThread>(has_free_threads_));
+        auto retired = std::partition(threads_.begin(), threads_.end(), [](const ThreadPtr& t) { return !t->is_retired(); });
+        graveyard_.insert(graveyard_.end(), retired, threads_.end());
+        threads_.erase(retired, threads_.end());
     }
 
-    void adjust_thread_count(size_t count)
+    // retired threads that have already exited, joining them doesn't block; lock_ is held
+    void take_exited(std::vector<ThreadPtr>& exited)
     {
-        // Create new threads
-        while (count > threads_.size())
+        auto it = std::partition(graveyard_.begin(), graveyard_.end(), [](const ThreadPtr& t) { return !t->has_exited(); });
+        exited.insert(exited.end(), it, graveyard_.end());
+        graveyard_.erase(it, graveyard_.end());
+    }
+
+    // smallest indexes not used by running threads, keeps names and CPUs of threads stable; lock_ is held
+    std::vector<size_t> free_indexes(size_t count) const
+    {
+        std::vector<bool> used(threads_.size() + count, false);
+        for (const auto& thread : threads_)
         {
-            add_thread();
+            if (thread->index() < used.size())
+                used[thread->index()] = true;
         }
 
-        // Trim existing threads
-        while (count < threads_.size())
+        std::vector<size_t> indexes;
+        for (size_t i = 0; indexes.size() < count; ++i)
         {
-            threads_.pop_back();  // destructor will call terminate() and join()
+            if (!used[i])
+                indexes.push_back(i);
         }
+        return indexes;
     }
 
-    void scheduler_loop()
+    // all threads are busy and queue is not empty; lock_ is held
+    bool should_grow() const
     {
-        for (;;)
+        if (threads_.size() >= max_thread_count_)
+            return false;
+
+        if (threads_.empty() || queue_.size() >= grow_queue_depth_)
+            return true;
+
+        return grow_latency_ms_ >= 0 && latency_left_ms() == 0;
+    }
+
+    // until the oldest queued task waits grow_latency_ms_; lock_ is held
+    int latency_left_ms() const
+    {
+        auto waited = std::chrono::steady_clock::now() - queue_.oldest_enqueued();
+        auto left = std::chrono::milliseconds(grow_latency_ms_) - std::chrono::duration_cast<std::chrono::milliseconds>(waited);
+        return static_cast<int>(std::max<long long>(left.count(), 0));
+    }
+
+    // returns false if the caller has to run the task itself; lock_ is held
+    bool make_room(std::unique_lock<std::mutex>& l)
+    {
+        if (capacity_ == 0 || queue_.size() < capacity_)
+            return true;
+
+        if (full_policy_ == QF_Reject)
+        {
+            stats_.rejected();
+            throw QueueFullError();
+        }
+
+        // blocking a worker could leave nobody to make room
+        if (full_policy_ == QF_CallerRuns || d_::ThreadSetup::current_owner == this)
+        {
+            stats_.caller_runs();
+            return false;
+        }
+
+        ++full_waiters_;
+        not_full_.wait(l, [this]{ return queue_.size() < capacity_ || dead_; });
+        --full_waiters_;
+        return true;
+    }
+
+    // lock_ is held
+    void pop(d_::WorkData& work_data)
+    {
+        queue_.pop(work_data);
+        if (full_waiters_ > 0)
+            not_full_.notify_one();
+    }
+
+    void purge_cancelled()
+    {
+        std::vector<d_::WorkData> removed;
+
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            queue_.remove_if([](const d_::WorkData& work) { return work.is_cancelled(); }, removed);
+            if (!removed.empty() && full_waiters_ > 0)
+                not_full_.notify_all();
+        }
+        stats_.cancelled(removed.size());
+
+        if (!removed.empty())
+            wake_.notify_all();  // the pool may be idle now
+
+        // tasks are destroyed without the lock, futures of removed tasks report broken_promise
+    }
+
+    // nothing queued and no busy worker
+    bool is_idle()
+    {
+        std::lock_guard<std::mutex> l(lock_);
+
+        if (!queue_.empty())
+            return false;
+
+        for (auto it = threads_.begin(); it != threads_.end(); ++it)
         {
-            has_queue_.wait();
-            has_free_threads_.reset();
+            if (!(*it)->is_free())
+                return false;
+        }
+        return true;
+    }
+
+    ThreadPtr spawn_thread(size_t index)
+    {
+        return std::make_shared<d_::WorkerThread>(wake_, elastic_, stats_, setup_, index);
+    }
+
+    // threads are started and joined without lock_, so post() never waits for them;
+    // resize_lock_ is held
+    void resize(size_t count)
+    {
+        std::vector<ThreadPtr> removed;
+        std::vector<size_t> indexes;
 
-            std::shared_ptr<d_::WorkerThread> thread;
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            reap_retired();
 
+            while (threads_.size() > count)
             {
-                std::lock_guard<std::mutex> l(lock_);
+                threads_.back()->terminate();
+                removed.push_back(threads_.back());
+                threads_.pop_back();
+            }
 
-                if (dead_)  // to exit when destructor sets dead_ and signals has_queue_
-                    break;
+            if (threads_.size() < count)
+                indexes = free_indexes(count - threads_.size());
+        }
+
+        removed.clear();  // joins, waiting for their current tasks
+
+        std::vector<ThreadPtr> started;
+        for (size_t index : indexes)
+            started.push_back(spawn_thread(index));
+
+        if (!started.empty())
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            threads_.insert(threads_.end(), started.begin(), started.end());
+        }
+        wake_.notify_all();  // new threads can take queued work
+    }
 
-                thread = free_thread();
+    // sleeps on a single eventcount that is notified when work is queued,
+    // when a worker becomes free and when a worker retires
+    void scheduler_loop()
+    {
+        if (!setup_.name.empty())
+            set_current_thread_name(setup_.name + "-sched");
+
+        for (;;)
+        {
+            uint32_t key = wake_.prepare_wait();
+            bool dispatched = false;
+            bool grow = false;
+            size_t grow_index = 0;
+            int wait_ms = -1;
+            std::vector<ThreadPtr> exited;
+
+            {
+                std::lock_guard<std::mutex> l(lock_);
 
-                if (!thread && threads_.size() < max_thread_count_)  // we still have free slots
+                if (dead_)  // to exit when destructor sets dead_ and notifies wake_
                 {
-                    add_thread();
-                    thread = threads_.back();
+                    wake_.cancel_wait();
+                    break;
                 }
 
-                if (thread)
+                reap_retired();
+                take_exited(exited);
+
+                if (!queue_.empty())
                 {
-                    if (queue_.size() > 0)
+                    if (ThreadPtr thread = free_thread())
                     {
-                        auto work_data = std::move(queue_.back());
-                        queue_.pop_back();
+                        d_::WorkData work_data;
+                        pop(work_data);
                         thread->do_work(std::move(work_data));
-
-                        if (queue_.empty())
-                            has_queue_.reset();
+                        dispatched = true;
+                    }
+                    else if (should_grow())
+                    {
+                        grow = true;
+                        grow_index = free_indexes(1).front();
+                    }
+                    else if (grow_latency_ms_ >= 0 && threads_.size() < max_thread_count_)
+                    {
+                        wait_ms = std::max(latency_left_ms(), 1);
                     }
                 }
             }
 
-            if (!thread)
+            exited.clear();
+
+            if (grow)
             {
-                has_free_threads_.wait();
+                // started without lock_, post() keeps dispatching to free threads meanwhile
+                ThreadPtr thread = spawn_thread(grow_index);
+                {
+                    std::lock_guard<std::mutex> l(lock_);
+                    if (threads_.size() < max_thread_count_)  // set_max_thread_count() could race with us
+                        threads_.push_back(thread);
+                    else
+                        thread->terminate();
+                }
+                thread.reset();
+                dispatched = true;  // look at the queue again
             }
+
+            if (dispatched)
+                wake_.cancel_wait();
+            else
+                wake_.wait(key, wait_ms);
         }
     }
 
 
     size_t max_thread_count_;
+    const size_t grow_queue_depth_;
+    const int grow_latency_ms_;
+    const size_t capacity_;
+    const QueueFullPolicy full_policy_;
+    size_t full_waiters_;
+    std::condition_variable not_full_;
     bool dead_;
-    std::vector<std::shared_ptr<d_::WorkerThread>> threads_;
-    std::vector<d_::WorkData> queue_;
-    VT::Event has_queue_;
-    VT::Event has_free_threads_;
+    d_::ThreadSetup setup_;
+    d_::Elastic elastic_;
+    d_::PoolStats stats_;  // declared before threads, they write to it until joined
+    std::vector<ThreadPtr> threads_;
+    std::vector<ThreadPtr> graveyard_;  // retired on idle timeout, joined by scheduler after they exit
+    d_::TaskQueue<d_::WorkData> queue_;  // by priority, then deadline, then FIFO
+    VT::EventCount wake_;  // work queued, worker freed or retired
     mutable std::mutex lock_;
+    std::mutex resize_lock_;  // serializes set_thread_count() and set_max_thread_count()
+    std::shared_ptr<d_::CancelHook> cancel_hook_;  // registered with tokens of queued tasks
+    std::unique_ptr<d_::StealingScheduler> stealing_;  // set in work stealing mode, the rest is unused then
     std::thread thread_;
 };
 
 
+namespace
+{
+    VT::ThreadPool::Options make_options(size_t thread_count, size_t max_thread_count)
+    {
+        VT::ThreadPool::Options options;
+        options.thread_count = thread_count;
+        options.max_thread_count = max_thread_count;
+        return options;
+    }
+}
+
+
 VT::ThreadPool::ThreadPool(size_t thread_count, size_t max_thread_count)
-    : d(new Impl(max_thread_count))
+    : d(new Impl(make_options(thread_count, max_thread_count)))
 {
     set_thread_count(thread_count);
 }
 
 
+VT::ThreadPool::ThreadPool(const Options& options)
+    : d(new Impl(options))
+{
+    if (!d->stealing_)
+        set_thread_count(options.thread_count);
+}
+
+
 VT::ThreadPool::~ThreadPool()
 {
     try
@@ -279,13 +1534,20 @@ VT::ThreadPool::~ThreadPool()
 
 size_t VT::ThreadPool::thread_count() const
 {
+    if (d->stealing_)
+        return d->stealing_->thread_count();
+
     std::lock_guard<std::mutex> l(d->lock_);
+    d->reap_retired();
     return d->threads_.size();
 }
 
 
 size_t VT::ThreadPool::max_thread_count() const
 {
+    if (d->stealing_)
+        return d->stealing_->max_thread_count();
+
     std::lock_guard<std::mutex> l(d->lock_);
     return d->max_thread_count_;
 }
@@ -293,53 +1555,94 @@ size_t VT::ThreadPool::max_thread_count() const
 
 void VT::ThreadPool::set_thread_count(size_t count)
 {
+    if (d->stealing_)
+        return d->stealing_->set_thread_count(count);
+
+    std::lock_guard<std::mutex> rl(d->resize_lock_);
     assert(count <= d->max_thread_count_);
-    std::lock_guard<std::mutex> l(d->lock_);
-    d->adjust_thread_count(count);
+    d->elastic_.min_threads = count;
+    d->resize(count);
 }
 
 
 void VT::ThreadPool::set_max_thread_count(size_t count)
 {
     assert(count >= 1);
-    std::lock_guard<std::mutex> l(d->lock_);
-    d->max_thread_count_ = count;
-    if (d->max_thread_count_ < d->threads_.size())
-        d->adjust_thread_count(d->max_thread_count_);
+
+    if (d->stealing_)
+        return d->stealing_->set_max_thread_count(count);
+
+    std::lock_guard<std::mutex> rl(d->resize_lock_);
+    bool trim = false;
+
+    {
+        std::lock_guard<std::mutex> l(d->lock_);
+        d->max_thread_count_ = count;
+        if (d->elastic_.min_threads > count)
+            d->elastic_.min_threads = count;
+        trim = (count < d->threads_.size());
+    }
+
+    if (trim)
+        d->resize(count);
 }
 
 
 std::future<void> VT::ThreadPool::run(const std::function<void()>& work)
 {
-    std::lock_guard<std::mutex> l(d->lock_);
+    return submit(work);
+}
+
+
+void VT::ThreadPool::post(Task task, const TaskOptions& options)
+{
+    if (options.cancel.is_cancelled())
+    {
+        d->stats_.cancelled(1);
+        return;
+    }
+
+    if (d->stealing_)
+    {
+        d->stealing_->submit(std::move(task), options);
+        options.cancel.add_hook(d->cancel_hook_);
+        return;
+    }
 
-    std::promise<void> promise;
-    auto fut = promise.get_future();
-    d_::WorkData work_data(work, std::move(promise));
+    std::unique_lock<std::mutex> l(d->lock_);
+
+    d_::WorkData work_data(std::move(task), options.cancel);
 
     // do we have free threads?
     auto thread = d->free_thread();
     if (thread)
     {
+        d->queue_.record_direct(options.priority);
         thread->do_work(std::move(work_data));
+        return;
     }
-    else if (d->threads_.size() < d->max_thread_count_)  // we still have free slots
-    {
-        d->add_thread();
-        d->threads_.back()->do_work(std::move(work_data));
-    }
-    else  // queue that bitch
+
+    if (!d->make_room(l))
     {
-        d->queue_.push_back(std::move(work_data));
-        d->has_queue_.signal();
+        l.unlock();
+        d->stats_.execute(d->stats_.outside(), work_data);
+        return;
     }
 
-    return fut;
+    // queue that bitch, scheduler starts more threads if needed
+    d->queue_.push(std::move(work_data), options);
+    options.cancel.add_hook(d->cancel_hook_);
+    l.unlock();
+
+    d->wake_.notify_all();
 }
 
 
 bool VT::ThreadPool::wait_for_all(int timeout_ms)
 {
+    if (d->stealing_)
+        return d->stealing_->wait_for_all(timeout_ms);
+
     Timer timer;
 
     for (;;)
@@ -380,3 +1683,213 @@ bool VT::ThreadPool::wait_for_all(int timeout_ms)
         }
     }
 }
+
+
+bool VT::ThreadPool::wait_for_all(const CancellationToken& cancel, int timeout_ms)
+{
+    // cancel() wakes this waiter up
+    std::shared_ptr<d_::CancelHook> hook = std::make_shared<d_::CancelHook>();
+    hook->callback = [this]
+    {
+        if (d->stealing_)
+            d->stealing_->wake_waiters();
+        else
+            d->wake_.notify_all();
+    };
+    cancel.add_hook(hook);
+
+    bool done = false;
+    if (d->stealing_)
+    {
+        done = d->stealing_->wait_for_all(cancel, timeout_ms);
+    }
+    else
+    {
+        // wake_ is notified whenever a worker gets free and when queued work is run or purged
+        Timer timer;
+        for (;;)
+        {
+            uint32_t key = d->wake_.prepare_wait();
+
+            if (cancel.is_cancelled())
+            {
+                d->wake_.cancel_wait();
+                break;
+            }
+
+            if (d->is_idle())
+            {
+                d->wake_.cancel_wait();
+                done = true;
+                break;
+            }
+
+            int time_left = -1;
+            if (timeout_ms != -1)
+            {
+                time_left = static_cast<int>(timeout_ms - timer.time_elapsed_s() * 1000);
+                if (time_left < 0)
+                {
+                    d->wake_.cancel_wait();
+                    break;
+                }
+            }
+
+            d->wake_.wait(key, time_left);
+        }
+    }
+
+    // cancel() may be calling it right now
+    std::lock_guard<std::mutex> l(hook->lock);
+    hook->callback = nullptr;
+    return done;
+}
+
+
+bool VT::ThreadPool::try_run_pending_task()
+{
+    if (d->stealing_)
+        return d->stealing_->try_run_pending_task();
+
+    d_::WorkData work_data;
+    bool drained = false;
+
+    {
+        std::lock_guard<std::mutex> l(d->lock_);
+
+        if (d->queue_.empty())
+            return false;
+        d->pop(work_data);
+        drained = d->queue_.empty();
+    }
+
+    if (drained)
+        d->wake_.notify_all();  // for wait_for_all(cancel)
+
+    d->stats_.execute(d->stats_.outside(), work_data);
+    return true;
+}
+
+
+VT::PriorityStats VT::ThreadPool::priority_stats(TaskPriority priority) const
+{
+    if (d->stealing_)
+        return d->stealing_->priority_stats(priority);
+
+    std::lock_guard<std::mutex> l(d->lock_);
+    return d->queue_.stats(priority);
+}
+
+
+VT::ThreadPoolStats VT::ThreadPool::stats() const
+{
+    ThreadPoolStats result;
+    d->stats_.fill(result);
+
+    if (d->stealing_)
+    {
+        result.queue_depth = d->stealing_->queue_depth();
+        result.thread_count = d->stealing_->thread_count();
+        return result;
+    }
+
+    std::lock_guard<std::mutex> l(d->lock_);
+    d->reap_retired();
+    result.queue_depth = d->queue_.size();
+    result.thread_count = d->threads_.size();
+    return result;
+}
+
+
+struct VT::NumaThreadPool::Impl
+{
+    std::vector<std::unique_ptr<ThreadPool>> pools;
+    std::vector<size_t> node_of_cpu;
+};
+
+
+VT::NumaThreadPool::NumaThreadPool(const ThreadPool::Options& options)
+    : d(new Impl())
+{
+    std::vector<std::vector<int>> nodes = numa_nodes();
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        ThreadPool::Options node_options = options;
+        node_options.cpus = nodes[i];
+        if (!options.name.empty())
+            node_options.name = options.name + std::to_string(i);
+
+        d->pools.push_back(std::unique_ptr<ThreadPool>(new ThreadPool(node_options)));
+
+        for (int cpu : nodes[i])
+        {
+            if (static_cast<size_t>(cpu) >= d->node_of_cpu.size())
+                d->node_of_cpu.resize(cpu + 1, 0);
+            d->node_of_cpu[cpu] = i;
+        }
+    }
+}
+
+
+VT::NumaThreadPool::~NumaThreadPool()
+{
+    delete d;
+}
+
+
+size_t VT::NumaThreadPool::node_count() const
+{
+    return d->pools.size();
+}
+
+
+VT::ThreadPool& VT::NumaThreadPool::node(size_t index)
+{
+    assert(index < d->pools.size());
+    return *d->pools[index];
+}
+
+
+size_t VT::NumaThreadPool::current_node() const
+{
+    int cpu = current_cpu();
+    if (cpu < 0 || static_cast<size_t>(cpu) >= d->node_of_cpu.size())
+        return 0;
+
+    return d->node_of_cpu[cpu];
+}
+
+
+void VT::NumaThreadPool::post(ThreadPool::Task task, const TaskOptions& options)
+{
+    node(current_node()).post(std::move(task), options);
+}
+
+
+void VT::NumaThreadPool::post_to(size_t node_index, ThreadPool::Task task, const TaskOptions& options)
+{
+    node(node_index).post(std::move(task), options);
+}
+
+
+bool VT::NumaThreadPool::wait_for_all(int timeout_ms)
+{
+    Timer timer;
+
+    for (auto& pool : d->pools)
+    {
+        int time_left = -1;
+        if (timeout_ms != -1)
+        {
+            time_left = static_cast<int>(timeout_ms - timer.time_elapsed_s() * 1000);
+            if (time_left < 0)
+                return false;
+        }
+
+        if (!pool->wait_for_all(time_left))
+            return false;
+    }
+
+    return true;
+}
@@ -1,17 +1,336 @@
 #pragma once
 
 #include "VTEvent.hpp"
+#include "VTHistogram.h"
+#include "VTUniqueFunction.h"
 
+#include <atomic>
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <type_traits>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 
 namespace VT
 {
+    // tasks of higher priority leave the queue first
+    enum TaskPriority
+    {
+        TP_High    = 0,
+        TP_Normal  = 1,
+        TP_Low     = 2,
+        TP_Count   = 3
+    };
+
+    namespace d_
+    {
+        // lets a pool hear about cancel() of tokens its queued tasks carry;
+        // the pool clears callback before it goes away
+        struct CancelHook
+        {
+            std::mutex lock;
+            std::function<void()> callback;
+        };
+
+        struct CancelState
+        {
+            CancelState() : cancelled(false) { }
+
+            std::atomic<bool> cancelled;
+            std::mutex lock;
+            std::vector<std::weak_ptr<CancelHook>> hooks;
+        };
+    }
+
+    // Cooperative cancellation, copies share the state.
+    // Running tasks check is_cancelled() themselves, queued tasks carrying
+    // a cancelled token are removed from pool queues and never started
+    // (their futures report broken_promise).
+    class CancellationToken
+    {
+    public:
+        CancellationToken()
+            : state_(std::make_shared<d_::CancelState>())
+        { }
+
+        // empty token, never cancelled
+        CancellationToken(std::nullptr_t)
+        { }
+
+        bool valid() const { return state_ != nullptr; }
+
+        bool is_cancelled() const
+        {
+            return state_ && state_->cancelled.load(std::memory_order_acquire);
+        }
+
+        void cancel()
+        {
+            if (!state_ || state_->cancelled.exchange(true))
+                return;
+
+            std::vector<std::weak_ptr<d_::CancelHook>> hooks;
+            {
+                std::lock_guard<std::mutex> l(state_->lock);
+                hooks.swap(state_->hooks);
+            }
+
+            for (auto& weak : hooks)
+            {
+                if (std::shared_ptr<d_::CancelHook> hook = weak.lock())
+                {
+                    std::lock_guard<std::mutex> l(hook->lock);
+                    if (hook->callback)
+                        hook->callback();
+                }
+            }
+        }
+
+        // used by pools, registers hook once
+        void add_hook(const std::shared_ptr<d_::CancelHook>& hook) const
+        {
+            if (!state_)
+                return;
+
+            std::lock_guard<std::mutex> l(state_->lock);
+
+            auto& hooks = state_->hooks;
+            for (size_t i = 0; i < hooks.size(); )
+            {
+                std::shared_ptr<d_::CancelHook> existing = hooks[i].lock();
+                if (existing == hook)
+                    return;
+
+                if (!existing)  // pool is gone
+                {
+                    hooks[i] = hooks.back();
+                    hooks.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            hooks.push_back(hook);
+        }
+
+    private:
+        std::shared_ptr<d_::CancelState> state_;
+    };
+
+    struct TaskOptions
+    {
+        TaskOptions(TaskPriority priority = TP_Normal)
+            : priority(priority)
+            , deadline(std::chrono::steady_clock::time_point::max())
+            , cancel(nullptr)
+        { }
+
+        TaskOptions(TaskPriority priority, std::chrono::steady_clock::time_point deadline)
+            : priority(priority)
+            , deadline(deadline)
+            , cancel(nullptr)
+        { }
+
+        TaskOptions(const CancellationToken& cancel, TaskPriority priority = TP_Normal)
+            : priority(priority)
+            , deadline(std::chrono::steady_clock::time_point::max())
+            , cancel(cancel)
+        { }
+
+        bool has_deadline() const { return deadline != std::chrono::steady_clock::time_point::max(); }
+
+        TaskPriority priority;
+
+        // within one priority tasks with deadlines go first, earliest deadline first,
+        // tasks without deadline keep FIFO order
+        std::chrono::steady_clock::time_point deadline;
+
+        // task is dropped if the token is cancelled before it starts
+        CancellationToken cancel;
+    };
+
+    // what post() does when queue_capacity tasks are already queued
+    enum QueueFullPolicy
+    {
+        QF_Block,       // wait for room (pool's own threads run the task instead, to avoid deadlock)
+        QF_Reject,      // throw QueueFullError
+        QF_CallerRuns   // run the task on the calling thread
+    };
+
+    class QueueFullError : public std::runtime_error
+    {
+    public:
+        QueueFullError() : std::runtime_error("VT::ThreadPool queue is full") { }
+    };
+
+    // time spent in the queue by tasks of one priority class
+    struct PriorityStats
+    {
+        PriorityStats() : tasks(0), total_wait_us(0), max_wait_us(0) { }
+
+        uint64_t tasks;
+        uint64_t total_wait_us;
+        uint64_t max_wait_us;
+    };
+
+    // counters of a pool, see ThreadPool::stats()
+    struct ThreadPoolStats
+    {
+        struct Worker
+        {
+            Worker() : tasks(0), steals(0), busy_ns(0) { }
+
+            uint64_t tasks;
+            uint64_t steals;    // tasks taken from other workers' deques
+            uint64_t busy_ns;   // time spent running tasks
+        };
+
+        ThreadPoolStats()
+            : enabled(false)
+            , queue_depth(0)
+            , thread_count(0)
+            , completed(0)
+            , cancelled(0)
+            , rejected(0)
+            , caller_runs(0)
+            , threads_started(0)
+            , threads_retired(0)
+        { }
+
+        bool enabled;  // false if VTThreadPool.cpp is built without VT_THREAD_POOL_STATS
+
+        size_t queue_depth;
+        size_t thread_count;
+
+        uint64_t completed;
+        uint64_t cancelled;         // removed from queue or skipped
+        uint64_t rejected;          // QF_Reject
+        uint64_t caller_runs;       // run by the submitting thread because the queue was full
+        uint64_t threads_started;
+        uint64_t threads_retired;   // idle timeout or thread count decrease
+
+        HistogramSnapshot queue_wait_ns;  // enqueue to start
+        HistogramSnapshot run_time_ns;    // start to finish
+
+        // by worker index, the last one accumulates tasks run by threads
+        // outside of the pool (try_run_pending_task(), caller runs)
+        std::vector<Worker> workers;
+    };
+
+    namespace d_
+    {
+        // fulfils the promise with the result (or exception) of the callable
+        template <typename R, typename F>
+        struct PromiseTask
+        {
+            PromiseTask(F&& f, std::promise<R>&& p) : fn(std::move(f)), promise(std::move(p)) { }
+            PromiseTask(PromiseTask&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+                : fn(std::move(other.fn)), promise(std::move(other.promise))
+            { }
+
+            void operator()()
+            {
+                try
+                {
+                    promise.set_value(fn());
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+
+            F fn;
+            std::promise<R> promise;
+        };
+
+        template <typename F>
+        struct PromiseTask<void, F>
+        {
+            PromiseTask(F&& f, std::promise<void>&& p) : fn(std::move(f)), promise(std::move(p)) { }
+            PromiseTask(PromiseTask&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+                : fn(std::move(other.fn)), promise(std::move(other.promise))
+            { }
+
+            void operator()()
+            {
+                try
+                {
+                    fn();
+                    promise.set_value();
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+
+            F fn;
+            std::promise<void> promise;
+        };
+    }
+
     class ThreadPool
     {
     public:
+        // move-only, small callables are stored without heap allocation
+        typedef UniqueFunction<void()> Task;
+
+        struct Options
+        {
+            Options()
+                : thread_count(1)
+                , max_thread_count(10)
+                , work_stealing(false)
+                , name("vt-pool")
+                , idle_timeout_ms(-1)
+                , grow_queue_depth(1)
+                , grow_latency_ms(-1)
+                , queue_capacity(0)
+                , queue_full_policy(QF_Block)
+            { }
+
+            size_t thread_count;
+            size_t max_thread_count;
+
+            // every worker owns a Chase-Lev deque, tasks submitted from inside a worker
+            // go to its own deque and idle workers steal from the others;
+            // there is no scheduler thread and workers are started upfront
+            // (max_thread_count can't be raised later in this mode)
+            bool work_stealing;
+
+            // workers are named "<name>-<index>" (empty name leaves threads unnamed)
+            std::string name;
+
+            // if not empty, worker with index i is pinned to cpus[i % cpus.size()]
+            std::vector<int> cpus;
+
+            // elastic sizing (classic mode only): thread_count is the minimum, threads above it
+            // retire after idle_timeout_ms without work; -1 keeps them forever
+            int idle_timeout_ms;
+
+            // when all threads are busy, a new one is started once grow_queue_depth tasks are queued
+            // or the oldest queued task has waited grow_latency_ms (-1: queue depth only);
+            // threads are started by the scheduler thread, post() never waits for it
+            size_t grow_queue_depth;
+            int grow_latency_ms;
+
+            // maximum number of queued (not yet started) tasks, 0 - unbounded;
+            // approximate in work stealing mode
+            size_t queue_capacity;
+            QueueFullPolicy queue_full_policy;
+        };
+
         ThreadPool(size_t thread_count = 1, size_t max_thread_count = 10);
+        explicit ThreadPool(const Options& options);
         ~ThreadPool();
 
         // number of threads can grow when needed
@@ -19,16 +338,93 @@ namespace VT
         //
         // if setting count or max_count reduces current thread number,
         // this operation may cause a wait for threads to finish
+        // (the pool lock is not held meanwhile, post() and run() are not blocked)
+        //
+        // with idle_timeout_ms set, count is the number of threads that never retire
 
         size_t thread_count() const;
         size_t max_thread_count() const;
         void set_thread_count(size_t count);
         void set_max_thread_count(size_t count);
 
+        // same as submit(work)
         std::future<void> run(const std::function<void()>& work);
 
+        // fire-and-forget, no future and no shared state is allocated
+        // exceptions escaping the task are reported to std::cerr
+        // if the queue is full, acts according to Options::queue_full_policy
+        void post(Task task, const TaskOptions& options = TaskOptions());
+
+        // returns future for the result of the callable (or the exception it throws)
+        template <typename F>
+        std::future<decltype(std::declval<F&>()())> submit(F&& work, const TaskOptions& options = TaskOptions())
+        {
+            typedef decltype(std::declval<F&>()()) R;
+            typedef typename std::decay<F>::type Fn;
+
+            // Task keeps only nothrow movable callables in place
+            static_assert(std::is_nothrow_move_constructible<d_::PromiseTask<R, Fn>>::value ||
+                          !std::is_nothrow_move_constructible<Fn>::value, "PromiseTask move must be noexcept");
+
+            std::promise<R> promise;
+            auto fut = promise.get_future();
+            post(Task(d_::PromiseTask<R, Fn>(Fn(std::forward<F>(work)), std::move(promise))), options);
+            return fut;
+        }
+
         bool wait_for_all(int timeout_ms = -1);
 
+        // returns false on timeout or as soon as [cancel] is cancelled
+        // (tasks removed from the queue by cancellation are never waited for)
+        bool wait_for_all(const CancellationToken& cancel, int timeout_ms = -1);
+
+        // runs one queued task on the calling thread, returns false if there was nothing to run
+        // lets threads that wait for pool work help instead of blocking
+        bool try_run_pending_task();
+
+        // queue wait times of tasks that went through the shared queue
+        // (in work stealing mode tasks pushed to worker's own deque are not counted)
+        PriorityStats priority_stats(TaskPriority priority) const;
+
+        // snapshot of counters and latency histograms aggregated over workers,
+        // collected only when VTThreadPool.cpp is built with VT_THREAD_POOL_STATS
+        // (otherwise it costs nothing and only queue_depth and thread_count are filled)
+        ThreadPoolStats stats() const;
+
+        // co_await pool.schedule() continues the coroutine on a pool thread (see VTCoroutine.h);
+        // the options' cancel token is not used: a dropped task would leave the coroutine
+        // suspended forever, check the token after the hop instead
+        class ScheduleAwaiter
+        {
+        public:
+            ScheduleAwaiter(ThreadPool& pool, const TaskOptions& options)
+                : pool_(pool)
+                , options_(options)
+            {
+                options_.cancel = nullptr;
+            }
+
+            bool await_ready() const { return false; }
+
+            // Handle is std::coroutine_handle<>, a template keeps this header C++11
+            template <typename Handle>
+            void await_suspend(Handle handle)
+            {
+                pool_.post([handle]{ handle.resume(); }, options_);
+            }
+
+            void await_resume() const { }
+
+        private:
+            ThreadPool& pool_;
+            TaskOptions options_;
+        };
+
+        ScheduleAwaiter schedule(const TaskOptions& options = TaskOptions())
+        {
+            return ScheduleAwaiter(*this, options);
+        }
+
         //static ThreadPool global;
 
     private:
@@ -36,6 +432,50 @@ namespace VT
         Impl* d;
     };
 
+    /*
+     * One ThreadPool per NUMA node, workers of each pool are pinned to CPUs of
+     * their node so tasks touching node-local memory don't cross sockets.
+     *
+     * thread_count and max_thread_count of options are per node, options.cpus is ignored.
+     * Tasks posted without a node go to the node the calling thread runs on.
+     */
+    class NumaThreadPool
+    {
+    public:
+        explicit NumaThreadPool(const ThreadPool::Options& options = ThreadPool::Options());
+        ~NumaThreadPool();
+
+        size_t node_count() const;
+        ThreadPool& node(size_t index);
+
+        // node of the CPU the calling thread runs on
+        size_t current_node() const;
+
+        void post(ThreadPool::Task task, const TaskOptions& options = TaskOptions());
+        void post_to(size_t node_index, ThreadPool::Task task, const TaskOptions& options = TaskOptions());
+
+        template <typename F>
+        std::future<decltype(std::declval<F&>()())> submit(F&& work, const TaskOptions& options = TaskOptions())
+        {
+            return node(current_node()).submit(std::forward<F>(work), options);
+        }
+
+        template <typename F>
+        std::future<decltype(std::declval<F&>()())> submit_to(size_t node_index, F&& work, const TaskOptions& options = TaskOptions())
+        {
+            return node(node_index).submit(std::forward<F>(work), options);
+        }
+
+        bool wait_for_all(int timeout_ms = -1);
+
+    private:
+        NumaThreadPool(const NumaThreadPool&);
+        NumaThreadPool& operator=(const NumaThreadPool&);
+
+        struct Impl;
+        Impl* d;
+    };
+
     class ThreadPoolSingleton
     {
     public:
@@ -1,8 +1,17 @@
 #pragma once
 
+#include "VTCompilerSpecific.h"
+#include "VTEvent.hpp"
+
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <cstdint>
+#include <assert.h>
 
 namespace VT
 {
@@ -43,5 +52,487 @@ namespace VT
         mutable std::mutex mutex_;
         std::condition_variable cond_;
     };
-}
 
+
+    namespace d_
+    {
+        // Spin for a while, then give up the time slice; used before parking on a condition variable
+        class Backoff
+        {
+        public:
+            Backoff() : count_(0) { }
+
+            // returns false when it's time to park
+            bool spin()
+            {
+                if (count_ < 64)
+                    VT_CPU_RELAX();
+                else if (count_ < 80)
+                    std::this_thread::yield();
+                else
+                    return false;
+
+                ++count_;
+                return true;
+            }
+
+        private:
+            unsigned int count_;
+        };
+    }
+
+
+    /*
+     * Bounded lock-free multi-producer multi-consumer queue
+     * (D. Vyukov's array based queue with per-slot sequence numbers).
+     *
+     * Capacity must be a power of two. try_* functions never block,
+     * push() and pop() spin briefly and then park until there is space or data.
+     */
+    template <typename T>
+    class MPMCQueue
+    {
+    public:
+        explicit MPMCQueue(size_t capacity)
+            : mask_(capacity - 1)
+            , cells_(new Cell[capacity])
+            , enqueue_pos_(0)
+            , dequeue_pos_(0)
+            , push_waiters_(0)
+            , pop_waiters_(0)
+        {
+            assert(capacity >= 2 && (capacity & (capacity - 1)) == 0 && "Capacity must be a power of two");
+            for (size_t i = 0; i < capacity; ++i)
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~MPMCQueue()
+        {
+            T item;
+            while (try_pop(item))
+                ;
+        }
+
+        bool try_push(const T& item)
+        {
+            T copy(item);
+            return try_push(std::move(copy));
+        }
+
+        bool try_push(T&& item)
+        {
+            if (!enqueue(item))
+                return false;
+
+            notify(pop_waiters_, not_empty_);
+            return true;
+        }
+
+        bool try_pop(T& item)
+        {
+            if (!dequeue(item))
+                return false;
+
+            notify(push_waiters_, not_full_);
+            return true;
+        }
+
+        // blocks while queue is full
+        void push(T&& item)
+        {
+            d_::Backoff backoff;
+            while (!enqueue(item))
+            {
+                if (!backoff.spin())
+                {
+                    park(push_waiters_, not_full_, [&]{ return enqueue(item); });
+                    break;
+                }
+            }
+            notify(pop_waiters_, not_empty_);
+        }
+
+        void push(const T& item)
+        {
+            T copy(item);
+            push(std::move(copy));
+        }
+
+        // blocks while queue is empty
+        T pop()
+        {
+            T item;
+            d_::Backoff backoff;
+            while (!dequeue(item))
+            {
+                if (!backoff.spin())
+                {
+                    park(pop_waiters_, not_empty_, [&]{ return dequeue(item); });
+                    break;
+                }
+            }
+            notify(push_waiters_, not_full_);
+            return item;
+        }
+
+        // approximate when called concurrently
+        size_t size() const
+        {
+            size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+            size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        size_t capacity() const { return mask_ + 1; }
+
+    private:
+        MPMCQueue(const MPMCQueue&);
+        MPMCQueue& operator=(const MPMCQueue&);
+
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+        };
+
+        // enqueue() and dequeue() don't notify, so they are safe to call while holding park_lock_
+
+        bool enqueue(T& item)
+        {
+            Cell* cell;
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                cell = &cells_[pos & mask_];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return false;  // full
+                }
+                else
+                {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            new (&cell->storage) T(std::move(item));
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool dequeue(T& item)
+        {
+            Cell* cell;
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                cell = &cells_[pos & mask_];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+                if (diff == 0)
+                {
+                    if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return false;  // empty
+                }
+                else
+                {
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            T* stored = reinterpret_cast<T*>(&cell->storage);
+            item = std::move(*stored);
+            stored->~T();
+            cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+            return true;
+        }
+
+        template <typename Pred>
+        void park(std::atomic<size_t>& waiters, std::condition_variable& cond, Pred pred)
+        {
+            std::unique_lock<std::mutex> l(park_lock_);
+            waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cond.wait(l, pred);
+            waiters.fetch_sub(1);
+        }
+
+        void notify(std::atomic<size_t>& waiters, std::condition_variable& cond)
+        {
+            // skip the lock entirely when nobody is parked
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters.load(std::memory_order_relaxed) == 0)
+                return;
+
+            std::lock_guard<std::mutex> l(park_lock_);
+            cond.notify_one();
+        }
+
+        const size_t mask_;
+        std::unique_ptr<Cell[]> cells_;
+
+        // producers and consumers hammer different indexes, keep them apart
+        char pad0_[VT_CACHE_LINE_SIZE];
+        std::atomic<size_t> enqueue_pos_;
+        char pad1_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos_;
+        char pad2_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+        std::atomic<size_t> push_waiters_;
+        std::atomic<size_t> pop_waiters_;
+        std::mutex park_lock_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+    };
+
+
+    /*
+     * Wait strategies for SPSCQueue, they decide what a blocked side does
+     * until ready() returns true. notify() is called after every publish.
+     */
+
+    // burns the core, lowest latency when both threads are pinned
+    struct SpinWait
+    {
+        template <typename Pred>
+        void wait(Pred ready)
+        {
+            while (!ready())
+                VT_CPU_RELAX();
+        }
+
+        void notify() { }
+    };
+
+    // spins briefly, then yields the time slice
+    struct YieldWait
+    {
+        template <typename Pred>
+        void wait(Pred ready)
+        {
+            d_::Backoff backoff;
+            while (!ready())
+            {
+                if (!backoff.spin())
+                    std::this_thread::yield();
+            }
+        }
+
+        void notify() { }
+    };
+
+    // spins briefly, then sleeps on a futex; notify() skips the syscall when nobody sleeps
+    class ParkWait
+    {
+    public:
+        ParkWait() { }
+
+        template <typename Pred>
+        void wait(Pred ready)
+        {
+            d_::Backoff backoff;
+            while (!ready())
+            {
+                if (backoff.spin())
+                    continue;
+
+                uint32_t key = count_.prepare_wait();
+                if (ready())
+                    count_.cancel_wait();
+                else
+                    count_.wait(key);
+            }
+        }
+
+        void notify() { count_.notify_one(); }
+
+    private:
+        ParkWait(const ParkWait&);
+        ParkWait& operator=(const ParkWait&);
+
+        EventCount count_;
+    };
+
+
+    /*
+     * Bounded single-producer single-consumer queue.
+     *
+     * Only one thread may push and only one (other) thread may pop. Each side keeps
+     * a cached copy of the other side's index and re-reads the shared one only when
+     * the cached value says the queue is full/empty. push_bulk() and pop_bulk()
+     * move up to N items and publish the index once.
+     * Capacity must be a power of two.
+     */
+    template <typename T, typename WaitStrategy = YieldWait>
+    class SPSCQueue
+    {
+    public:
+        explicit SPSCQueue(size_t capacity)
+            : mask_(capacity - 1)
+            , slots_(new Slot[capacity])
+            , tail_(0)
+            , head_cache_(0)
+            , head_(0)
+            , tail_cache_(0)
+        {
+            assert(capacity >= 2 && (capacity & (capacity - 1)) == 0 && "Capacity must be a power of two");
+        }
+
+        ~SPSCQueue()
+        {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            for (; head != tail; ++head)
+                item_at(head)->~T();
+        }
+
+        // producer side
+
+        bool try_push(T&& item)
+        {
+            return push_bulk(&item, 1) == 1;
+        }
+
+        bool try_push(const T& item)
+        {
+            T copy(item);
+            return try_push(std::move(copy));
+        }
+
+        // moves as many of [items, items + count) as fit, returns number of moved items
+        template <typename It>
+        size_t push_bulk(It items, size_t count)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t space = capacity() - (tail - head_cache_);
+
+            if (space < count)
+            {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                space = capacity() - (tail - head_cache_);
+            }
+
+            size_t n = (count < space ? count : space);
+            if (n == 0)
+                return 0;
+
+            for (size_t i = 0; i < n; ++i, ++items)
+                new (item_at(tail + i)) T(std::move(*items));
+
+            tail_.store(tail + n, std::memory_order_release);
+            not_empty_.notify();
+            return n;
+        }
+
+        // blocks while queue is full
+        void push(T&& item)
+        {
+            while (!try_push(std::move(item)))
+                not_full_.wait([this]{ return size() < capacity(); });
+        }
+
+        void push(const T& item)
+        {
+            T copy(item);
+            push(std::move(copy));
+        }
+
+        // consumer side
+
+        bool try_pop(T& item)
+        {
+            return pop_bulk(&item, 1) == 1;
+        }
+
+        // moves up to max_count items to out, returns number of moved items
+        template <typename OutIt>
+        size_t pop_bulk(OutIt out, size_t max_count)
+        {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t available = tail_cache_ - head;
+
+            if (available < max_count)
+            {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                available = tail_cache_ - head;
+            }
+
+            size_t n = (max_count < available ? max_count : available);
+            if (n == 0)
+                return 0;
+
+            for (size_t i = 0; i < n; ++i, ++out)
+            {
+                T* stored = item_at(head + i);
+                *out = std::move(*stored);
+                stored->~T();
+            }
+
+            head_.store(head + n, std::memory_order_release);
+            not_full_.notify();
+            return n;
+        }
+
+        // blocks while queue is empty
+        T pop()
+        {
+            T item;
+            while (!try_pop(item))
+                not_empty_.wait([this]{ return size() > 0; });
+            return item;
+        }
+
+        // approximate when called concurrently
+        size_t size() const
+        {
+            return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+        }
+
+        bool empty() const { return size() == 0; }
+
+        size_t capacity() const { return mask_ + 1; }
+
+    private:
+        SPSCQueue(const SPSCQueue&);
+        SPSCQueue& operator=(const SPSCQueue&);
+
+        typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type Slot;
+
+        T* item_at(size_t index)
+        {
+            return reinterpret_cast<T*>(&slots_[index & mask_]);
+        }
+
+        const size_t mask_;
+        std::unique_ptr<Slot[]> slots_;
+
+        // producer's cache line
+        char pad0_[VT_CACHE_LINE_SIZE];
+        std::atomic<size_t> tail_;
+        size_t head_cache_;
+        WaitStrategy not_full_;
+        char pad1_[VT_CACHE_LINE_SIZE];
+
+        // consumer's cache line
+        std::atomic<size_t> head_;
+        size_t tail_cache_;
+        WaitStrategy not_empty_;
+        char pad2_[VT_CACHE_LINE_SIZE];
+    };
+}
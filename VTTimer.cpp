@@ -0,0 +1,139 @@
+#include "VTTimer.h"
+
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define VT_TIMER_HAS_TSC
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+        #include <x86intrin.h>
+    #endif
+#endif
+
+namespace
+{
+    struct TscCalibration
+    {
+        TscCalibration() : usable(false), mult(0) { }
+
+        bool usable;
+        uint64_t mult;  // ns per cycle in 32.32 fixed point
+    };
+
+#ifdef VT_TIMER_HAS_TSC
+
+    inline uint64_t read_tsc()
+    {
+        return __rdtsc();
+    }
+
+    // TSC ticks at a constant rate in all P/C-states and is synchronized between cores
+    bool has_invariant_tsc()
+    {
+        unsigned regs[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0x80000000);
+        if (static_cast<unsigned>(info[0]) < 0x80000007)
+            return false;
+        __cpuid(info, 0x80000007);
+        regs[3] = static_cast<unsigned>(info[3]);
+#else
+        if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+            return false;
+        __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+        return (regs[3] & (1u << 8)) != 0;
+    }
+
+    TscCalibration calibrate()
+    {
+        TscCalibration c;
+        if (!has_invariant_tsc())
+            return c;
+
+        int64_t ns_start = VT::d_::clock_ns(VT::Timer::TS_MonotonicRaw);
+        uint64_t tsc_start = read_tsc();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        int64_t ns = VT::d_::clock_ns(VT::Timer::TS_MonotonicRaw) - ns_start;
+        uint64_t cycles = read_tsc() - tsc_start;
+
+        if (ns <= 0 || cycles == 0)
+            return c;
+
+        c.mult = (static_cast<uint64_t>(ns) << 32) / cycles;
+        c.usable = (c.mult != 0);
+        return c;
+    }
+
+#else
+
+    inline uint64_t read_tsc()
+    {
+        return 0;
+    }
+
+    TscCalibration calibrate()
+    {
+        return TscCalibration();
+    }
+
+#endif
+
+    const TscCalibration& tsc()
+    {
+        static const TscCalibration calibration = calibrate();
+        return calibration;
+    }
+
+    // split in halves so that multiplication doesn't overflow for long intervals
+    inline int64_t cycles_to_ns(uint64_t cycles)
+    {
+        const uint64_t mult = tsc().mult;
+        return static_cast<int64_t>((cycles >> 32) * mult + (((cycles & 0xffffffffu) * mult) >> 32));
+    }
+}
+
+
+VT::Timer::Timer(bool start_, Source source)
+    : source_(source)
+    , counter_start_(0)
+{
+    if (source_ == TS_Tsc && !tsc_available())
+        source_ = TS_Monotonic;
+
+    if (start_)
+        start();
+}
+
+void VT::Timer::start()
+{
+    counter_start_ = read();
+}
+
+int64_t VT::Timer::time_elapsed_ns() const
+{
+    uint64_t elapsed = read() - counter_start_;
+    return source_ == TS_Tsc ? cycles_to_ns(elapsed) : static_cast<int64_t>(elapsed);
+}
+
+uint64_t VT::Timer::read() const
+{
+    return source_ == TS_Tsc ? read_tsc() : static_cast<uint64_t>(d_::clock_ns(source_));
+}
+
+int64_t VT::Timer::now_ns(Source source)
+{
+    if (source == TS_Tsc)
+        return tsc_available() ? cycles_to_ns(read_tsc()) : d_::clock_ns(TS_Monotonic);
+    return d_::clock_ns(source);
+}
+
+bool VT::Timer::tsc_available()
+{
+    return tsc().usable;
+}
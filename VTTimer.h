@@ -1,24 +1,85 @@
 #pragma once
 
+#include "VTHistogram.h"
+
 #include <chrono>
+#include <cstdint>
 
 namespace VT
 {
+    /*
+     * Stopwatch on a monotonic clock, never affected by wall clock changes.
+     *
+     * TS_Tsc reads the CPU cycle counter (a few ns per read, no syscall) and converts
+     * cycles to ns with a fixed-point multiplier calibrated once against TS_MonotonicRaw
+     * (the first TS_Tsc timer of the process pays ~10 ms for it). It is used only
+     * on x86 CPUs with invariant TSC, otherwise such timers run on TS_Monotonic.
+     */
     class Timer
     {
     public:
-        explicit Timer(bool start = true);
+        enum Source
+        {
+            TS_Monotonic,       // CLOCK_MONOTONIC / QueryPerformanceCounter
+            TS_MonotonicRaw,    // CLOCK_MONOTONIC_RAW, not slewed by NTP (same as TS_Monotonic on Windows)
+            TS_Tsc              // calibrated rdtsc
+        };
+
+        explicit Timer(bool start = true, Source source = TS_Monotonic);
         void start();
-        double time_elapsed_s() const;
+
+        // source actually used (TS_Tsc may fall back to TS_Monotonic)
+        Source source() const { return source_; }
+
+        int64_t time_elapsed_ns() const;
+        int64_t time_elapsed_us() const { return time_elapsed_ns() / 1000; }
+        double time_elapsed_s() const { return time_elapsed_ns() / 1.0e9; }
+
         std::chrono::milliseconds time_elapsed() const
         {
-            return std::chrono::milliseconds(static_cast<int64_t>(time_elapsed_s() * 1000));
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(time_elapsed_ns()));
+        }
+
+        // nanoseconds since an arbitrary point, comparable only within one source
+        static int64_t now_ns(Source source = TS_Monotonic);
+
+        static bool tsc_available();
+
+    private:
+        uint64_t read() const;
+
+        Source source_;
+        uint64_t counter_start_;  // ns, or cycles for TS_Tsc
+    };
+
+
+    // records the lifetime of the scope in nanoseconds:
+    //   { VT::ScopedTimer t(parse_latency); parse(); }
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram& histogram, Timer::Source source = Timer::TS_Tsc)
+            : histogram_(histogram)
+            , timer_(true, source)
+        { }
+
+        ~ScopedTimer()
+        {
+            int64_t ns = timer_.time_elapsed_ns();
+            histogram_.record(static_cast<uint64_t>(ns > 0 ? ns : 0));
         }
 
     private:
-#ifdef _MSC_VER
-        double              PCFreq_;
-#endif
-        unsigned long long  counter_start_;
+        ScopedTimer(const ScopedTimer&);
+        ScopedTimer& operator=(const ScopedTimer&);
+
+        Histogram& histogram_;
+        Timer timer_;
     };
+
+    namespace d_
+    {
+        // platform clock in ns, TS_Tsc is not accepted here
+        int64_t clock_ns(Timer::Source source);
+    }
 }
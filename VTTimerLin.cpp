@@ -4,38 +4,28 @@
 #include <sstream>
 #include <assert.h>
 
-#include <sys/time.h>
+#include <time.h>
 
-unsigned long long get_ms_since_epoch()
+int64_t VT::d_::clock_ns(Timer::Source source)
 {
-    timeval t;
-    int ret = gettimeofday(&t, NULL);
-    
-    assert(ret == 0 && "gettimeofday returned error");
+    assert(source != Timer::TS_Tsc);
+
+#ifdef CLOCK_MONOTONIC_RAW
+    clockid_t id = (source == Timer::TS_MonotonicRaw ? CLOCK_MONOTONIC_RAW : CLOCK_MONOTONIC);
+#else
+    clockid_t id = CLOCK_MONOTONIC;
+#endif
+
+    timespec t;
+    int ret = clock_gettime(id, &t);
+
+    assert(ret == 0 && "clock_gettime returned error");
     if (ret != 0)
     {
         std::stringstream err;
-        err << "gettimeofday returned error " << ret;
+        err << "clock_gettime returned error " << ret;
         throw std::runtime_error(err.str());
     }
-    
-    return t.tv_sec * 1000000LL + t.tv_usec;
-}
 
-VT::Timer::Timer(bool start_) :
-    counter_start_(0)
-{
-    if (start_)
-        start();
-}
-
-void VT::Timer::start()
-{
-    counter_start_ = get_ms_since_epoch();
-}
-
-double VT::Timer::time_elapsed_s() const
-{
-    unsigned long long current_time = get_ms_since_epoch();
-    return (current_time - counter_start_) / 1.0e6;
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
 }
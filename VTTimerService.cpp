@@ -0,0 +1,485 @@
+#include "VTTimerService.h"
+#include "VTThreadAffinity.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    const unsigned kLevelBits = 8;
+    const size_t kLevels = 4;
+    const size_t kSlots = size_t(1) << kLevelBits;
+    const uint64_t kSlotMask = kSlots - 1;
+    const uint64_t kWheelSpan = uint64_t(1) << (kLevels * kLevelBits);  // ticks covered by the top level
+    const uint64_t kNoWake = std::numeric_limits<uint64_t>::max();
+}
+
+
+struct VT::TimerService::Impl
+{
+    typedef std::chrono::steady_clock clock;
+
+    struct Timer
+    {
+        Timer(TimerId id, ThreadPool::Task&& callback, const TaskOptions& options, TimerMode mode, uint64_t interval)
+            : id(id)
+            , callback(std::move(callback))
+            , options(options)
+            , mode(mode)
+            , interval(interval)
+            , expiry(0)
+            , prev(nullptr)
+            , next(nullptr)
+            , slot(nullptr)
+            , cancelled(false)
+            , fired(false)
+            , running(false)
+        { }
+
+        const TimerId id;
+        ThreadPool::Task callback;
+        const TaskOptions options;
+        const TimerMode mode;
+        const uint64_t interval;    // ticks
+        uint64_t expiry;            // absolute tick
+
+        // slot list, linked while the timer waits in the wheel
+        Timer* prev;
+        Timer* next;
+        Timer** slot;
+
+        bool cancelled;
+        bool fired;                 // one-shot callback has started
+        bool running;
+        std::thread::id runner;
+    };
+
+    typedef std::shared_ptr<Timer> TimerPtr;
+
+    // posted to the pool, finishes the timer even if the pool drops it without running
+    struct FireTask
+    {
+        FireTask(Impl* owner, const TimerPtr& timer) : owner(owner), timer(timer) { }
+        FireTask(FireTask&& other) noexcept : owner(other.owner), timer(std::move(other.timer)) { }
+
+        ~FireTask()
+        {
+            if (timer)
+                owner->finish(*timer);
+        }
+
+        void operator()()
+        {
+            owner->fire(*timer);
+            timer.reset();
+        }
+
+        Impl* owner;
+        TimerPtr timer;
+    };
+
+    // stored in place by ThreadPool::Task, no allocation per fired timer
+    static_assert(std::is_nothrow_move_constructible<FireTask>::value, "FireTask move must be noexcept");
+
+    Impl(ThreadPool& pool, int tick_ms)
+        : pool_(pool)
+        , tick_(std::chrono::milliseconds(tick_ms))
+        , start_(clock::now())
+        , now_(0)
+        , next_wake_(kNoWake)
+        , next_id_(1)
+        , armed_(0)
+        , in_flight_(0)
+        , stop_(false)
+    {
+        assert(tick_ms > 0);
+
+        for (size_t level = 0; level < kLevels; ++level)
+        {
+            for (size_t slot = 0; slot < kSlots; ++slot)
+                wheel_[level][slot] = nullptr;
+        }
+
+        thread_ = std::thread([this]{ loop(); });
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+
+        std::unique_lock<std::mutex> l(lock_);
+        for (auto& it : timers_)
+        {
+            it.second->cancelled = true;
+            if (it.second->slot)
+                unlink(*it.second);
+        }
+        timers_.clear();
+
+        finished_.wait(l, [this]{ return in_flight_ == 0; });
+    }
+
+    // first tick at or after [delay_ms] from now
+    uint64_t tick_after(int delay_ms) const
+    {
+        clock::duration since_start = clock::now() - start_ + std::chrono::milliseconds(delay_ms > 0 ? delay_ms : 0);
+        return static_cast<uint64_t>((since_start + tick_ - clock::duration(1)) / tick_);
+    }
+
+    uint64_t current_tick() const
+    {
+        return static_cast<uint64_t>((clock::now() - start_) / tick_);
+    }
+
+    uint64_t to_ticks(int ms) const
+    {
+        uint64_t ticks = static_cast<uint64_t>((std::chrono::milliseconds(ms) + tick_ - clock::duration(1)) / tick_);
+        return ticks ? ticks : 1;
+    }
+
+    TimerId add(ThreadPool::Task&& callback, const TaskOptions& options, TimerMode mode, int interval_ms, int delay_ms)
+    {
+        std::lock_guard<std::mutex> l(lock_);
+
+        TimerPtr timer = std::make_shared<Timer>(next_id_++, std::move(callback), options, mode,
+                                                 mode == TM_OneShot ? 0 : to_ticks(interval_ms));
+        timer->expiry = tick_after(delay_ms);
+        timers_[timer->id] = timer;
+        skip_idle_ticks();
+        arm(*timer);
+        return timer->id;
+    }
+
+    bool cancel(TimerId id, bool wait)
+    {
+        std::unique_lock<std::mutex> l(lock_);
+
+        auto it = timers_.find(id);
+        if (it == timers_.end())
+            return false;
+
+        TimerPtr timer = it->second;
+        timers_.erase(it);
+
+        timer->cancelled = true;
+        if (timer->slot)
+            unlink(*timer);
+
+        if (wait && timer->running && timer->runner != std::this_thread::get_id())
+            finished_.wait(l, [&]{ return !timer->running; });
+
+        return timer->mode != TM_OneShot || !timer->fired;
+    }
+
+    size_t timer_count() const
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        return timers_.size();
+    }
+
+    /*
+     * Wheel.
+     *
+     * Level L slot s holds timers with (expiry >> 8L) % 256 == s that are due within 256^(L+1)
+     * ticks of now_. When the low 8L bits of now_ become zero, the current slot of level L is
+     * cascaded: its timers are re-inserted and land in lower levels. Timers farther than the
+     * wheel span wait in the top level and are re-inserted until they come within reach.
+     */
+
+    // an empty wheel has nothing to cascade: ticks that passed while it was empty are not
+    // replayed by loop() and new timers are placed relative to the current tick
+    void skip_idle_ticks()
+    {
+        if (armed_ == 0)
+        {
+            const uint64_t current = current_tick();
+            if (now_ < current)
+                now_ = current;
+        }
+    }
+
+    void arm(Timer& timer)
+    {
+        if (timer.expiry < now_)
+            timer.expiry = now_;
+
+        uint64_t delta = timer.expiry - now_;
+        uint64_t at = (delta < kWheelSpan ? timer.expiry : now_ + kWheelSpan - 1);
+
+        size_t level = 0;
+        while (level + 1 < kLevels && (at - now_) >= (uint64_t(1) << ((level + 1) * kLevelBits)))
+            ++level;
+
+        Timer** slot = &wheel_[level][(at >> (level * kLevelBits)) & kSlotMask];
+        timer.prev = nullptr;
+        timer.next = *slot;
+        if (*slot)
+            (*slot)->prev = &timer;
+        *slot = &timer;
+        timer.slot = slot;
+        ++armed_;
+
+        if (timer.expiry < next_wake_)
+            wake_.notify_one();
+    }
+
+    void unlink(Timer& timer)
+    {
+        if (timer.prev)
+            timer.prev->next = timer.next;
+        else
+            *timer.slot = timer.next;
+
+        if (timer.next)
+            timer.next->prev = timer.prev;
+
+        timer.prev = timer.next = nullptr;
+        timer.slot = nullptr;
+        --armed_;
+    }
+
+    // processes tick now_, expired timers are appended to [due]
+    void advance(std::vector<TimerPtr>& due)
+    {
+        for (size_t level = 1; level < kLevels; ++level)
+        {
+            if ((now_ & ((uint64_t(1) << (level * kLevelBits)) - 1)) != 0)
+                break;
+
+            Timer** slot = &wheel_[level][(now_ >> (level * kLevelBits)) & kSlotMask];
+            while (Timer* timer = *slot)
+            {
+                unlink(*timer);
+                cascaded_.push_back(timer);
+            }
+            for (Timer* timer : cascaded_)
+                arm(*timer);
+            cascaded_.clear();
+        }
+
+        Timer** slot = &wheel_[0][now_ & kSlotMask];
+        while (Timer* timer = *slot)
+        {
+            unlink(*timer);
+            timer->running = true;  // until finish(), cancel(id, true) waits for it
+            ++in_flight_;
+            due.push_back(timers_[timer->id]);
+        }
+    }
+
+    // next tick worth waking up for: a non-empty level 0 slot or the next cascade
+    uint64_t next_wake_tick() const
+    {
+        uint64_t boundary = (now_ + kSlotMask) & ~kSlotMask;
+        for (uint64_t tick = now_; tick < boundary; ++tick)
+        {
+            if (wheel_[0][tick & kSlotMask])
+                return tick;
+        }
+        return boundary;
+    }
+
+    void loop()
+    {
+        set_current_thread_name("vt-timer");
+
+        std::vector<TimerPtr> due;
+        std::unique_lock<std::mutex> l(lock_);
+
+        while (!stop_)
+        {
+            const uint64_t current = current_tick();
+
+            if (armed_ == 0 && now_ <= current)
+                now_ = current + 1;  // nothing to cascade, skip ahead
+
+            while (now_ <= current)
+            {
+                advance(due);
+                ++now_;
+            }
+
+            if (!due.empty())
+            {
+                l.unlock();
+                for (const TimerPtr& timer : due)
+                    dispatch(timer);
+                due.clear();
+                l.lock();
+                continue;
+            }
+
+            if (armed_ == 0)
+            {
+                next_wake_ = kNoWake;
+                wake_.wait(l);
+            }
+            else
+            {
+                next_wake_ = next_wake_tick();
+                wake_.wait_until(l, start_ + tick_ * next_wake_);
+            }
+            next_wake_ = 0;  // awake, new timers need no notification
+        }
+    }
+
+    void dispatch(const TimerPtr& timer)
+    {
+        // the token is checked by fire(), a task dropped by the pool would only be finished
+        TaskOptions options = timer->options;
+        options.cancel = nullptr;
+
+        try
+        {
+            pool_.post(ThreadPool::Task(FireTask(this, timer)), options);
+        }
+        catch (const std::exception& ex)
+        {
+            // rejected by a full queue: this run is lost, FireTask re-arms periodic timers
+            std::cerr << "VT::TimerService can't dispatch timer: " << ex.what() << std::endl;
+        }
+    }
+
+    void fire(Timer& timer)
+    {
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            if (timer.cancelled || timer.options.cancel.is_cancelled())
+            {
+                finish_locked(timer);
+                return;
+            }
+            timer.fired = true;
+            timer.runner = std::this_thread::get_id();
+        }
+
+        try
+        {
+            timer.callback();
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << "Exception in VT::TimerService callback: " << ex.what() << std::endl;
+        }
+        catch (...)
+        {
+            std::cerr << "Uknown error in VT::TimerService callback." << std::endl;
+        }
+
+        finish(timer);
+    }
+
+    void finish(Timer& timer)
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        finish_locked(timer);
+    }
+
+    // re-arms periodic timer or forgets it
+    void finish_locked(Timer& timer)
+    {
+        timer.running = false;
+        timer.runner = std::thread::id();
+        --in_flight_;
+
+        if (timer.cancelled)
+        {
+            // already removed by cancel()
+        }
+        else if (timer.mode == TM_OneShot || timer.options.cancel.is_cancelled() || stop_)
+        {
+            timers_.erase(timer.id);
+        }
+        else
+        {
+            const uint64_t current = current_tick();
+
+            if (timer.mode == TM_FixedDelay)
+            {
+                timer.expiry = current + timer.interval;
+            }
+            else
+            {
+                uint64_t missed = (current >= timer.expiry ? (current - timer.expiry) / timer.interval : 0);
+                timer.expiry += (missed + 1) * timer.interval;
+            }
+            skip_idle_ticks();
+            arm(timer);
+        }
+
+        finished_.notify_all();
+    }
+
+    ThreadPool& pool_;
+    const clock::duration tick_;
+    const clock::time_point start_;
+
+    mutable std::mutex lock_;
+    std::condition_variable wake_;      // timer thread
+    std::condition_variable finished_;  // cancel(id, true) and destructor
+
+    Timer* wheel_[kLevels][kSlots];
+    std::vector<Timer*> cascaded_;
+    uint64_t now_;          // next tick to process
+    uint64_t next_wake_;    // tick the timer thread sleeps until, 0 while it is awake
+
+    std::unordered_map<TimerId, TimerPtr> timers_;
+    TimerId next_id_;
+    size_t armed_;
+    size_t in_flight_;      // dispatched and not finished
+    bool stop_;
+
+    std::thread thread_;
+};
+
+
+VT::TimerService::TimerService(ThreadPool& pool, int tick_ms)
+    : d(new Impl(pool, tick_ms))
+{
+}
+
+VT::TimerService::~TimerService()
+{
+    delete d;
+}
+
+VT::TimerService::TimerId VT::TimerService::schedule_once(int delay_ms, ThreadPool::Task callback, const TaskOptions& options)
+{
+    assert(callback);
+    return d->add(std::move(callback), options, TM_OneShot, 0, delay_ms);
+}
+
+VT::TimerService::TimerId VT::TimerService::schedule_periodic(int interval_ms, ThreadPool::Task callback, TimerMode mode,
+                                                              int initial_delay_ms, const TaskOptions& options)
+{
+    assert(callback);
+    assert(interval_ms > 0 && mode != TM_OneShot);
+    return d->add(std::move(callback), options, mode, interval_ms, initial_delay_ms == -1 ? interval_ms : initial_delay_ms);
+}
+
+bool VT::TimerService::cancel(TimerId id, bool wait)
+{
+    return d->cancel(id, wait);
+}
+
+size_t VT::TimerService::timer_count() const
+{
+    return d->timer_count();
+}
+
+VT::TimerService& VT::TimerService::instance()
+{
+    static TimerService service(ThreadPoolSingleton::instance());
+    return service;
+}
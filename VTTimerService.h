@@ -0,0 +1,64 @@
+#pragma once
+
+#include "VTThreadPool.h"
+
+#include <cstdint>
+
+/*
+ * Shared timer service: one thread drives a hierarchical timing wheel,
+ * expired timers are dispatched to a ThreadPool.
+ *
+ * The wheel has 4 levels of 256 slots, level L holds timers due within 256^(L+1) ticks
+ * and is cascaded into the lower levels as time advances, so scheduling and
+ * cancellation are O(1) whatever the number of timers. The thread sleeps until the
+ * next non-empty slot (at most 256 ticks while there are timers, forever when there are none).
+ *
+ * A timer never runs concurrently with itself: periodic timers are re-armed
+ * when the callback returns (or throws).
+ */
+
+namespace VT
+{
+    enum TimerMode
+    {
+        TM_OneShot,
+        TM_FixedRate,   // runs at start + k * interval, periods missed by a long callback are skipped
+        TM_FixedDelay   // next run is interval after the previous one finished
+    };
+
+    class TimerService
+    {
+    public:
+        typedef uint64_t TimerId;  // 0 is never used
+
+        // [pool] must outlive the service, tick_ms is the timer resolution
+        explicit TimerService(ThreadPool& pool, int tick_ms = 1);
+
+        // cancels all timers and waits for running callbacks
+        ~TimerService();
+
+        // callback is posted to the pool with [options] once delay_ms elapses
+        TimerId schedule_once(int delay_ms, ThreadPool::Task callback, const TaskOptions& options = TaskOptions());
+
+        // first run after initial_delay_ms (-1: after interval_ms)
+        TimerId schedule_periodic(int interval_ms, ThreadPool::Task callback, TimerMode mode = TM_FixedRate,
+                                  int initial_delay_ms = -1, const TaskOptions& options = TaskOptions());
+
+        // returns false if the timer already fired (one-shot) or was cancelled;
+        // with [wait], also waits for the callback to return if it is running right now
+        // (unless called from that callback)
+        bool cancel(TimerId id, bool wait = false);
+
+        size_t timer_count() const;
+
+        // service on ThreadPoolSingleton, used by VT::Executer
+        static TimerService& instance();
+
+    private:
+        TimerService(const TimerService&);
+        TimerService& operator=(const TimerService&);
+
+        struct Impl;
+        Impl* d;
+    };
+}
@@ -9,42 +9,39 @@
 
 #include <windows.h>
 
-unsigned long long query_performance_counter()
+namespace
 {
-    LARGE_INTEGER li;
-    if (!QueryPerformanceCounter(&li))
+    int64_t query_performance_frequency()
     {
-        std::stringstream err;
-        err << "Couldn't get timer info: QueryPerformanceCounter failed with error " << GetLastError();
-        throw std::runtime_error(err.str());
+        LARGE_INTEGER li;
+        if (!QueryPerformanceFrequency(&li))
+        {
+            std::stringstream err;
+            err << "Couldn't init timer frequency: QueryPerformanceFrequency failed with error " << GetLastError();
+            throw std::runtime_error(err.str());
+        }
+        return li.QuadPart;
     }
-    return li.QuadPart;
-}
 
-VT::Timer::Timer(bool start_) : 
-    PCFreq_(0.0),
-    counter_start_(0)
-{
-    LARGE_INTEGER li;
-    if (!QueryPerformanceFrequency(&li))
+    int64_t query_performance_counter()
     {
-        std::stringstream err;
-        err << "Couldn't init timer frequency: QueryPerformanceFrequency failed with error " << GetLastError();
-        throw std::runtime_error(err.str());
+        LARGE_INTEGER li;
+        if (!QueryPerformanceCounter(&li))
+        {
+            std::stringstream err;
+            err << "Couldn't get timer info: QueryPerformanceCounter failed with error " << GetLastError();
+            throw std::runtime_error(err.str());
+        }
+        return li.QuadPart;
     }
-    PCFreq_ = double(li.QuadPart);
-
-    if (start_)
-        start();
 }
 
-void VT::Timer::start()
+// QueryPerformanceCounter is not slewed, so both monotonic sources are the same here
+int64_t VT::d_::clock_ns(Timer::Source)
 {
-    counter_start_ = query_performance_counter();
-}
+    static const int64_t frequency = query_performance_frequency();
 
-double VT::Timer::time_elapsed_s() const
-{
-    unsigned long long current_time = query_performance_counter();
-    return double(current_time - counter_start_) / PCFreq_;
+    // integer only, split to keep counter * 10^9 from overflowing
+    int64_t counter = query_performance_counter();
+    return (counter / frequency) * 1000000000LL + (counter % frequency) * 1000000000LL / frequency;
 }
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <assert.h>
+
+/*
+ * Move-only replacement for std::function.
+ *
+ *  * accepts move-only callables (lambdas owning a std::promise, unique_ptr, etc.)
+ *  * callables up to InlineSize bytes that are nothrow movable are stored in place,
+ *    bigger ones are allocated on the heap
+ *  * never copies the stored callable
+ */
+
+namespace VT
+{
+    template <typename Signature>
+    class UniqueFunction;
+
+    template <typename R, typename... Args>
+    class UniqueFunction<R(Args...)>
+    {
+    public:
+        static const size_t InlineSize = 64;
+
+        UniqueFunction()
+            : ops_(nullptr)
+        { }
+
+        UniqueFunction(std::nullptr_t)
+            : ops_(nullptr)
+        { }
+
+        template <typename F,
+                  typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, UniqueFunction>::value>::type>
+        UniqueFunction(F&& f)
+            : ops_(nullptr)
+        {
+            typedef typename std::decay<F>::type Fn;
+            typedef typename std::conditional<fits_inline<Fn>::value, Inline<Fn>, Heap<Fn>>::type Manager;
+
+            Manager::create(&storage_, std::forward<F>(f));
+            ops_ = &Manager::ops;
+        }
+
+        UniqueFunction(UniqueFunction&& other)
+            : ops_(other.ops_)
+        {
+            if (ops_)
+            {
+                ops_->move(&other.storage_, &storage_);
+                other.ops_ = nullptr;
+            }
+        }
+
+        UniqueFunction& operator=(UniqueFunction&& rhs)
+        {
+            if (this != &rhs)
+            {
+                reset();
+                if (rhs.ops_)
+                {
+                    rhs.ops_->move(&rhs.storage_, &storage_);
+                    ops_ = rhs.ops_;
+                    rhs.ops_ = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        UniqueFunction& operator=(std::nullptr_t)
+        {
+            reset();
+            return *this;
+        }
+
+        ~UniqueFunction()
+        {
+            reset();
+        }
+
+        R operator()(Args... args)
+        {
+            assert(ops_ && "Calling empty VT::UniqueFunction");
+            return ops_->invoke(&storage_, std::forward<Args>(args)...);
+        }
+
+        explicit operator bool() const { return ops_ != nullptr; }
+
+        void swap(UniqueFunction& other)
+        {
+            UniqueFunction tmp(std::move(other));
+            other = std::move(*this);
+            *this = std::move(tmp);
+        }
+
+    private:
+        UniqueFunction(const UniqueFunction&);
+        UniqueFunction& operator=(const UniqueFunction&);
+
+        typedef typename std::aligned_storage<InlineSize, std::alignment_of<std::max_align_t>::value>::type Storage;
+
+        struct Ops
+        {
+            R (*invoke)(void* storage, Args&&... args);
+            void (*move)(void* from, void* to);  // leaves [from] destroyed
+            void (*destroy)(void* storage);
+        };
+
+        template <typename Fn>
+        struct fits_inline
+            : std::integral_constant<bool, sizeof(Fn) <= InlineSize &&
+                                           std::alignment_of<Storage>::value % std::alignment_of<Fn>::value == 0 &&
+                                           std::is_nothrow_move_constructible<Fn>::value>
+        { };
+
+        template <typename Fn>
+        struct Inline
+        {
+            template <typename F>
+            static void create(void* storage, F&& f)
+            {
+                new (storage) Fn(std::forward<F>(f));
+            }
+
+            static R invoke(void* storage, Args&&... args)
+            {
+                return (*static_cast<Fn*>(storage))(std::forward<Args>(args)...);
+            }
+
+            static void move(void* from, void* to)
+            {
+                Fn* src = static_cast<Fn*>(from);
+                new (to) Fn(std::move(*src));
+                src->~Fn();
+            }
+
+            static void destroy(void* storage)
+            {
+                static_cast<Fn*>(storage)->~Fn();
+            }
+
+            static const Ops ops;
+        };
+
+        template <typename Fn>
+        struct Heap
+        {
+            template <typename F>
+            static void create(void* storage, F&& f)
+            {
+                *static_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+            }
+
+            static R invoke(void* storage, Args&&... args)
+            {
+                return (**static_cast<Fn**>(storage))(std::forward<Args>(args)...);
+            }
+
+            static void move(void* from, void* to)
+            {
+                *static_cast<Fn**>(to) = *static_cast<Fn**>(from);
+            }
+
+            static void destroy(void* storage)
+            {
+                delete *static_cast<Fn**>(storage);
+            }
+
+            static const Ops ops;
+        };
+
+        void reset()
+        {
+            if (ops_)
+            {
+                ops_->destroy(&storage_);
+                ops_ = nullptr;
+            }
+        }
+
+        Storage storage_;
+        const Ops* ops_;
+    };
+
+
+    template <typename R, typename... Args>
+    template <typename Fn>
+    const typename UniqueFunction<R(Args...)>::Ops UniqueFunction<R(Args...)>::Inline<Fn>::ops =
+    {
+        &UniqueFunction<R(Args...)>::Inline<Fn>::invoke,
+        &UniqueFunction<R(Args...)>::Inline<Fn>::move,
+        &UniqueFunction<R(Args...)>::Inline<Fn>::destroy
+    };
+
+    template <typename R, typename... Args>
+    template <typename Fn>
+    const typename UniqueFunction<R(Args...)>::Ops UniqueFunction<R(Args...)>::Heap<Fn>::ops =
+    {
+        &UniqueFunction<R(Args...)>::Heap<Fn>::invoke,
+        &UniqueFunction<R(Args...)>::Heap<Fn>::move,
+        &UniqueFunction<R(Args...)>::Heap<Fn>::destroy
+    };
+}
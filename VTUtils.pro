@@ -53,5 +53,5 @@ unix {
     HEADERS -= NtService.h
 }
 
-win32-msvc*: LIBS += -lShell32 -ldbghelp
+win32-msvc*: LIBS += -lShell32 -ldbghelp -lSynchronization
 unix : LIBS += -ldl -pthread
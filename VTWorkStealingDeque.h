@@ -0,0 +1,161 @@
+#pragma once
+
+#include "VTCompilerSpecific.h"
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <assert.h>
+
+/*
+ * Chase-Lev work stealing deque
+ * (D. Chase, Y. Lev "Dynamic Circular Work-Stealing Deque", memory orderings
+ * as in N. M. Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models").
+ *
+ *  * push() and pop() may be called only by the owner thread and work on the bottom end (LIFO)
+ *  * steal() may be called by any thread and takes from the top end (FIFO)
+ *  * T must be trivially copyable (usually a pointer), empty results are returned as T()
+ *
+ * Buffer grows when full. Old buffers are kept until deque is destroyed,
+ * because concurrent thieves may still be reading from them.
+ */
+
+namespace VT
+{
+    template <typename T>
+    class WorkStealingDeque
+    {
+    public:
+        explicit WorkStealingDeque(size_t capacity = 256)
+            : top_(0)
+            , bottom_(0)
+            , array_(nullptr)
+        {
+            assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "Capacity must be a power of two");
+            garbage_.push_back(std::unique_ptr<Array>(new Array(capacity)));
+            array_.store(garbage_.back().get(), std::memory_order_relaxed);
+        }
+
+        // owner only
+        void push(T item)
+        {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_acquire);
+            Array* a = array_.load(std::memory_order_relaxed);
+
+            if (b - t > static_cast<int64_t>(a->mask))
+                a = grow(a, t, b);
+
+            a->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // owner only, returns T() when empty
+        T pop()
+        {
+            int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+            Array* a = array_.load(std::memory_order_relaxed);
+            bottom_.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top_.load(std::memory_order_relaxed);
+
+            if (t > b)  // empty
+            {
+                bottom_.store(b + 1, std::memory_order_relaxed);
+                return T();
+            }
+
+            T item = a->get(b);
+
+            if (t == b)  // last element, race with thieves
+            {
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = T();
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+
+            return item;
+        }
+
+        // any thread, returns T() when empty or when lost a race with another thief
+        T steal()
+        {
+            int64_t t = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom_.load(std::memory_order_acquire);
+
+            if (t >= b)
+                return T();
+
+            Array* a = array_.load(std::memory_order_acquire);
+            T item = a->get(t);
+
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return T();
+
+            return item;
+        }
+
+        // approximate when called concurrently
+        bool empty() const
+        {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+
+        size_t size() const
+        {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_relaxed);
+            return b > t ? static_cast<size_t>(b - t) : 0;
+        }
+
+    private:
+        WorkStealingDeque(const WorkStealingDeque&);
+        WorkStealingDeque& operator=(const WorkStealingDeque&);
+
+        struct Array
+        {
+            explicit Array(size_t capacity)
+                : mask(capacity - 1)
+                , items(new std::atomic<T>[capacity])
+            { }
+
+            T get(int64_t i) const
+            {
+                return items[static_cast<size_t>(i) & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t i, T item)
+            {
+                items[static_cast<size_t>(i) & mask].store(item, std::memory_order_relaxed);
+            }
+
+            size_t mask;
+            std::unique_ptr<std::atomic<T>[]> items;
+        };
+
+        Array* grow(Array* a, int64_t t, int64_t b)
+        {
+            std::unique_ptr<Array> bigger(new Array((a->mask + 1) * 2));
+            for (int64_t i = t; i < b; ++i)
+                bigger->put(i, a->get(i));
+
+            Array* result = bigger.get();
+            garbage_.push_back(std::move(bigger));
+            array_.store(result, std::memory_order_release);
+            return result;
+        }
+
+        // top_ is written by thieves and bottom_ by the owner, keep them on separate cache lines
+        std::atomic<int64_t> top_;
+        char pad0_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> bottom_;
+        char pad1_[VT_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+        std::atomic<Array*> array_;
+        std::vector<std::unique_ptr<Array>> garbage_;  // owner only
+    };
+}
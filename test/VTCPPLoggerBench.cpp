@@ -0,0 +1,122 @@
+// Microbenchmark of the << message path: the LogWorker with thread-local buffers
+// against the previous ostringstream based worker.
+//
+// Both write the same line to the null device through fprintf + fflush, so the
+// difference is the cost of building the message. Heap allocations are counted
+// with a replaced global operator new.
+//
+// Build: g++ -O2 -std=c++11 -pthread VTCPPLoggerBench.cpp ../VTCPPLogger.cpp ../VTCPPLoggerAsync.cpp
+//        ../VTSafeSprintf.cpp ../VTRotatingFile.cpp ../VTRotatingFileLin.cpp ../VTThreadAffinityLin.cpp
+//        ../VTFutexLin.cpp ../VTUtil.cpp ../VTUtilLin.cpp ../VTStringUtil.cpp ../VTEncodeConvertLin.cpp
+
+#include "../VTCPPLogger.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+    #define NULL_DEVICE "NUL"
+#else
+    #define NULL_DEVICE "/dev/null"
+#endif
+
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+
+namespace
+{
+    const int kMessages = 1000000;
+
+    // what the worker did before: stream per message, copy of the text for the epilog
+    void legacy_message(std::FILE* out, int i, double d, const std::string& s)
+    {
+        std::ostringstream stream;
+        stream << std::string("<Info> ");
+        stream << "request" << " ";
+        stream << i << " ";
+        stream << "took" << " ";
+        stream << d << " ";
+        stream << "ms for" << " ";
+        stream << s << " ";
+
+        std::string text(stream.str());
+        text.push_back('\n');
+        std::fprintf(out, "%s", text.c_str());
+        std::fflush(out);
+    }
+
+    template <typename F>
+    void run(const char* name, F message)
+    {
+        const std::string user = "user@example.com";
+
+        message(0, 0.0, user);  // warm-up, the thread buffer is allocated here
+
+        const size_t allocations_before = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < kMessages; ++i)
+            message(i, i * 0.25, user);
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const size_t count = allocations.load() - allocations_before;
+
+        std::printf("%-10s %8.1f ns/message %8.2f allocations/message\n", name,
+                    std::chrono::duration<double, std::nano>(elapsed).count() / kMessages,
+                    static_cast<double>(count) / kMessages);
+    }
+}
+
+
+int main()
+{
+    std::FILE* legacy_out = std::fopen(NULL_DEVICE, "w");
+    std::FILE* worker_out = std::fopen(NULL_DEVICE, "w");
+    if (!legacy_out || !worker_out)
+    {
+        std::fprintf(stderr, "Can't open %s\n", NULL_DEVICE);
+        return 1;
+    }
+
+    VT::Logger log("bench");
+    log.set(VT::LO_NoTimestamp);
+    log.set(VT::LO_NoThreadId);
+    log.set(VT::LO_NoLoggerName);
+    log.set_stream(worker_out, VT::LL_Info);  // closed by the logger
+
+    run("legacy", [&](int i, double d, const std::string& s) {
+        legacy_message(legacy_out, i, d, s);
+    });
+
+    run("worker", [&](int i, double d, const std::string& s) {
+        log.info() << "request" << i << "took" << d << "ms for" << s;
+    });
+
+    std::fclose(legacy_out);
+    return 0;
+}
@@ -1,11 +1,34 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 
-#include "../VTEvent.h"
+#include "../VTEvent.hpp"
 #include "../VTStringUtil.h"
+#include "../VTSafeSprintf.h"
 #include "../VTThreadPool.h"
+#include "../VTParallel.h"
+#include "../VTTaskGraph.h"
+#include "../VTThreadAffinity.h"
+#include "../VTHistogram.h"
+#include "../VTCoroutine.h"
+#include "../VTTimerService.h"
+#include "../VTExecuter.h"
+#include "../VTTimer.h"
+#include "../VTThreadSafeQueue.h"
+#include "../VTCPPLoggerBinary.h"
 
 #include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <iomanip>
+#include <limits>
+#include <sstream>
 
 
 TEST_CASE("VTUtils/VTEvent/constructor", "Should construct not signaled event")
@@ -47,6 +70,22 @@ TEST_CASE("VTUtils/VTEvent/timeouts", "Verious timeouts")
 }
 
 
+TEST_CASE("VTUtils/VTEvent/auto_reset", "Auto reset event releases one waiter per signal")
+{
+    VT::Event event(false);
+    event.signal();
+    REQUIRE(event.is_signaled() == true);
+    REQUIRE(event.wait(0) == true);
+    REQUIRE(event.is_signaled() == false);
+    REQUIRE(event.wait(1) == false);
+
+    std::thread waiter([&event]{ event.wait(); });
+    event.signal();
+    waiter.join();
+    REQUIRE(event.is_signaled() == false);
+}
+
+
 TEST_CASE("VTUtils/VTStringUtils/trim", "")
 {
     CHECK(VT::StrUtils::trim("  Bus     ") == "Bus");
@@ -86,6 +125,28 @@ TEST_CASE("VTUtils/VTStringUtils/symbols", "Numbers and symbols")
 }
 
 
+TEST_CASE("VTUtils/VTSafeSprintf/format", "Anchors by index, hex specs, literal text and runtime errors")
+{
+    const std::string name = "eth0";
+    REQUIRE(VT::safe_sprintf_ret("{1} {0} {1}", -42, name) == "eth0 -42 eth0");
+    REQUIRE(VT::safe_sprintf_ret("{0:x}/{1:X}/{2}", 255, 4096u, 2.5) == "ff/1000/2.5");
+    REQUIRE(VT::safe_sprintf_ret("{{0}} }{0}", "literal") == "{{0}} }literal");
+    REQUIRE(VT::safe_sprintf_ret("{0}{1}{0}{1}{0}{1}{0}{1}{0}{1}{0}{1}{0}{1}{0}{1}{0}{1}", 1, 'x') ==
+            "1x1x1x1x1x1x1x1x1x");  // more anchors than a compiled format holds
+
+    std::string out = ">";
+    VT::safe_sprintf(out, "{0} {1}", (std::numeric_limits<long long>::min)(), true);
+    REQUIRE(out == ">-9223372036854775808 1");
+
+    // formats known at runtime are checked when used
+    const std::string unknown_index = "{3} {0}";
+    REQUIRE(VT::safe_sprintf_ret(unknown_index, 7) == "{3} 7");
+    REQUIRE_THROWS_AS(VT::safe_sprintf_ret(std::string("{0"), 1), std::runtime_error);
+    REQUIRE_THROWS_AS(VT::safe_sprintf_ret(std::string("{a}"), 1), std::runtime_error);
+    REQUIRE_THROWS_AS(VT::safe_sprintf_ret(std::string("{:x}"), 1), std::runtime_error);
+}
+
+
 TEST_CASE("VTUtils/VTThreadPool/constructor", "")
 {
     VT::ThreadPool tp(2, 5);
@@ -147,3 +208,1166 @@ TEST_CASE("VTUtils/VTThreadPool/run_multiple", "")
     for (int i = 0; i < 10; ++i)
         REQUIRE(v[i] == 42);
 }
+
+
+TEST_CASE("VTUtils/VTThreadPool/work_stealing", "Tasks spawned from workers go to local deques and get stolen")
+{
+    VT::ThreadPool::Options options;
+    options.thread_count = 4;
+    options.max_thread_count = 4;
+    options.work_stealing = true;
+    VT::ThreadPool tp(options);
+    REQUIRE(tp.thread_count() == 4);
+
+    std::vector<int> v(100);
+    for (int i = 0; i < 10; ++i)
+    {
+        tp.run([&tp, &v, i]()
+        {
+            for (int j = 0; j < 10; ++j)
+            {
+                v[i * 10 + j] = 41;
+                tp.run(std::bind(&work, std::ref(v[i * 10 + j])));
+            }
+        });
+    }
+    REQUIRE(tp.wait_for_all() == true);
+
+    for (size_t i = 0; i < v.size(); ++i)
+        REQUIRE(v[i] == 42);
+
+    tp.set_thread_count(2);
+    REQUIRE(tp.thread_count() == 2);
+}
+
+
+TEST_CASE("VTUtils/VTMPMCQueue/try", "Non-blocking push and pop respect capacity and order")
+{
+    VT::MPMCQueue<int> q(4);
+    REQUIRE(q.capacity() == 4);
+    for (int i = 0; i < 4; ++i)
+        REQUIRE(q.try_push(i) == true);
+    REQUIRE(q.try_push(4) == false);
+
+    int x = -1;
+    for (int i = 0; i < 4; ++i)
+    {
+        REQUIRE(q.try_pop(x) == true);
+        REQUIRE(x == i);
+    }
+    REQUIRE(q.try_pop(x) == false);
+    REQUIRE(q.empty() == true);
+}
+
+
+TEST_CASE("VTUtils/VTMPMCQueue/blocking", "Several producers and consumers")
+{
+    VT::MPMCQueue<int> q(16);
+    std::atomic<long> sum(0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 2; ++t)
+        threads.push_back(std::thread([&q]{ for (int i = 1; i <= 1000; ++i) q.push(i); }));
+    for (int t = 0; t < 2; ++t)
+        threads.push_back(std::thread([&q, &sum]{ for (int i = 0; i < 1000; ++i) sum += q.pop(); }));
+
+    for (auto& t : threads)
+        t.join();
+
+    REQUIRE(sum.load() == 2 * 500500);
+}
+
+
+TEST_CASE("VTUtils/VTSPSCQueue/bulk", "Bulk operations move as many items as fit")
+{
+    VT::SPSCQueue<int> q(8);
+    int in[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    REQUIRE(q.push_bulk(in, 10) == 8);
+    REQUIRE(q.size() == 8);
+
+    int out[10];
+    REQUIRE(q.pop_bulk(out, 5) == 5);
+    REQUIRE(q.pop_bulk(out + 5, 5) == 3);
+    for (int i = 0; i < 8; ++i)
+        REQUIRE(out[i] == i);
+    REQUIRE(q.empty() == true);
+}
+
+
+TEST_CASE("VTUtils/VTSPSCQueue/park", "Producer and consumer threads with futex parking")
+{
+    VT::SPSCQueue<int, VT::ParkWait> q(4);
+    long sum = 0;
+
+    std::thread consumer([&q, &sum]{ for (int i = 0; i < 1000; ++i) sum += q.pop(); });
+    for (int i = 1; i <= 1000; ++i)
+        q.push(i);
+    consumer.join();
+
+    REQUIRE(sum == 500500);
+}
+
+
+TEST_CASE("VTUtils/VTWaitSet/wait", "Wait for any of several events and conditions")
+{
+    VT::Event stop;
+    VT::Event work(false);
+    VT::ThreadSafeQueue<int> queue;
+
+    VT::WaitSet ws;
+    REQUIRE(ws.add(stop) == 0);
+    REQUIRE(ws.add(work) == 1);
+    REQUIRE(ws.add([&queue]{ return !queue.empty(); }) == 2);
+
+    REQUIRE(ws.wait(1) == -1);
+
+    std::thread producer([&]{ queue.push(42); ws.notify(); });
+    REQUIRE(ws.wait() == 2);
+    producer.join();
+    REQUIRE(queue.pop() == 42);
+
+    work.signal();
+    stop.signal();
+    std::vector<size_t> fired;
+    REQUIRE(ws.wait(VT::VT_INFINITE, &fired) == 0);
+    REQUIRE(fired.size() == 2);
+    REQUIRE(work.is_signaled() == false);  // auto reset event is consumed
+}
+
+
+struct MoveOnlyTask
+{
+    explicit MoveOnlyTask(int v) : value(new int(v)) { }
+    MoveOnlyTask(MoveOnlyTask&& other) : value(std::move(other.value)) { }
+    int operator()() { return *value * 2; }
+
+    std::unique_ptr<int> value;
+};
+
+TEST_CASE("VTUtils/VTThreadPool/submit", "Typed futures, move-only tasks and fire-and-forget post")
+{
+    VT::ThreadPool tp(2, 5);
+
+    auto doubled = tp.submit(MoveOnlyTask(21));
+    auto text = tp.submit([]{ return std::string("done"); });
+    auto failed = tp.submit([]() -> int { throw std::runtime_error("boom"); });
+
+    REQUIRE(doubled.get() == 42);
+    REQUIRE(text.get() == "done");
+    REQUIRE_THROWS_AS(failed.get(), std::runtime_error);
+
+    int x = 41;
+    tp.post(std::bind(&work, std::ref(x)));
+    tp.wait_for_all();
+    REQUIRE(x == 42);
+}
+
+
+TEST_CASE("VTUtils/VTParallel/algorithms", "parallel_for, parallel_reduce, parallel_transform and parallel_sort")
+{
+    VT::ThreadPool tp(2, 4);
+
+    std::vector<int> v(10000);
+    VT::parallel_for(tp, 0, static_cast<int>(v.size()), [&v](int i) { v[i] = i; });
+
+    long sum = VT::parallel_reduce(tp, size_t(0), v.size(), size_t(100), 0L,
+                                   [&v](size_t b, size_t e, long acc) { for (size_t i = b; i < e; ++i) acc += v[i]; return acc; },
+                                   [](long a, long b) { return a + b; });
+    REQUIRE(sum == 49995000L);
+
+    bool all_even = VT::parallel_reduce(tp, size_t(0), v.size(), size_t(10), true,
+                                        [&v](size_t b, size_t e, bool acc) { for (size_t i = b; i < e; ++i) acc = acc && v[i] % 2 == 0; return acc; },
+                                        [](bool a, bool b) { return a && b; });
+    REQUIRE(!all_even);
+
+    std::vector<int> doubled(v.size());
+    VT::parallel_transform(tp, v.begin(), v.end(), doubled.begin(), [](int x) { return x * 2; });
+    REQUIRE(doubled[1234] == 2468);
+
+    std::vector<int> unsorted(v.rbegin(), v.rend());
+    VT::parallel_sort(tp, unsorted.begin(), unsorted.end());
+    REQUIRE(unsorted == v);
+
+    REQUIRE_THROWS_AS(VT::parallel_for(tp, 0, 100, 1, [](int i) { if (i == 50) throw std::runtime_error("fail"); }),
+                      std::runtime_error);
+}
+
+
+TEST_CASE("VTUtils/VTThreadPool/priorities", "Queued tasks run by priority, then deadline, then FIFO")
+{
+    VT::ThreadPool tp(1, 1);
+    VT::Event gate;
+    std::vector<int> order;
+
+    tp.post([&gate]{ gate.wait(); });  // keep the only thread busy while the queue fills
+
+    auto now = std::chrono::steady_clock::now();
+    tp.post([&order]{ order.push_back(5); }, VT::TP_Low);
+    tp.post([&order]{ order.push_back(3); });
+    tp.post([&order]{ order.push_back(4); });
+    tp.post([&order]{ order.push_back(0); }, VT::TP_High);
+    tp.post([&order]{ order.push_back(2); }, VT::TaskOptions(VT::TP_Normal, now + std::chrono::seconds(10)));
+    tp.post([&order]{ order.push_back(1); }, VT::TaskOptions(VT::TP_Normal, now + std::chrono::seconds(1)));
+
+    gate.signal();
+    REQUIRE(tp.wait_for_all() == true);
+
+    REQUIRE(order.size() == 6);
+    for (int i = 0; i < 6; ++i)
+        REQUIRE(order[i] == i);
+
+    REQUIRE(tp.priority_stats(VT::TP_Normal).tasks == 5);
+    REQUIRE(tp.priority_stats(VT::TP_High).tasks == 1);
+}
+
+
+TEST_CASE("VTUtils/VTTaskGraph/continuations", "then(), when_all, when_any and errors passed down the chain")
+{
+    VT::ThreadPool tp(4, 4);
+
+    auto f = VT::spawn(tp, []{ return 20; })
+                 .then([](int x) { return x + 1; })
+                 .then([](int x) { return x * 2; });
+    REQUIRE(f.get() == 42);
+
+    std::vector<VT::TaskFuture<int>> parts;
+    for (int i = 0; i < 10; ++i)
+        parts.push_back(VT::spawn(tp, [i]{ return i; }));
+
+    int sum = 0;
+    VT::when_all(parts).then([&]{ for (auto& p : parts) sum += p.get(); }).get();
+    REQUIRE(sum == 45);
+    REQUIRE(VT::when_any(parts).get() < parts.size());
+
+    bool skipped = true;
+    auto failed = VT::spawn(tp, []() -> int { throw std::runtime_error("fail"); })
+                      .then([&](int) { skipped = false; });
+    REQUIRE_THROWS_AS(failed.get(), std::runtime_error);
+    REQUIRE(skipped);
+
+    VT::ThreadPool::Options options;
+    options.thread_count = 1;
+    options.max_thread_count = 1;
+    options.queue_capacity = 1;
+    options.queue_full_policy = VT::QF_Reject;
+
+    VT::ThreadPool full(options);
+    auto ready = VT::spawn(full, []{ return 1; });
+    ready.wait();
+
+    VT::Event gate;
+    full.post([&gate]{ gate.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    full.post([]{});
+
+    // rejected continuation fails its own future, not the caller
+    auto rejected = ready.then([](int x) { return x; });
+    REQUIRE_THROWS_AS(rejected.get(), VT::QueueFullError);
+
+    gate.signal();
+    REQUIRE(full.wait_for_all());
+}
+
+
+TEST_CASE("VTUtils/VTTaskGraph/graph", "Tasks start after all their dependencies, errors skip dependants")
+{
+    VT::ThreadPool tp(4, 4);
+    VT::TaskGraph g(tp);
+    std::atomic<int> a(0), b(0), c(0);
+    std::atomic<bool> ordered(true);
+
+    auto na = g.add([&]{ a = 1; });
+    auto nb = g.add([&]{ b = 1; });
+    auto nc = g.add([&]{ if (!a || !b) ordered = false; c = 1; });
+    g.precede(na, nc);
+    g.precede(nb, nc);
+
+    g.run();
+    g.wait();
+    REQUIRE(c.load() == 1);
+    REQUIRE(ordered);
+
+    VT::TaskGraph cycle(tp);
+    auto x = cycle.add([]{});
+    auto y = cycle.add([]{});
+    cycle.precede(x, y);
+    cycle.precede(y, x);
+    REQUIRE_THROWS_AS(cycle.run(), std::logic_error);
+
+    VT::TaskGraph failing(tp);
+    bool reached = false;
+    auto first = failing.add([]{ throw std::runtime_error("fail"); });
+    auto second = failing.add([&]{ reached = true; });
+    failing.precede(first, second);
+    failing.run();
+    REQUIRE_THROWS_AS(failing.wait(), std::runtime_error);
+    REQUIRE(!reached);
+
+    // posts rejected by a full queue fail the node and skip its dependants
+    VT::ThreadPool::Options options;
+    options.thread_count = 1;
+    options.max_thread_count = 1;
+    options.queue_capacity = 1;
+    options.queue_full_policy = VT::QF_Reject;
+    VT::ThreadPool full(options);
+
+    VT::TaskGraph rejected(full);
+    auto fills = rejected.add([&full]{ full.post([]{}); });  // the successor finds the queue full
+    auto after = rejected.add([&]{ reached = true; });
+    auto last = rejected.add([&]{ reached = true; });
+    rejected.precede(fills, after);
+    rejected.precede(after, last);
+    rejected.run();
+    REQUIRE(full.wait_for_all());  // doesn't help the pool, the filler stays queued until the successor is posted
+    REQUIRE_THROWS_AS(rejected.wait(), VT::QueueFullError);
+    REQUIRE(!reached);
+
+    VT::Event gate;
+    full.post([&gate]{ gate.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    full.post([]{});
+
+    VT::TaskGraph roots(full);
+    roots.precede(roots.add([&]{ reached = true; }), roots.add([&]{ reached = true; }));
+    roots.run();  // the root is rejected, run() doesn't throw
+    gate.signal();
+    REQUIRE_THROWS_AS(roots.wait(), VT::QueueFullError);
+    REQUIRE(!reached);
+}
+
+
+TEST_CASE("VTUtils/VTThreadPool/affinity", "Pinned workers and per NUMA node sub-pools")
+{
+    VT::ThreadPool::Options options;
+    options.thread_count = 2;
+    options.max_thread_count = 2;
+    options.cpus.push_back(0);
+
+    VT::ThreadPool pinned(options);
+    REQUIRE(pinned.submit([]{ return VT::current_cpu(); }).get() == 0);
+
+    options.cpus.clear();
+    VT::NumaThreadPool numa(options);
+    REQUIRE(numa.node_count() >= 1);
+    REQUIRE(numa.current_node() < numa.node_count());
+
+    const std::vector<std::vector<int>> nodes = VT::numa_nodes();
+    for (size_t i = 0; i < numa.node_count(); ++i)
+    {
+        int cpu = numa.submit_to(i, []{ return VT::current_cpu(); }).get();
+        REQUIRE(std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end());
+    }
+    REQUIRE(numa.wait_for_all());
+}
+
+
+TEST_CASE("VTUtils/VTThreadPool/elastic", "Threads above the minimum retire when idle")
+{
+    VT::ThreadPool::Options options;
+    options.thread_count = 1;
+    options.max_thread_count = 4;
+    options.idle_timeout_ms = 50;
+
+    VT::ThreadPool tp(options);
+    VT::Event gate;
+
+    std::vector<std::future<void>> blocked;
+    for (int i = 0; i < 4; ++i)
+        blocked.push_back(tp.submit([&gate]{ gate.wait(); }));
+
+    for (int i = 0; i < 200 && tp.thread_count() < 4; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    REQUIRE(tp.thread_count() == 4);
+
+    gate.signal();
+    for (auto& f : blocked)
+        f.get();
+
+    for (int i = 0; i < 200 && tp.thread_count() > 1; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    REQUIRE(tp.thread_count() == 1);
+
+    REQUIRE(tp.submit([]{ return 7; }).get() == 7);
+}
+
+
+TEST_CASE("VTUtils/VTThreadPool/cancellation", "Cancelled tasks leave the queue, full queue policies")
+{
+    for (int stealing = 0; stealing < 2; ++stealing)
+    {
+        VT::ThreadPool::Options options;
+        options.thread_count = 1;
+        options.max_thread_count = 1;
+        options.work_stealing = (stealing != 0);
+
+        VT::ThreadPool tp(options);
+        VT::Event gate;
+        VT::CancellationToken token;
+        std::atomic<int> ran(0);
+
+        tp.post([&gate]{ gate.wait(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));  // let the worker pick it up
+
+        auto dropped = tp.submit([&ran]{ ++ran; }, token);
+        for (int i = 0; i < 10; ++i)
+            tp.post([&ran]{ ++ran; }, token);
+        tp.post([&ran]{ ran += 100; });
+
+        token.cancel();
+        REQUIRE_THROWS_AS(dropped.get(), std::future_error);
+        REQUIRE(tp.wait_for_all(token) == false);
+
+        // a waiter blocked on the busy pool wakes up on cancel()
+        VT::CancellationToken stop;
+        std::thread canceller([&stop]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            stop.cancel();
+        });
+        REQUIRE(tp.wait_for_all(stop) == false);
+        canceller.join();
+
+        gate.signal();
+        REQUIRE(tp.wait_for_all(VT::CancellationToken()));
+        REQUIRE(ran.load() == 100);
+    }
+
+    VT::ThreadPool::Options options;
+    options.thread_count = 1;
+    options.max_thread_count = 1;
+    options.queue_capacity = 1;
+    options.queue_full_policy = VT::QF_Reject;
+
+    VT::ThreadPool tp(options);
+    VT::Event gate;
+    tp.post([&gate]{ gate.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    tp.post([]{});
+    REQUIRE_THROWS_AS(tp.post([]{}), VT::QueueFullError);
+
+    VT::TaskGroup group(tp);
+    REQUIRE_THROWS_AS(group.run([]{}), VT::QueueFullError);
+
+    gate.signal();
+    REQUIRE(tp.wait_for_all());
+    group.wait();  // the rejected task is not waited for
+}
+
+
+TEST_CASE("VTUtils/VTHistogram/percentiles", "Log-linear buckets keep relative error under 12.5%")
+{
+    for (uint64_t v : { 0ull, 7ull, 8ull, 1000ull, 123456789ull, ~0ull })
+    {
+        size_t i = VT::HistogramSnapshot::bucket_index(v);
+        REQUIRE(VT::HistogramSnapshot::bucket_lower(i) <= v);
+        REQUIRE(VT::HistogramSnapshot::bucket_upper(i) >= v);
+    }
+
+    VT::Histogram h;
+    for (uint64_t v = 1; v <= 1000; ++v)
+        h.record(v);
+
+    VT::HistogramSnapshot s = h.snapshot();
+    REQUIRE(s.count() == 1000);
+    REQUIRE(s.min() == 1);
+    REQUIRE(s.max() == 1000);
+    REQUIRE(s.percentile(50) >= 500);
+    REQUIRE(s.percentile(50) <= 500 * 1.125);
+    REQUIRE(s.percentile(100) == 1000);
+
+    VT::HistogramSnapshot merged;
+    merged.merge(s);
+    merged.merge(s);
+    REQUIRE(merged.count() == 2000);
+}
+
+
+TEST_CASE("VTUtils/VTThreadPool/stats", "Counters and latency histograms")
+{
+    VT::ThreadPool tp(2, 2);
+    for (int i = 0; i < 100; ++i)
+        tp.post([]{});
+    REQUIRE(tp.wait_for_all());
+
+    VT::ThreadPoolStats s = tp.stats();
+    REQUIRE(s.thread_count == 2);
+    REQUIRE(s.queue_depth == 0);
+
+    if (s.enabled)  // built with VT_THREAD_POOL_STATS
+    {
+        REQUIRE(s.completed == 100);
+        REQUIRE(s.run_time_ns.count() == 100);
+        REQUIRE(s.queue_wait_ns.count() == 100);
+        REQUIRE(s.threads_started == 2);
+    }
+    else  // counters compiled out, nothing is recorded
+    {
+        REQUIRE(s.completed == 0);
+        REQUIRE(s.run_time_ns.count() == 0);
+        REQUIRE(s.queue_wait_ns.count() == 0);
+        REQUIRE(s.threads_started == 0);
+        REQUIRE(s.workers.empty());
+    }
+}
+
+
+TEST_CASE("VTUtils/VTTimer/sources", "All timer sources measure the same interval in nanoseconds")
+{
+    bool has_tsc = VT::Timer::tsc_available();  // calibrates, takes a while the first time
+
+    VT::Timer mono;
+    VT::Timer raw(true, VT::Timer::TS_MonotonicRaw);
+    VT::Timer tsc(true, VT::Timer::TS_Tsc);
+    REQUIRE((tsc.source() == VT::Timer::TS_Tsc) == has_tsc);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int64_t tsc_ns = tsc.time_elapsed_ns();
+    int64_t raw_ns = raw.time_elapsed_ns();
+    int64_t mono_ns = mono.time_elapsed_ns();
+
+    REQUIRE(mono_ns >= 50000000);
+    REQUIRE(mono_ns < 1000000000);
+    REQUIRE(std::abs(raw_ns - mono_ns) < 5000000);
+    REQUIRE(std::abs(tsc_ns - mono_ns) < 5000000);
+    REQUIRE(mono.time_elapsed().count() >= 50);
+
+    int64_t before = VT::Timer::now_ns(VT::Timer::TS_Tsc);
+    REQUIRE(VT::Timer::now_ns(VT::Timer::TS_Tsc) >= before);
+}
+
+
+TEST_CASE("VTUtils/VTTimer/scoped", "ScopedTimer records scope duration into a histogram")
+{
+    VT::Histogram latency;
+    for (int i = 0; i < 3; ++i)
+    {
+        VT::ScopedTimer t(latency);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    VT::HistogramSnapshot s = latency.snapshot();
+    REQUIRE(s.count() == 3);
+    REQUIRE(s.min() >= 5000000);
+    REQUIRE(s.max() < 1000000000);
+}
+
+
+TEST_CASE("VTUtils/VTTimerService/once", "One-shot timers fire once, in deadline order, and can be cancelled")
+{
+    VT::ThreadPool tp(1, 1);
+    VT::TimerService timers(tp);
+
+    std::mutex lock;
+    std::vector<int> order;
+    auto record = [&](int value) { return [&, value]{ std::lock_guard<std::mutex> l(lock); order.push_back(value); }; };
+
+    auto start = std::chrono::steady_clock::now();
+    timers.schedule_once(60, record(3));
+    timers.schedule_once(20, record(1));
+    timers.schedule_once(40, record(2));
+    VT::TimerService::TimerId cancelled = timers.schedule_once(30, record(-1));
+    // beyond the first wheel level, goes through a cascade
+    VT::TimerService::TimerId far = timers.schedule_once(300, record(4));
+
+    REQUIRE(timers.cancel(cancelled));
+    REQUIRE(!timers.cancel(cancelled));
+    REQUIRE(timers.timer_count() == 4);
+
+    while (timers.timer_count() != 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    REQUIRE((std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(300)));
+    REQUIRE(order == std::vector<int>({ 1, 2, 3, 4 }));
+    REQUIRE(!timers.cancel(far));
+}
+
+
+TEST_CASE("VTUtils/VTTimerService/periodic", "Fixed rate doesn't drift with callback duration, fixed delay does")
+{
+    VT::ThreadPool tp(2, 2);
+    VT::TimerService timers(tp);
+
+    std::atomic<int> rate(0);
+    std::atomic<int> delay(0);
+    auto slow = [](std::atomic<int>& count) { return [&count]{ count++; std::this_thread::sleep_for(std::chrono::milliseconds(10)); }; };
+
+    VT::TimerService::TimerId rate_id = timers.schedule_periodic(20, slow(rate), VT::TM_FixedRate);
+    VT::TimerService::TimerId delay_id = timers.schedule_periodic(20, slow(delay), VT::TM_FixedDelay);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(410));
+    REQUIRE(timers.cancel(rate_id, true));
+    REQUIRE(timers.cancel(delay_id, true));
+
+    int rate_runs = rate.load();
+    int delay_runs = delay.load();
+    REQUIRE(rate_runs >= 17);
+    REQUIRE(rate_runs <= 21);
+    REQUIRE(delay_runs < rate_runs);
+
+    // nothing runs after cancel(id, true) returned
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(rate.load() == rate_runs);
+    REQUIRE(delay.load() == delay_runs);
+    REQUIRE(timers.timer_count() == 0);
+}
+
+
+TEST_CASE("VTUtils/VTExecuter/calls", "Executer calls the function periodically until destroyed")
+{
+    VT::ThreadPool tp(1, 1);
+    VT::TimerService timers(tp);
+
+    std::atomic<int> calls(0);
+    {
+        VT::Executer executer(timers, [&]{ calls++; }, 10);
+        std::this_thread::sleep_for(std::chrono::milliseconds(105));
+    }
+    int made = calls.load();
+    REQUIRE(made >= 8);
+    REQUIRE(made <= 11);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    REQUIRE(calls.load() == made);
+
+    VT::Executer disabled(timers, [&]{ calls++; }, 0);
+    REQUIRE(timers.timer_count() == 0);
+}
+
+
+TEST_CASE("VTUtils/VTLogger/enabled", "Disabled levels skip formatting and evaluation of arguments")
+{
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("lvl");
+    REQUIRE(!log.enabled(VT::LL_Critical));
+
+    log.set_stream(file, VT::LL_Warning);
+    log.set_cerr(VT::LL_NoLogging);
+    REQUIRE(!log.enabled(VT::LL_Info));
+    REQUIRE(log.enabled(VT::LL_Warning));
+
+    int evaluated = 0;
+    VT_LOG_INFO(log) << "skipped" << ++evaluated;
+    VT_LOGF(log, VT::LL_Debug, "skipped {0}", ++evaluated);
+    VT_LOG_ERROR(log) << "written" << ++evaluated;
+    VT_LOGF(log, VT::LL_Warning, "written {0}", ++evaluated);
+    log.info() << "skipped";
+    REQUIRE(evaluated == 2);
+
+    // literals are checked at compile time with C++20, other strings when used
+    const std::string runtime_format = "written {0}";
+    log.warning(runtime_format, 3);
+    log.error("written {0}", 4);
+    REQUIRE_THROWS_AS(log.error(std::string("{0"), 5), std::runtime_error);
+
+    VT::Logger copy = log;
+    copy.set_cout(VT::LL_Debug);
+    REQUIRE(copy.enabled(VT::LL_Debug));
+    REQUIRE(!log.enabled(VT::LL_Debug));
+
+    std::thread t([&]{
+        for (int i = 0; i < 1000; ++i)
+            log.set_cerr(i % 2 ? VT::LL_Critical : VT::LL_NoLogging);
+    });
+    for (int i = 0; i < 1000; ++i)
+        VT_LOG_DEBUG(log) << "skipped";
+    t.join();
+
+    std::rewind(file);
+    int lines = 0;
+    char buf[256];
+    while (std::fgets(buf, sizeof(buf), file))
+        ++lines;
+    REQUIRE(lines == 4);
+}
+
+
+TEST_CASE("VTUtils/VTLogger/async", "Mixed size records wrap around small rings, order is kept per thread")
+{
+    VT::AsyncLogOptions options;
+    options.ring_bytes = 1024;
+    VT::configure_async_logging(options);  // for threads started below
+
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("async");
+    log.set(VT::LO_NoTimestamp);
+    log.set(VT::LO_NoThreadId);
+    log.set(VT::LO_NoLoggerName);
+    log.set(VT::LO_NoLogLevel);
+    log.set_stream(file, VT::LL_Info);
+
+    const int kThreads = 3;
+    const int kMessages = 3000;
+    const std::string padding(600, '.');
+    auto produce = [&](VT::Logger& logger, int thread)
+    {
+        // 0..99 bytes of padding, so records end at every offset near the end of the ring;
+        // every 500th record is too big for the ring and is written synchronously
+        for (int i = 0; i < kMessages; ++i)
+            logger.info() << thread << i << padding.substr(0, i % 500 == 0 ? 600 : (i * 37) % 100);
+    };
+
+    std::vector<std::thread> threads;
+    {
+        log.set_async(VT::LOF_Block);
+        for (int t = 0; t < kThreads; ++t)
+            threads.emplace_back([&, t]{ produce(log, t); });
+        for (std::thread& t : threads)
+            t.join();
+        threads.clear();
+        VT::flush_async_logging();
+    }
+
+    // dropped and synchronously written records are accounted for
+    const uint64_t dropped_before = VT::async_logging_dropped();
+    {
+        VT::Logger dropping(log);
+        dropping.set_async(VT::LOF_Drop);
+        threads.emplace_back([&]{ produce(dropping, kThreads); });
+        VT::Logger sync(log);
+        sync.set_async(VT::LOF_Sync);
+        threads.emplace_back([&]{ produce(sync, kThreads + 1); });
+        for (std::thread& t : threads)
+            t.join();
+        VT::flush_async_logging();
+    }
+    const uint64_t dropped = VT::async_logging_dropped() - dropped_before;
+    VT::configure_async_logging(VT::AsyncLogOptions());
+
+    std::rewind(file);
+    std::vector<int> next(kThreads + 2, 0);
+    int lines = 0;
+    bool parsed = true;
+    bool ordered = true;
+    char buf[1024];
+    while (std::fgets(buf, sizeof(buf), file))
+    {
+        int thread = -1;
+        int i = -1;
+        if (std::sscanf(buf, "%d %d", &thread, &i) != 2 || thread < 0 || thread >= kThreads + 2)
+        {
+            parsed = false;
+            break;
+        }
+        if (thread != kThreads)  // the LOF_Drop logger skips records
+            ordered = ordered && (i == next[thread]);
+        next[thread] = i + 1;
+        ++lines;
+    }
+
+    REQUIRE(parsed);
+    REQUIRE(ordered);
+    REQUIRE((lines + dropped == static_cast<uint64_t>(kMessages * (kThreads + 2))));
+    REQUIRE(dropped <= static_cast<uint64_t>(kMessages));  // only the LOF_Drop logger drops
+}
+
+
+TEST_CASE("VTUtils/VTLogger/timestamp", "Custom timestamp format with fractions of a second")
+{
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("ts");
+    log.set_stream(file, VT::LL_Info);
+    log.set_timestamp_format("%H:%M:%S", VT::LTP_Milliseconds);
+    log.info() << "one";
+    log.set_timestamp_format("[%Y]", VT::LTP_Microseconds);
+    log.info() << "two";
+
+    std::rewind(file);
+    char buf[256];
+    REQUIRE(std::fgets(buf, sizeof(buf), file));
+    std::string first(buf);
+    REQUIRE(std::fgets(buf, sizeof(buf), file));
+    std::string second(buf);
+
+    std::string thread_id = VT::safe_sprintf_ret("0x{0:X} ", std::this_thread::get_id());
+    REQUIRE(first.size() > 13);
+    REQUIRE(first[2] == ':');
+    REQUIRE(first[8] == '.');
+    REQUIRE(first.substr(12) == " [ts] " + thread_id + "<Info> one \n");
+    REQUIRE(second[0] == '[');
+    REQUIRE(second[5] == ']');
+    REQUIRE(second[6] == '.');
+    REQUIRE(second.substr(13) == " [ts] " + thread_id + "<Info> two \n");
+}
+
+
+TEST_CASE("VTUtils/VTLogger/worker", "Fast inserters format like std::ostream, nested messages get own buffers")
+{
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("worker");
+    log.set(VT::LO_NoTimestamp);
+    log.set(VT::LO_NoThreadId);
+    log.set(VT::LO_NoLoggerName);
+    log.set(VT::LO_NoLogLevel);
+    log.set(VT::LO_NoSpace);
+    log.set_stream(file, VT::LL_Info);
+
+    {
+        VT::detail_::LogWorker outer = log.info();
+        outer << 0 << ',' << -42 << ',' << (std::numeric_limits<long long>::min)() << ','
+              << (std::numeric_limits<unsigned long long>::max)() << ',' << true << ','
+              << 3.14159265 << ',' << 1e-7 << ',' << 0.1f << ',' << 1e300 << ',' << 2.5L << ','
+              << std::string("str") << ',' << std::setprecision(3) << 1.0 / 3 << ','
+              << std::hex << 255 << ',' << std::setw(5) << 7 << ',' << std::dec << std::setfill('*')
+              << std::setw(4) << "ab" << ',' << VT::quote << "q";
+        log.info() << "inner " << 1.5;  // written first
+    }
+    log.info() << 1.0 / 3 << ',' << 255 << ',' << std::setw(0) << "x";  // formatting is reset
+
+    std::ostringstream expected;
+    expected << 0 << ',' << -42 << ',' << (std::numeric_limits<long long>::min)() << ','
+             << (std::numeric_limits<unsigned long long>::max)() << ',' << true << ','
+             << 3.14159265 << ',' << 1e-7 << ',' << 0.1f << ',' << 1e300 << ',' << 2.5L << ','
+             << std::string("str") << ',' << std::setprecision(3) << 1.0 / 3 << ','
+             << std::hex << 255 << ',' << std::setw(5) << 7 << ',' << std::dec << std::setfill('*')
+             << std::setw(4) << "ab" << ',' << "\"q\"";
+
+    std::rewind(file);
+    char buf[512];
+    REQUIRE(std::fgets(buf, sizeof(buf), file));
+    REQUIRE(std::string(buf) == "inner 1.5\n");
+    REQUIRE(std::fgets(buf, sizeof(buf), file));
+    REQUIRE(std::string(buf) == expected.str() + "\n");
+    REQUIRE(std::fgets(buf, sizeof(buf), file));
+    REQUIRE(std::string(buf) == "0.333333,255,x\n");
+}
+
+
+TEST_CASE("VTUtils/VTLogger/structured", "Fields are serialized as JSON lines and logfmt, text keeps them inline")
+{
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("kv");
+    log.set(VT::LO_NoTimestamp);
+    log.set(VT::LO_NoThreadId);
+    log.set_stream(file, VT::LL_Info);
+
+    const std::string user = "bob \"the\" admin";
+    const char* const formats[] = { "text", "json", "logfmt" };
+    const VT::LogFormat values[] = { VT::LF_Text, VT::LF_JSON, VT::LF_Logfmt };
+    for (int i = 0; i < 3; ++i)
+    {
+        log.set_format(values[i]);
+        log.info() << "login" << VT::field("user", user) << VT::field("id", -7) << VT::field("ms", 0.25)
+                   << VT::field("ok", true) << VT::field("format", formats[i]) << VT::field("nan", std::nan(""));
+        log.warning("line\n{0}", 2);
+    }
+
+    std::rewind(file);
+    std::vector<std::string> lines;
+    char buf[512];
+    while (std::fgets(buf, sizeof(buf), file))
+        lines.push_back(buf);
+
+    REQUIRE(lines.size() == 7);  // the text message with the newline is split
+    REQUIRE(lines[0] == "[kv] <Info> login user=\"bob \\\"the\\\" admin\" id=-7 ms=0.25 ok=true format=text nan=nan \n");
+    REQUIRE(lines[3] == "{\"logger\":\"kv\",\"level\":\"Info\",\"msg\":\"login\",\"user\":\"bob \\\"the\\\" admin\","
+                        "\"id\":-7,\"ms\":0.25,\"ok\":true,\"format\":\"json\",\"nan\":null}\n");
+    REQUIRE(lines[4] == "{\"logger\":\"kv\",\"level\":\"Warning\",\"msg\":\"line\\n2\"}\n");
+    REQUIRE(lines[5] == "logger=kv level=Info msg=login user=\"bob \\\"the\\\" admin\" id=-7 ms=0.25 ok=true format=logfmt nan=nan\n");
+    REQUIRE(lines[6] == "logger=kv level=Warning msg=\"line\\n2\"\n");
+}
+
+
+TEST_CASE("VTUtils/VTLogger/ratelimit", "Call sites are sampled or rate limited, suppressed messages are summarized")
+{
+    std::FILE* file = std::tmpfile();  // closed by the logger
+    REQUIRE(file);
+
+    VT::Logger log("rl");
+    log.set(VT::LO_NoTimestamp);
+    log.set(VT::LO_NoThreadId);
+    log.set(VT::LO_NoLoggerName);
+    log.set(VT::LO_NoLogLevel);
+    log.set_stream(file, VT::LL_Info);
+
+    int evaluated = 0;
+    for (int i = 0; i < 1000; ++i)
+        VT_LOG_EVERY_N(log, VT::LL_Info, 300) << "sample" << i << ++evaluated;
+    REQUIRE(evaluated == 4);
+
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int i = 0; i < 100; ++i)
+            VT_LOG_RATE(log, VT::LL_Info, 2, 2) << "rate" << i;
+        std::this_thread::sleep_for(std::chrono::milliseconds(750));  // between 1 and 2 tokens
+    }
+
+    for (int i = 0; i < 100; ++i)
+        VT_LOG_RATE(log, VT::LL_Debug, 1, 1) << "disabled";  // not counted either
+
+    std::rewind(file);
+    std::vector<std::string> lines;
+    char buf[256];
+    while (std::fgets(buf, sizeof(buf), file))
+        lines.push_back(buf);
+
+    REQUIRE(lines.size() == 8);
+    REQUIRE(lines[0] == "sample 0 1 \n");
+    REQUIRE(lines[3] == "sample 900 4 \n");
+    REQUIRE(lines[4] == "rate 0 \n");
+    REQUIRE(lines[5] == "rate 1 \n");
+    REQUIRE(lines[6].find("suppressed 98 similar messages at ") == 0);  // one token after 500 ms
+    REQUIRE(lines[7] == "rate 0 \n");
+}
+
+
+#ifdef __linux__
+
+TEST_CASE("VTUtils/VTRotatingFile/rotation", "Segments rotate by size at line ends and only max_files are kept")
+{
+    VT::RotatingFileOptions opts;
+    opts.path = "vt_rotating_test.log";
+    opts.max_bytes = 1000;
+    opts.max_files = 2;
+    opts.use_mmap = true;
+
+    {
+        VT::Logger log("rot");
+        log.set(VT::LO_NoTimestamp);
+        log.set(VT::LO_NoThreadId);
+        REQUIRE(log.set_rotating_stream(opts, VT::LL_Info));
+        for (int i = 0; i < 200; ++i)
+            log.info() << "line" << i;
+    }
+
+    std::vector<std::string> lines;
+    const char* const files[] = { "vt_rotating_test.log.2", "vt_rotating_test.log.1", "vt_rotating_test.log" };
+    for (const char* name : files)
+    {
+        std::FILE* f = std::fopen(name, "r");
+        REQUIRE(f);
+        std::fseek(f, 0, SEEK_END);
+        REQUIRE(std::ftell(f) <= 1000);  // trimmed to the written size
+        std::rewind(f);
+        char buf[256];
+        while (std::fgets(buf, sizeof(buf), f))
+            lines.push_back(buf);
+        std::fclose(f);
+        std::remove(name);
+    }
+    REQUIRE((std::fopen("vt_rotating_test.log.3", "r") == nullptr));
+
+    // the oldest segments are gone, the rest is complete
+    REQUIRE(lines.size() > 80);
+    REQUIRE(lines.size() < 150);
+    int first = 200 - static_cast<int>(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+        REQUIRE(lines[i] == VT::safe_sprintf_ret("[rot] <Info> line {0} \n", first + static_cast<int>(i)));
+}
+
+#endif
+
+
+TEST_CASE("VTUtils/VTLogger/registry", "Handles follow set_logger, lookups run concurrently with registration")
+{
+    VT::LoggerHandle handle = VT::get_logger_handle("registry/a");
+    REQUIRE(handle.valid());
+    REQUIRE(handle.get() == VT::get_logger_handle("registry/a").get());
+    REQUIRE(handle->enabled(VT::LL_Debug));  // Logger::cout by default
+
+    VT::Logger quiet("registry/a");
+    VT::set_logger("registry/a", quiet);
+    REQUIRE(!handle->enabled(VT::LL_Critical));
+    REQUIRE(!VT::get_logger("registry/a").enabled(VT::LL_Critical));
+
+    VT::Logger to_file("registry/b");
+    to_file.set_stream(std::tmpfile(), VT::LL_Debug);
+    VT::set_logger("registry/b", to_file);
+    to_file.set_stream(nullptr, VT::LL_NoLogging);
+
+    // replaced instance stays valid but lets go of its stream
+    const VT::Logger* replaced = VT::get_logger_handle("registry/b").get();
+    REQUIRE(replaced->enabled(VT::LL_Debug));
+    VT::set_logger("registry/b", quiet);
+    REQUIRE(!replaced->enabled(VT::LL_Critical));
+
+    // streams of replaced loggers are closed while a thread still writes through the handle
+    std::atomic<bool> writing(true);
+    std::thread writer([&writing]{
+        VT::LoggerHandle h = VT::get_logger_handle("registry/c");
+        while (writing.load())
+            h->info() << "to whichever stream is current";
+    });
+    for (int i = 0; i < 100; ++i)
+    {
+        VT::Logger next("registry/c");
+        next.set_stream(std::tmpfile(), VT::LL_Info);
+        VT::set_logger("registry/c", next);
+    }
+    writing.store(false);
+    writer.join();
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]{
+            for (int i = 0; i < 200; ++i)
+            {
+                std::string name = "registry/" + std::to_string((i * 7 + t) % 50);
+                VT::LoggerHandle h = VT::get_logger_handle(name);
+                if (h.get() != VT::get_logger_handle(name).get())
+                    ++mismatches;
+                if (i % 20 == 0)
+                    VT::set_logger("registry/a", quiet);
+                VT_LOG_DEBUG(*handle) << "never written";
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    REQUIRE(mismatches.load() == 0);
+    REQUIRE(!handle->enabled(VT::LL_Critical));
+}
+
+
+TEST_CASE("VTUtils/VTBinaryLogger/decode", "Raw records decode to the same text safe_sprintf produces")
+{
+    std::FILE* raw = std::tmpfile();
+    std::FILE* text = std::tmpfile();
+    REQUIRE((raw && text));
+
+    int evaluated = 0;
+    {
+        VT::BinaryLogOptions opts;
+        opts.raw = true;
+        opts.level = VT::LL_Info;
+        opts.overflow = VT::LOF_Block;
+        VT::BinaryLogger log("blog", raw, opts);
+
+        std::string name = "eth0";
+        VT_BLOG(log, VT::LL_Warning, "{0} {1:x} {2} {3} {4}", -7, 255u, 2.5, name, "literal");
+        VT_BLOG(log, VT::LL_Debug, "skipped {0}", ++evaluated);
+
+        std::thread t([&]{
+            for (int i = 0; i < 1000; ++i)
+                VT_BLOG(log, VT::LL_Info, "i={0}", i);
+        });
+        t.join();
+        log.flush();
+        REQUIRE(log.dropped() == 0);
+    }
+    REQUIRE(evaluated == 0);
+
+    std::rewind(raw);
+    REQUIRE(VT::decode_binary_log(raw, text));
+    std::rewind(text);
+
+    std::vector<std::string> lines;
+    char buf[256];
+    while (std::fgets(buf, sizeof(buf), text))
+        lines.push_back(buf);
+    std::fclose(raw);
+    std::fclose(text);
+
+    REQUIRE(lines.size() == 1001);
+    REQUIRE(lines[0].find("[blog] ") != std::string::npos);
+    std::string expected = VT::safe_sprintf_ret(" <Warning> {0} {1:x} {2} {3} {4}\n", -7, 255u, 2.5, "eth0", "literal");
+    REQUIRE(lines[0].find(expected) != std::string::npos);
+    REQUIRE(lines[0].find(VT::safe_sprintf_ret("0x{0:X} ", std::this_thread::get_id())) != std::string::npos);
+    REQUIRE(lines[1000].find(" <Info> i=999\n") != std::string::npos);
+}
+
+
+#ifdef VT_HAS_COROUTINES
+
+static VT::CoTask<int> co_square(VT::ThreadPool& pool, int value)
+{
+    co_await pool.schedule();
+    co_return value * value;
+}
+
+static VT::CoTask<int> co_sum_squares(VT::ThreadPool& pool, int count)
+{
+    int sum = 0;
+    for (int i = 1; i <= count; ++i)
+        sum += co_await co_square(pool, i);
+    co_return sum;
+}
+
+static VT::CoTask<> co_throw(VT::ThreadPool& pool)
+{
+    co_await pool.schedule();
+    throw std::runtime_error("co_throw");
+}
+
+static VT::CoTask<int> co_wait_event(VT::AsyncEvent& event, std::atomic<int>& passed)
+{
+    co_await event;
+    co_return ++passed;
+}
+
+TEST_CASE("VTUtils/VTCoroutine/task", "Coroutines hop to the pool and await each other")
+{
+    VT::ThreadPool tp(2, 2);
+
+    REQUIRE(VT::spawn(tp, co_sum_squares(tp, 100)).get() == 338350);
+    REQUIRE_THROWS_AS(VT::spawn(tp, co_throw(tp)).get(), std::runtime_error);
+
+    // synchronously completing awaits transfer control instead of nesting resume() calls
+    auto chain = [](int depth) -> VT::CoTask<int>
+    {
+        int n = 0;
+        for (int i = 0; i < depth; ++i)
+            n += co_await [](int v) -> VT::CoTask<int> { co_return v; }(1);
+        co_return n;
+    };
+    REQUIRE(VT::spawn(tp, chain(1000)).get() == 1000);
+
+    // awaiting a TaskFuture doesn't block a thread
+    VT::TaskFuture<int> future = VT::spawn(tp, []{ return 21; });
+    auto doubled = [](VT::TaskFuture<int> f) -> VT::CoTask<int> { co_return 2 * co_await f; };
+    REQUIRE(VT::spawn(tp, doubled(future)).get() == 42);
+}
+
+
+TEST_CASE("VTUtils/VTCoroutine/event", "AsyncEvent and sleep resume suspended coroutines")
+{
+    VT::ThreadPool tp(2, 2);
+
+    VT::AsyncEvent manual;
+    std::atomic<int> passed(0);
+    auto a = VT::spawn(tp, co_wait_event(manual, passed));
+    auto b = VT::spawn(tp, co_wait_event(manual, passed));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(passed.load() == 0);
+    manual.signal();
+    a.wait();
+    b.wait();
+    REQUIRE(passed.load() == 2);
+    REQUIRE(manual.is_signaled());
+
+    VT::AsyncEvent automatic(false);
+    auto c = VT::spawn(tp, co_wait_event(automatic, passed));
+    auto d = VT::spawn(tp, co_wait_event(automatic, passed));
+    automatic.signal();
+    REQUIRE(VT::when_any(std::vector<VT::TaskFuture<int>>{ c, d }).get() < 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(passed.load() == 3);
+    automatic.signal();
+    c.wait();
+    d.wait();
+    REQUIRE(passed.load() == 4);
+    REQUIRE(!automatic.is_signaled());
+
+    auto sleeper = [](VT::ThreadPool& pool) -> VT::CoTask<double>
+    {
+        auto start = std::chrono::steady_clock::now();
+        co_await VT::sleep_for(pool, std::chrono::milliseconds(30));
+        co_return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    REQUIRE(VT::spawn(tp, sleeper(tp)).get() >= 30);
+}
+
+#endif